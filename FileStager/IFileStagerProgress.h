@@ -0,0 +1,59 @@
+#ifndef FILESTAGER_IFILESTAGERPROGRESS_H
+#define FILESTAGER_IFILESTAGERPROGRESS_H
+
+#include "GaudiKernel/IInterface.h"
+#include <string>
+
+
+/** @class IFileStagerProgress IFileStagerProgress.h FileStager/IFileStagerProgress.h
+ *
+ *   Extension of the IFileStagerSvc interface, implemented by the FileStagerSvc service:
+ *   the progress of the staging of a dataset and the estimated time until its local copy
+ *   is complete, for algorithms and event selectors deciding whether to wait for a file,
+ *   skip ahead or read it remotely.
+ *
+ *   @version 1.0
+ *
+*/
+class GAUDI_API IFileStagerProgress: virtual public IInterface
+{
+public:
+  /// InterfaceID
+  DeclareInterfaceID(IFileStagerProgress,1,0);
+
+  /// stage of the local copy of a dataset
+  enum State { UNKNOWN, QUEUED, STAGING, STAGED, FAILED, RELEASED };
+
+  /// progress of the staging of one dataset
+  struct Progress {
+    Progress() : state(UNKNOWN), bytesDone(0), bytesTotal(0), rate(0), eta(-1), retries(0) {}
+    State state;
+    /// bytes of the local copy written so far
+    unsigned long long bytesDone;
+    /// size of the dataset, 0 if not known yet
+    unsigned long long bytesTotal;
+    /// current transfer rate in bytes per second, 0 if not known
+    double rate;
+    /** estimated seconds until the local copy is complete: 0 once it is, negative if it
+     *  can not be estimated. For a QUEUED dataset, the duration of its transfer alone.
+     */
+    double eta;
+    /// attempts made after a failed transfer
+    int retries;
+    /// source of the current transfer attempt, or of the next one for a QUEUED dataset
+    std::string source;
+  };
+
+  /** Get the staging progress of a dataset specified in the job input.
+   *  Bytes written are measured from the growth of the local copy, or reported by the
+   *  transfer itself for range downloads; when neither is possible (preallocated copies),
+   *  they are estimated from the average throughput of the job.
+   *
+   * @param dataset the original dataset, as passed to IFileStagerSvc::getLocalDataset
+   * @param progress the progress of its staging
+   * @return Status code indicating success, or failure if the dataset is not handled by the stager.
+   */
+  virtual StatusCode getProgress(const std::string& dataset, Progress& progress) = 0;
+};
+
+#endif // FILESTAGER_IFILESTAGERPROGRESS_H
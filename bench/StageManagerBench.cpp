@@ -0,0 +1,213 @@
+// Microbenchmark of the StageManager bookkeeping at production input counts.
+// Times the calls made per input file by FileStagerSvc and the data managers
+// (addToList, getStatusOf, getTmpFilename, getLocalHandle, releaseFile and print)
+// with 1k, 10k and 100k tracked files, and the heap used per tracked file.
+// No grid calls are made: the transfers go to a backend which creates empty files.
+//
+// usage: StageManagerBench [nfiles ...] [--tmpdir dir]
+// Every size runs in its own child process, since the StageManager is a singleton.
+
+#include "../src/StageManager.h"
+#include "../src/ITransferBackend.h"
+
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace std ;
+
+//====================================================
+static double now() {
+  struct timeval tp;
+  gettimeofday( &tp, NULL );
+  return static_cast<double>( tp.tv_sec ) + static_cast<double>( tp.tv_usec )/1E6;
+}
+
+//====================================================
+static void report(const char* op, int nfiles, double seconds, int nops) {
+  printf("%-20s %8d files %12.1f ns/op\n", op, nfiles, seconds*1E9/nops);
+  fflush(stdout);
+}
+
+//====================================================
+static size_t heapInUse() {
+  struct mallinfo info = mallinfo();
+  return size_t((unsigned int)info.uordblks) + size_t((unsigned int)info.hblkhd);
+}
+
+/**  Backend of empty files: every file exists with size 0 and its copy creates
+ *   the empty local file, so that the files reach STAGED without any transfer.
+ */
+class EmptyFileBackend : public ITransferBackend {
+public:
+  string name() const {
+    return "empty";
+  }
+  bool accepts(const std::string&) const {
+    return true;
+  }
+  void configure(const vector<string>&) {}
+  int stat(const std::string&, unsigned long long& size) {
+    size = 0;
+    return 0;
+  }
+  int copy(const std::string&, const std::string& dest,
+           const TransferOptions&, std::string& error) {
+    string path(dest);
+    if (path.compare(0, 5, "file:")==0)
+      path.erase(0, 5);
+    int fd = open(path.c_str(), O_WRONLY|O_CREAT, 0644);
+    if (fd<0) {
+      error = "cannot create " + path;
+      return 1;
+    }
+    close(fd);
+    return 0;
+  }
+  int replicate(const std::string&, const std::string&, const TransferOptions&, std::string& error) {
+    error = "no replication";
+    return 1;
+  }
+  bool listReplicas(const std::string&, const TransferOptions&, vector<string>& replicas, std::string&) {
+    replicas.clear();
+    return true;
+  }
+  void cancel(const std::string&) {}
+  bool ranges() const {
+    return false;
+  }
+};
+
+//====================================================
+static void bench(int nfiles, const string& tmpdir) {
+  EmptyFileBackend backend;
+  StageManager& manager(StageManager::instance());
+  manager.setOutputLevel(MSG::FATAL);
+  manager.setTransferBackend(&backend);
+  manager.setTransferThreads(1);
+  manager.setProbeThreads(0);
+  manager.setReplicaRanking(false, "");
+  manager.setInfilePrefix("gfal:");
+  manager.setOutfilePrefix("file:");
+  manager.setBaseTmpdir(tmpdir);
+  manager.keepLogfiles(false);
+
+  vector<string> files;
+  for (int i=0; i<nfiles; ++i) {
+    char name[128];
+    sprintf(name, "gfal:LFN:/lhcb/data/2010/DST/00001234/0000/00001234_%08d_1.dst", i);
+    files.push_back(name);
+  }
+  // the lookups of the later phases, in an order unrelated to the insertion order
+  vector<int> order(nfiles);
+  for (int i=0; i<nfiles; ++i)
+    order[i] = int((i*2654435761U) % (unsigned int)nfiles);
+
+  size_t heapBefore = heapInUse();
+
+  // FileStagerSvc::loadStager()
+  double start = now();
+  for (int i=0; i<nfiles; ++i)
+    manager.addToList(files[i]);
+  report("addToList", nfiles, now()-start, nfiles);
+
+  start = now();
+  int queued(0);
+  for (int i=0; i<nfiles; ++i)
+    if (manager.getStatusOf(files[order[i]])==StageFileInfo::TOBESTAGED)
+      ++queued;
+  report("getStatusOf/queued", nfiles, now()-start, nfiles);
+
+  start = now();
+  for (int i=0; i<nfiles; ++i)
+    manager.getTmpFilename(files[order[i]]);
+  report("getTmpFilename", nfiles, now()-start, nfiles);
+
+  // stages every file, so that the following lookups hit the stage map
+  start = now();
+  for (int i=0; i<nfiles; ++i)
+    manager.getFile(files[i]);
+  report("getFile", nfiles, now()-start, nfiles);
+
+  size_t heapTracked = heapInUse();
+
+  start = now();
+  int staged(0);
+  for (int i=0; i<nfiles; ++i)
+    if (manager.getStatusOf(files[order[i]])==StageFileInfo::STAGED)
+      ++staged;
+  report("getStatusOf/staged", nfiles, now()-start, nfiles);
+
+  start = now();
+  string local;
+  for (int i=0; i<nfiles; ++i)
+    manager.getLocalHandle(files[order[i]], local);
+  report("getLocalHandle", nfiles, now()-start, nfiles);
+
+  // the per-file report goes to the standard output
+  fflush(stdout);
+  int savedStdout = dup(1);
+  int devnull = open("/dev/null", O_WRONLY);
+  dup2(devnull, 1);
+  start = now();
+  manager.print();
+  double printTime = now()-start;
+  fflush(stdout);
+  dup2(savedStdout, 1);
+  close(devnull);
+  close(savedStdout);
+  report("print", nfiles, printTime, nfiles);
+
+  start = now();
+  for (int i=0; i<nfiles; ++i)
+    manager.releaseFile(files[i]);
+  report("releaseFile", nfiles, now()-start, nfiles);
+
+  printf("%-20s %8d files %12.1f bytes/file (%d queued, %d staged)\n", "memory", nfiles,
+         double(heapTracked-heapBefore)/nfiles, queued, staged);
+}
+
+//====================================================
+int main(int argc, char** argv) {
+  vector<int> sizes;
+  string tmpdir("/tmp");
+  for (int i=1; i<argc; ++i) {
+    if (string(argv[i])=="--tmpdir" && i+1<argc)
+      tmpdir = argv[++i];
+    else if (atoi(argv[i])>0)
+      sizes.push_back(atoi(argv[i]));
+  }
+  if (sizes.empty()) {
+    sizes.push_back(1000);
+    sizes.push_back(10000);
+    sizes.push_back(100000);
+  }
+
+  for (unsigned int i=0; i<sizes.size(); ++i) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid==0) {
+      // the per-job directory is named after the pid of the parent, known to StagerInfo
+      // since the static initialisation: each child needs its own base directory
+      char base[64];
+      sprintf(base, "/StageManagerBench_%d", sizes[i]);
+      mkdir((tmpdir+base).c_str(), 0700);
+      bench(sizes[i], tmpdir+base);
+      fflush(stdout);
+      // skips the StageManager destructor and its report
+      _exit(0);
+    }
+    int status(0);
+    if (pid<0 || waitpid(pid, &status, 0)!=pid || !WIFEXITED(status) || WEXITSTATUS(status)!=0)
+      printf("run with %d files failed\n", sizes[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,133 @@
+// Benchmark of the StageManager staging queue bookkeeping.
+// Compares the indexed StageQueue with the plain std::list + find()
+// it replaces, for the operations done per input file by
+// FileStagerSvc::loadStager() and StageManager::getFile()/releaseFile().
+// The cost per operation of StageQueue should stay flat as the list grows.
+
+#include "../src/StageQueue.h"
+
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <list>
+#include <string>
+#include <vector>
+
+using namespace std ;
+
+//====================================================
+static double now() {
+  struct timeval tp;
+  gettimeofday( &tp, NULL );
+  return static_cast<double>( tp.tv_sec ) + static_cast<double>( tp.tv_usec )/1E6;
+}
+
+//====================================================
+static void report(const char* impl, const char* op, int nfiles, double seconds, int nops) {
+  printf("%-10s %-12s %8d files %12.1f ns/op\n", impl, op, nfiles, seconds*1E9/nops);
+}
+
+//====================================================
+static void benchList(const vector<string>& names, const vector<string>& lookups) {
+  int nfiles = int(names.size());
+  list<string> queue;
+
+  // addToList(): push_back unless already queued
+  double start = now();
+  for (int i=0; i<nfiles; ++i) {
+    if (find(queue.begin(),queue.end(),names[i])==queue.end())
+      queue.push_back(names[i]);
+  }
+  report("list", "addToList", nfiles, now()-start, nfiles);
+
+  // getStatusOf(): membership
+  int found(0);
+  start = now();
+  for (unsigned int i=0; i<lookups.size(); ++i) {
+    if (find(queue.begin(),queue.end(),lookups[i])!=queue.end())
+      ++found;
+  }
+  report("list", "contains", nfiles, now()-start, int(lookups.size()));
+
+  // getFile(): forced staging moves the file to the front
+  start = now();
+  for (unsigned int i=0; i<lookups.size(); ++i) {
+    list<string>::iterator itrF = find(queue.begin(),queue.end(),lookups[i]);
+    if (itrF!=queue.end()) {
+      queue.erase(itrF);
+      queue.push_front(lookups[i]);
+    }
+  }
+  report("list", "moveToFront", nfiles, now()-start, int(lookups.size()));
+
+  // releaseFile(): removal
+  start = now();
+  for (unsigned int i=0; i<lookups.size(); ++i) {
+    list<string>::iterator itrF = find(queue.begin(),queue.end(),lookups[i]);
+    if (itrF!=queue.end())
+      queue.erase(itrF);
+  }
+  report("list", "erase", nfiles, now()-start, int(lookups.size()));
+  if (found!=int(lookups.size()))
+    printf("unexpected misses: %d\n", int(lookups.size())-found);
+}
+
+//====================================================
+static void benchQueue(const vector<string>& names, const vector<string>& lookups) {
+  int nfiles = int(names.size());
+  StageQueue queue;
+
+  double start = now();
+  for (int i=0; i<nfiles; ++i)
+    queue.push_back(names[i]);
+  report("StageQueue", "addToList", nfiles, now()-start, nfiles);
+
+  int found(0);
+  start = now();
+  for (unsigned int i=0; i<lookups.size(); ++i) {
+    if (queue.contains(lookups[i]))
+      ++found;
+  }
+  report("StageQueue", "contains", nfiles, now()-start, int(lookups.size()));
+
+  start = now();
+  for (unsigned int i=0; i<lookups.size(); ++i) {
+    if (queue.contains(lookups[i]))
+      queue.push_front(lookups[i]);
+  }
+  report("StageQueue", "moveToFront", nfiles, now()-start, int(lookups.size()));
+
+  start = now();
+  for (unsigned int i=0; i<lookups.size(); ++i)
+    queue.erase(lookups[i]);
+  report("StageQueue", "erase", nfiles, now()-start, int(lookups.size()));
+  if (found!=int(lookups.size()))
+    printf("unexpected misses: %d\n", int(lookups.size())-found);
+}
+
+//====================================================
+int main(int argc, const char** argv) {
+  // the std::list runs take most of the time; they can be skipped with "-q"
+  bool skipList = (argc>1 && string(argv[1])=="-q");
+  const int sizes[] = { 1000, 5000, 20000, 50000 };
+  const int nlookups = 1000;
+
+  srand(12345);
+  for (unsigned int s=0; s<sizeof(sizes)/sizeof(sizes[0]); ++s) {
+    vector<string> names;
+    char buf[128];
+    for (int i=0; i<sizes[s]; ++i) {
+      sprintf(buf, "gfal:lfn:/grid/lhcb/data/2010/DST/00006563/0000/00006563_%08d_1.dst", i);
+      names.push_back(buf);
+    }
+    vector<string> lookups;
+    for (int i=0; i<nlookups; ++i)
+      lookups.push_back(names[rand()%sizes[s]]);
+
+    benchQueue(names, lookups);
+    if (!skipList)
+      benchList(names, lookups);
+  }
+  return 0;
+}
@@ -0,0 +1,384 @@
+// End-to-end benchmark of the staging pipeline against a simulated storage element.
+// Drives the StageManager through the call sequence of FileStagerSvc
+// (addToList() for all inputs, then getFile()/releaseFile() per input file, and
+// processCompletions() on every event), with transfers served by a local
+// simulated SE of configurable bandwidth, latency, jitter and failure rate.
+// Reports the job wall time, the total time blocked in getFile(), the time to
+// the first event and the peak scratch space, so that pipeline policies
+// (PipeSize, ParallelStreams, retries, ...) can be compared run by run.
+//
+// usage: StagingPipelineBench [--option value ...], see usage() for the options.
+// One configuration per run: the StageManager is a process-wide singleton.
+
+#include "../src/StageManager.h"
+#include "../src/ITransferBackend.h"
+
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace std ;
+
+//====================================================
+static double now() {
+  struct timeval tp;
+  gettimeofday( &tp, NULL );
+  return static_cast<double>( tp.tv_sec ) + static_cast<double>( tp.tv_usec )/1E6;
+}
+
+//====================================================
+static void sleepFor(double seconds) {
+  if (seconds>0)
+    usleep(useconds_t(seconds*1E6));
+}
+
+/// Settings of one run
+struct BenchConfig {
+  BenchConfig()
+      : nfiles(50), sizeMB(200), bandwidth(400), streamBandwidth(50), latency(0.5), jitter(0.2)
+      , failureRate(0), processing(2), eventTime(0.01), pipeLength(1), streams(1), threads(0)
+      , maxRetries(2), retryBackoff(1), budgetMB(0), tmpdir("/tmp"), seed(1), verbose(false) {}
+  int nfiles;
+  double sizeMB;
+  /// MB/s of the link to the SE, shared by the running transfers
+  double bandwidth;
+  /// MB/s of one stream of a transfer
+  double streamBandwidth;
+  /// seconds before the first byte of a transfer (and of a stat), +- jitter
+  double latency;
+  double jitter;
+  /// probability of a transfer failing halfway
+  double failureRate;
+  /// seconds of processing per file, and per event within it
+  double processing;
+  double eventTime;
+  int pipeLength;
+  int streams;
+  int threads;
+  int maxRetries;
+  double retryBackoff;
+  int budgetMB;
+  string tmpdir;
+  unsigned int seed;
+  bool verbose;
+};
+
+/**  Simulated storage element: the files "sim:/se/file_N" exist with a fixed size and
+ *   their copies write zeros at the simulated rate. The link bandwidth is shared by the
+ *   transfers running at the same time; each transfer gets at most streams times the
+ *   bandwidth of one stream. The counters live in shared memory, so that transfers in
+ *   forked children (TransferThreads = 0) are accounted for as well.
+ */
+class SimulatedStorage : public ITransferBackend {
+public:
+
+  SimulatedStorage(const BenchConfig& config)
+      : m_config(config) {
+    void* shared = mmap(0, sizeof(Counters), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    m_counters = (shared==MAP_FAILED) ? new Counters : static_cast<Counters*>(shared);
+    m_counters->active = m_counters->transfers = m_counters->failures = 0;
+  }
+
+  string name() const {
+    return "sim";
+  }
+  bool accepts(const std::string& source) const {
+    return source.compare(0, 4, "sim:")==0;
+  }
+  void configure(const vector<string>&) {}
+
+  int stat(const std::string& source, unsigned long long& size) {
+    sleepFor(delay());
+    if (!accepts(source))
+      return ENOENT;
+    size = (unsigned long long)(m_config.sizeMB*1024*1024);
+    return 0;
+  }
+
+  int copy(const std::string& source, const std::string& dest,
+           const TransferOptions& options, std::string& error) {
+    string path(dest);
+    if (path.compare(0, 5, "file:")==0)
+      path.erase(0, 5);
+    unsigned long long size(0);
+    if (stat(source, size)!=0) {
+      error = "no such file " + source;
+      return 1;
+    }
+    // drawn per transfer: forked children share the state of their parent
+    unsigned int seed = m_config.seed + 7919*__sync_add_and_fetch(&m_counters->transfers, 1);
+    bool fail = double(rand_r(&seed))/RAND_MAX < m_config.failureRate;
+
+    int fd = open(path.c_str(), O_WRONLY|O_CREAT, 0644);
+    if (fd<0) {
+      error = "cannot create " + path + ": " + strerror(errno);
+      return 1;
+    }
+
+    __sync_add_and_fetch(&m_counters->active, 1);
+
+    const size_t chunk = 1024*1024;
+    vector<char> zeros(chunk, 0);
+    unsigned long long done(0);
+    int rc(0);
+    while (done<size) {
+      if (fail && done>=size/2) {
+        error = "simulated transfer failure of " + source;
+        rc = 1;
+        break;
+      }
+      size_t n = (size-done<chunk) ? size_t(size-done) : chunk;
+      if (pwrite(fd, &zeros[0], n, done)!=ssize_t(n)) {
+        error = "cannot write " + path + ": " + strerror(errno);
+        rc = 1;
+        break;
+      }
+      done += n;
+      sleepFor(n/(1024.*1024.)/rate(options.nbstreams));
+    }
+    if (rc==0 && ftruncate(fd, size)!=0)
+      rc = 1;
+    close(fd);
+
+    __sync_sub_and_fetch(&m_counters->active, 1);
+    if (rc!=0)
+      __sync_add_and_fetch(&m_counters->failures, 1);
+    return rc;
+  }
+
+  int replicate(const std::string& source, const std::string&,
+                const TransferOptions&, std::string& error) {
+    error = "no replication on the simulated SE: " + source;
+    return 1;
+  }
+  bool listReplicas(const std::string&, const TransferOptions&,
+                    vector<string>& replicas, std::string&) {
+    replicas.clear();
+    return true;
+  }
+  void cancel(const std::string&) {}
+  bool ranges() const {
+    return false;
+  }
+
+  int transfers() const {
+    return m_counters->transfers;
+  }
+  int failures() const {
+    return m_counters->failures;
+  }
+
+private:
+  struct Counters {
+    volatile int active;
+    volatile int transfers;
+    volatile int failures;
+  };
+
+  double delay() {
+    unsigned int seed = m_config.seed + (unsigned int)(now()*1E6);
+    double value = m_config.latency + m_config.jitter*(2*double(rand_r(&seed))/RAND_MAX-1);
+    return value>0 ? value : 0;
+  }
+  /// current MB/s of one transfer
+  double rate(int nbstreams) {
+    int active = m_counters->active;
+    double shared = m_config.bandwidth/(active>0 ? active : 1);
+    double own = m_config.streamBandwidth*(nbstreams>0 ? nbstreams : 1);
+    return (shared<own) ? shared : own;
+  }
+
+  const BenchConfig& m_config;
+  Counters* m_counters;
+};
+
+//====================================================
+/// Samples the bytes held in the scratch directory until stopped
+struct ScratchSampler {
+  string dir;
+  volatile bool stop;
+  unsigned long long peak;
+
+  static void* run(void* arg) {
+    ScratchSampler* sampler = static_cast<ScratchSampler*>(arg);
+    while (!sampler->stop) {
+      unsigned long long used = sampler->usage();
+      if (used>sampler->peak)
+        sampler->peak = used;
+      usleep(20000);
+    }
+    return 0;
+  }
+
+  unsigned long long usage() const {
+    unsigned long long used(0);
+    DIR* dp = opendir(dir.c_str());
+    if (!dp)
+      return 0;
+    struct dirent* dirp;
+    while ((dirp = readdir(dp)) != NULL) {
+      struct stat statbuf;
+      string path = dir + "/" + dirp->d_name;
+      if (stat(path.c_str(), &statbuf)==0 && S_ISREG(statbuf.st_mode))
+        used += (unsigned long long)statbuf.st_blocks*512;
+    }
+    closedir(dp);
+    return used;
+  }
+};
+
+//====================================================
+static void usage(const char* program) {
+  printf("usage: %s [options]\n"
+         "  --files N            input files (50)\n"
+         "  --size MB            size of each file (200)\n"
+         "  --bandwidth MB/s     link to the simulated SE, shared (400)\n"
+         "  --stream-bw MB/s     bandwidth of one stream (50)\n"
+         "  --latency s          delay before the first byte (0.5)\n"
+         "  --jitter s           +- on the latency (0.2)\n"
+         "  --failure p          probability of a failed transfer (0)\n"
+         "  --processing s       processing time per file (2)\n"
+         "  --event s            processing time per event (0.01)\n"
+         "  --pipe N             PipeSize (1)\n"
+         "  --streams N          ParallelStreams (1)\n"
+         "  --threads N          TransferThreads, 0 to fork (0)\n"
+         "  --retries N          MaxRetries (2)\n"
+         "  --backoff s          RetryBackoff (1)\n"
+         "  --budget MB          PrefetchBudgetMB (0)\n"
+         "  --tmpdir dir         BaseTmpdir (/tmp)\n"
+         "  --seed N             random seed (1)\n"
+         "  --verbose            StageManager messages\n", program);
+}
+
+//====================================================
+static bool parse(int argc, char** argv, BenchConfig& config) {
+  for (int i=1; i<argc; ++i) {
+    string option(argv[i]);
+    if (option=="--verbose") {
+      config.verbose = true;
+      continue;
+    }
+    if (i+1>=argc)
+      return false;
+    const char* value = argv[++i];
+    if (option=="--files") config.nfiles = atoi(value);
+    else if (option=="--size") config.sizeMB = atof(value);
+    else if (option=="--bandwidth") config.bandwidth = atof(value);
+    else if (option=="--stream-bw") config.streamBandwidth = atof(value);
+    else if (option=="--latency") config.latency = atof(value);
+    else if (option=="--jitter") config.jitter = atof(value);
+    else if (option=="--failure") config.failureRate = atof(value);
+    else if (option=="--processing") config.processing = atof(value);
+    else if (option=="--event") config.eventTime = atof(value);
+    else if (option=="--pipe") config.pipeLength = atoi(value);
+    else if (option=="--streams") config.streams = atoi(value);
+    else if (option=="--threads") config.threads = atoi(value);
+    else if (option=="--retries") config.maxRetries = atoi(value);
+    else if (option=="--backoff") config.retryBackoff = atof(value);
+    else if (option=="--budget") config.budgetMB = atoi(value);
+    else if (option=="--tmpdir") config.tmpdir = value;
+    else if (option=="--seed") config.seed = atoi(value);
+    else return false;
+  }
+  return config.nfiles>0 && config.eventTime>0;
+}
+
+//====================================================
+int main(int argc, char** argv) {
+  BenchConfig config;
+  if (!parse(argc, argv, config)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  SimulatedStorage storage(config);
+  StageManager& manager(StageManager::instance());
+  // as FileStagerSvc::configStager()
+  manager.setOutputLevel(config.verbose ? MSG::INFO : MSG::FATAL);
+  manager.setTransferBackend(&storage);
+  manager.setPipeLength(config.pipeLength);
+  manager.setParallelStreams(config.streams);
+  manager.setTransferThreads(config.threads);
+  manager.setRetries(config.maxRetries, config.retryBackoff);
+  manager.setPrefetchBudget((unsigned long long)config.budgetMB*1024*1024, 0);
+  manager.setReplicaRanking(false, "");
+  manager.setInfilePrefix("gfal:");
+  manager.setOutfilePrefix("file:");
+  manager.setBaseTmpdir(config.tmpdir);
+  manager.keepLogfiles(false);
+
+  vector<string> files;
+  for (int i=0; i<config.nfiles; ++i) {
+    char name[64];
+    sprintf(name, "gfal:sim:/se/file_%06d", i);
+    files.push_back(name);
+  }
+
+  ScratchSampler sampler;
+  sampler.dir = manager.getStagerInfo().tmpdir;
+  sampler.stop = false;
+  sampler.peak = 0;
+  pthread_t samplerThread;
+  bool sampling = (pthread_create(&samplerThread, 0, &ScratchSampler::run, &sampler)==0);
+
+  double start = now();
+  // FileStagerSvc::loadStager()
+  for (unsigned int i=0; i<files.size(); ++i)
+    manager.addToList(files[i]);
+
+  double waited(0);
+  double firstEvent(-1);
+  int unstaged(0);
+  int nevents = int(config.processing/config.eventTime + 0.5);
+  for (unsigned int i=0; i<files.size(); ++i) {
+    // FileStagerSvc::setupNextFile()
+    double before = now();
+    manager.getFile(files[i]);
+    waited += now()-before;
+
+    string local;
+    if (!manager.getLocalHandle(files[i], local).isSuccess())
+      ++unstaged;
+    if (firstEvent<0)
+      firstEvent = now()-start;
+
+    // BeginEvent incidents
+    for (int event=0; event<nevents; ++event) {
+      manager.processCompletions();
+      sleepFor(config.eventTime);
+    }
+
+    // FileStagerSvc::releasePrevFile()
+    manager.releaseFile(files[i]);
+  }
+  double wall = now()-start;
+
+  if (sampling) {
+    sampler.stop = true;
+    pthread_join(samplerThread, 0);
+  }
+
+  double ideal = config.nfiles*nevents*config.eventTime;
+  printf("files %d x %.0f MB, pipe %d, streams %d, threads %d, link %.0f MB/s, stream %.0f MB/s, "
+         "latency %.2f+-%.2f s, failure rate %.2f\n",
+         config.nfiles, config.sizeMB, config.pipeLength, config.streams, config.threads,
+         config.bandwidth, config.streamBandwidth, config.latency, config.jitter, config.failureRate);
+  printf("wall time          %10.2f s (processing alone %.2f s)\n", wall, ideal);
+  printf("wait in getFile    %10.2f s\n", waited);
+  printf("time to 1st event  %10.2f s\n", firstEvent);
+  printf("peak scratch       %10.1f MB\n", sampler.peak/(1024.*1024.));
+  printf("transfers          %10d (%d failed, %d files not staged)\n",
+         storage.transfers(), storage.failures(), unstaged);
+  return 0;
+}
@@ -0,0 +1,152 @@
+#include "Adler32.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace ba = boost::algorithm;
+
+namespace {
+  const unsigned long s_base = 65521;
+  /// largest n such that 255n(n+1)/2 + (n+1)(BASE-1) fits in 32 bits
+  const size_t s_nmax = 5552;
+  /// bytes read per call by ofFile
+  const size_t s_readSize = 1024*1024;
+
+#ifdef __SSE2__
+  /** Sums of a multiple of 16 bytes: the plain byte sum and the sum of each byte
+   *  weighted by its distance to the end of the block
+   */
+  void sums16(const unsigned char* buf, size_t len,
+              unsigned long long& sum, unsigned long long& weighted) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weightsHi = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i weightsLo = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    __m128i vs1 = zero;
+    __m128i vs2 = zero;
+    // sum over the 16 byte steps of the byte sum before the step
+    __m128i vprefix = zero;
+
+    for (size_t i=0; i<len; i+=16) {
+      __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf+i));
+      vprefix = _mm_add_epi32(vprefix, vs1);
+      vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(bytes, zero));
+      vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weightsHi));
+      vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weightsLo));
+    }
+
+    unsigned int lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vs1);
+    sum = (unsigned long long)lanes[0] + lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vprefix);
+    weighted = 16*((unsigned long long)lanes[0] + lanes[2]);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vs2);
+    weighted += (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+#endif
+}
+
+const unsigned long Adler32::initial;
+
+//====================================================
+unsigned long Adler32::update(unsigned long adler, const unsigned char* buf, size_t len) {
+  unsigned long long s1 = adler & 0xffff;
+  unsigned long long s2 = (adler >> 16) & 0xffff;
+
+  while (len>0) {
+    size_t n = (len<s_nmax) ? len : s_nmax;
+    len -= n;
+
+#ifdef __SSE2__
+    size_t vectorLen = n & ~size_t(15);
+    if (vectorLen>0) {
+      unsigned long long sum, weighted;
+      sums16(buf, vectorLen, sum, weighted);
+      s2 += s1*vectorLen + weighted;
+      s1 += sum;
+      buf += vectorLen;
+      n -= vectorLen;
+    }
+#endif
+    while (n--) {
+      s1 += *buf++;
+      s2 += s1;
+    }
+    s1 %= s_base;
+    s2 %= s_base;
+  }
+  return (unsigned long)(s2 << 16 | s1);
+}
+
+
+//====================================================
+unsigned long Adler32::combine(unsigned long adler1, unsigned long adler2, unsigned long long len2) {
+  // as in zlib's adler32_combine
+  unsigned long rem = (unsigned long)(len2 % s_base);
+  unsigned long sum1 = adler1 & 0xffff;
+  unsigned long sum2 = (rem * sum1) % s_base;
+  sum1 += (adler2 & 0xffff) + s_base - 1;
+  sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + s_base - rem;
+  if (sum1 >= s_base) sum1 -= s_base;
+  if (sum1 >= s_base) sum1 -= s_base;
+  if (sum2 >= (s_base << 1)) sum2 -= (s_base << 1);
+  if (sum2 >= s_base) sum2 -= s_base;
+  return sum1 | (sum2 << 16);
+}
+
+
+//====================================================
+bool Adler32::ofFile(const std::string& path, unsigned long& adler) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd<0)
+    return false;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  vector<unsigned char> buffer(s_readSize);
+  adler = initial;
+  while (true) {
+    ssize_t got = read(fd, &buffer[0], buffer.size());
+    if (got<0 && errno==EINTR)
+      continue;
+    if (got<0) {
+      close(fd);
+      return false;
+    }
+    if (got==0)
+      break;
+    adler = update(adler, &buffer[0], got);
+  }
+  close(fd);
+  return true;
+}
+
+
+//====================================================
+bool Adler32::parse(const std::string& text, unsigned long& adler) {
+  string value = ba::to_lower_copy(ba::trim_copy(text));
+  if (ba::starts_with(value, "adler32:"))
+    value.erase(0, 8);
+  else if (ba::starts_with(value, "ad:"))
+    value.erase(0, 3);
+  if (value.empty() || value.size()>8)
+    return false;
+
+  char* end(0);
+  adler = strtoul(value.c_str(), &end, 16);
+  return *end=='\0';
+}
+
+
+//====================================================
+string Adler32::format(unsigned long adler) {
+  char text[16];
+  sprintf(text, "%08lx", adler);
+  return text;
+}
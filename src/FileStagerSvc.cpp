@@ -5,6 +5,7 @@
 #include "GaudiKernel/SvcFactory.h"
 #include "GaudiKernel/IIncidentSvc.h"
 #include "GaudiKernel/IToolSvc.h"
+#include "GaudiKernel/IMonitorSvc.h"
 #include "GaudiKernel/Service.h"
 #include "GaudiKernel/IIncidentListener.h"
 #include "StageManager.h"
@@ -33,6 +34,25 @@ namespace ba = boost::algorithm;
 FileStagerSvc::FileStagerSvc(const std::string& nam, ISvcLocator* svcLoc) :
     base_class(nam,svcLoc)
     , m_pipeSize(1)
+    , m_adaptivePipe(false)
+    , m_minPipeSize(1)
+    , m_maxPipeSize(5)
+    , m_prefetchBudgetMB(0)
+    , m_prefetchFreeFraction(0.)
+    , m_preallocate(false)
+    , m_progressiveRead(false)
+    , m_progressiveStall(30.)
+    , m_transferThreads(0)
+    , m_probeThreads(4)
+    , m_rangeSizeMB(0)
+    , m_rangeStreams(4)
+    , m_rangeReplicas(true)
+    , m_maxRetries(0)
+    , m_retryBackoff(5.)
+    , m_attemptTimeout(500)
+    , m_rankReplicas(false)
+    , m_nodeCacheSizeMB(0)
+    , m_catalogChecksums(true)
     , m_infilePrefix("gfal:")
     , m_outfilePrefix("file:")
     , m_keepLogfiles(false)
@@ -40,6 +60,7 @@ FileStagerSvc::FileStagerSvc(const std::string& nam, ISvcLocator* svcLoc) :
     , m_toolSvc(0)
     , m_prevFile("")
     , m_incidentSvc(0)
+    , m_monitorSvc(0)
     , m_inCollection(0)
     , m_is_collection(false)
     , m_firstFileInStream(true)
@@ -47,8 +68,40 @@ FileStagerSvc::FileStagerSvc(const std::string& nam, ISvcLocator* svcLoc) :
 /*, m_fallbackDir("/project/bfys/")*/ {
   //------------------------------------------------------------------------------
   m_initialized = false;
+  m_progressiveExtensions.push_back(".raw");
+  m_progressiveExtensions.push_back(".mdf");
+  if (getenv("HOME"))
+    m_replicaModel = string(getenv("HOME")) + "/.FileStagerReplicas";
 
   declareProperty("PipeSize", m_pipeSize);
+  declareProperty("AdaptivePipe", m_adaptivePipe);
+  declareProperty("MinPipeSize", m_minPipeSize);
+  declareProperty("MaxPipeSize", m_maxPipeSize);
+  declareProperty("PrefetchBudgetMB", m_prefetchBudgetMB);
+  declareProperty("PrefetchFreeFraction", m_prefetchFreeFraction);
+  declareProperty("PreallocateSpace", m_preallocate);
+  declareProperty("ProgressiveRead", m_progressiveRead);
+  declareProperty("ProgressiveExtensions", m_progressiveExtensions);
+  declareProperty("ProgressiveStallTimeout", m_progressiveStall);
+  declareProperty("TransferThreads", m_transferThreads);
+  declareProperty("ProbeThreads", m_probeThreads);
+  declareProperty("RangeSizeMB", m_rangeSizeMB);
+  declareProperty("RangeStreams", m_rangeStreams);
+  declareProperty("RangeReplicas", m_rangeReplicas);
+  declareProperty("MaxRetries", m_maxRetries);
+  declareProperty("RetryBackoff", m_retryBackoff);
+  declareProperty("AttemptTimeout", m_attemptTimeout);
+  declareProperty("RankReplicas", m_rankReplicas);
+  declareProperty("ReplicaModelFile", m_replicaModel);
+  declareProperty("NodeCacheDir", m_nodeCacheDir);
+  declareProperty("NodeCacheSizeMB", m_nodeCacheSizeMB);
+  declareProperty("Checksums", m_checksums);
+  declareProperty("CatalogChecksums", m_catalogChecksums);
+  declareProperty("TimelineTraceFile", m_timelineTrace);
+  declareProperty("TimelineCsvFile", m_timelineCsv);
+  declareProperty("StatusBoardFile", m_statusBoardFile);
+  declareProperty("TransferBackend", m_cpCommand = "auto");
+  declareProperty("TransferBackendArgs", m_cpArg);
   declareProperty("InfilePrefix", m_infilePrefix);
   declareProperty("OutfilePrefix", m_outfilePrefix);
   declareProperty("BaseTmpdir", m_baseTmpdir);
@@ -87,6 +140,7 @@ FileStagerSvc::initialize() {
 
   m_incidentSvc->addListener(this, IncidentType::BeginInputFile);
   m_incidentSvc->addListener(this, IncidentType::EndInputFile);
+  m_incidentSvc->addListener(this, IncidentType::BeginEvent);
 
   log << MSG::DEBUG << "Added listeners on begin and end of input files." << endmsg;
 
@@ -96,6 +150,7 @@ FileStagerSvc::initialize() {
   log << MSG::DEBUG << "Configuring File Stager Service." << endmsg;
   configStager();
   log << MSG::DEBUG << "File Stager Service configured!" << endmsg;
+  declareMetrics();
   loadStager();
   log << MSG::DEBUG << "Stager loaded..." << endmsg;
   setupNextFile();
@@ -108,6 +163,12 @@ FileStagerSvc::initialize() {
 //====================================================
 void
 FileStagerSvc::handle(const Incident& inc) {
+  if (inc.type() == IncidentType::BeginEvent) {
+    // finished transfers are picked up between events, freeing their pipeline slot
+    StageManager::instance().processCompletions();
+    return;
+  }
+
   MsgStream log(msgSvc(), name());
   log << MSG::INFO << "Handling incident '" << inc.type() << "'" << endmsg;
   log << MSG::INFO << "Incident source '" << inc.source() << "'" << endmsg;
@@ -117,7 +178,9 @@ FileStagerSvc::handle(const Incident& inc) {
       m_is_collection = true;
     else
       m_is_collection = false;
+    StageManager::instance().beginInputFile(m_currentFile);
   } else if (inc.type() == IncidentType::EndInputFile) {
+    StageManager::instance().endInputFile(m_currentFile);
     if(m_releaseFiles)
       releasePrevFile();
     setupNextFile();
@@ -133,6 +196,12 @@ FileStagerSvc::~FileStagerSvc() {}
 StatusCode FileStagerSvc::finalize() {
   // /------------------------------------------------------------------------------
   MsgStream log(msgSvc(), name());
+  StageManager::instance().saveReplicaModel();
+  StageManager::instance().writeTimeline();
+  StageManager::instance().reportStalls();
+  if (m_monitorSvc)
+    m_monitorSvc->undeclareAll(this);
+  m_monitorSvc = 0;
   m_toolSvc = 0;
   m_incidentSvc = 0;
   log << MSG::DEBUG << name() << ": Finalize() successful" << endmsg;
@@ -174,6 +243,17 @@ StatusCode FileStagerSvc::getLocalDataset(const std::string& dataset, std::strin
   return sc;
 }
 
+
+//====================================================
+
+StatusCode FileStagerSvc::getProgress(const std::string& dataset, Progress& progress) {
+  string dset = dataset;
+  ba::replace_first(dset , "FID:", "gfal:guid:");
+  if (!StageManager::instance().getProgress(dset, progress))
+    return StatusCode::FAILURE;
+  return StatusCode::SUCCESS;
+}
+
 //====================================================
 void FileStagerSvc::configStager() {
   MsgStream log(msgSvc(), name());
@@ -182,13 +262,41 @@ void FileStagerSvc::configStager() {
   StageManager& manager(StageManager::instance());
   manager.setOutputLevel(outputLevel());
   manager.setPipeLength(m_pipeSize);
+  if (m_adaptivePipe)
+    manager.setAdaptivePipe(m_minPipeSize, m_maxPipeSize);
+  manager.setPrefetchBudget((unsigned long long)m_prefetchBudgetMB*1024*1024, m_prefetchFreeFraction);
+  manager.setPreallocate(m_preallocate);
+  manager.setTransferThreads(m_transferThreads);
+  manager.setProbeThreads(m_probeThreads);
+  manager.setRangeDownload((unsigned long long)m_rangeSizeMB*1024*1024, m_rangeStreams, m_rangeReplicas);
+  manager.setRetries(m_maxRetries, m_retryBackoff);
+  manager.setTimeout(m_attemptTimeout);
+  manager.setReplicaRanking(m_rankReplicas, m_replicaModel);
+  manager.setCpCommand(m_cpCommand);
+  for (unsigned int i=0; i<m_cpArg.size(); ++i)
+    manager.addCpArg(m_cpArg[i]);
+  if (!m_nodeCacheDir.empty())
+    manager.setNodeCache(m_nodeCacheDir, m_nodeCacheSizeMB>0 ? (unsigned long long)m_nodeCacheSizeMB*1024*1024 : 0);
   manager.setParallelStreams(m_parallelStreams);
+  if (m_progressiveRead) {
+    // the local file size only tells how much can be read if it is written in order
+    if (m_preallocate || m_parallelStreams>1 || m_rangeSizeMB>0)
+      log << MSG::WARNING << "ProgressiveRead needs ParallelStreams = 1, no PreallocateSpace and no RangeSizeMB, "
+      << "files are read once fully staged." << endmsg;
+    else
+      manager.setProgressiveRead(m_progressiveExtensions, m_progressiveStall);
+  }
   manager.keepLogfiles(m_keepLogfiles);
 
   if (!m_infilePrefix.empty())
     manager.setInfilePrefix(m_infilePrefix);
   if (!m_outfilePrefix.empty())
     manager.setOutfilePrefix(m_outfilePrefix);
+  // keyed like the input files, so after the prefixes
+  manager.setChecksums(m_checksums, m_catalogChecksums);
+  manager.setTimeline(m_timelineTrace, m_timelineCsv);
+  if (!m_statusBoardFile.empty())
+    manager.setStatusBoard(m_statusBoardFile);
 
   if (!m_baseTmpdir.empty())
     manager.setBaseTmpdir(m_baseTmpdir);
@@ -209,12 +317,45 @@ void FileStagerSvc::configStager() {
 }
 
 
+//====================================================
+void FileStagerSvc::declareMetrics() {
+  MsgStream log(msgSvc(), name());
+  // optional: most jobs run without a MonitorSvc
+  if (!service("MonitorSvc", m_monitorSvc, false).isSuccess() || !m_monitorSvc) {
+    m_monitorSvc = 0;
+    return;
+  }
+
+  StageManager& manager(StageManager::instance());
+  manager.enableLiveMetrics();
+  // the figures are members of the StageManager singleton, refreshed by processCompletions()
+  const StageStatusBoard::Snapshot& metrics = manager.liveMetrics();
+  m_monitorSvc->declareInfo("StagerQueued", metrics.queued, "input files waiting to be staged", this);
+  m_monitorSvc->declareInfo("StagerStaging", metrics.staging, "input files being staged", this);
+  m_monitorSvc->declareInfo("StagerStaged", metrics.staged, "input files staged so far", this);
+  m_monitorSvc->declareInfo("StagerFailed", metrics.failed, "input files which could not be staged", this);
+  m_monitorSvc->declareInfo("StagerBytesInFlight", metrics.bytesInFlight, "size of the files being staged [B]", this);
+  m_monitorSvc->declareInfo("StagerCurrentThroughput", metrics.throughput, "bytes staged per second [B/s]", this);
+  m_monitorSvc->declareInfo("StagerScratchBytes", metrics.scratchBytes, "bytes held in the temporary directories", this);
+  m_monitorSvc->declareInfo("StagerWaitingSince", metrics.waitingSince,
+                            "start of the current wait for an input file, 0 if none [s since the epoch]", this);
+  log << MSG::DEBUG << "Live staging figures declared to the MonitorSvc." << endmsg;
+}
+
+
 //====================================================
 void FileStagerSvc::releasePrevFile() {
   MsgStream log(msgSvc(), name());
   if (!m_prevFile.empty()) {
-    StageManager& manager(StageManager::instance());
-    manager.releaseFile(m_prevFile.c_str());
+    // a file read again further on is kept until its last use
+    std::map<std::string,int>::iterator iUse = m_useCount.find(m_prevFile);
+    if (iUse!=m_useCount.end() && --(iUse->second) > 0) {
+      log << MSG::DEBUG << "Keeping " << m_prevFile << " for " << iUse->second
+      << " more use(s)." << endmsg;
+    } else {
+      StageManager& manager(StageManager::instance());
+      manager.releaseFile(m_prevFile.c_str());
+    }
   }
 
   if (m_fItr!=m_inCollection.end()) {
@@ -233,6 +374,7 @@ void FileStagerSvc::loadStager() {
   StageManager& manager(StageManager::instance());
 
   m_outCollection.clear();
+  m_useCount.clear();
   std::vector< std::string >::iterator itr = m_inCollection.begin();
 
   // ensure deletion of first staged file
@@ -242,10 +384,16 @@ void FileStagerSvc::loadStager() {
   // add files and start staging ...
 
   for (; itr!=m_inCollection.end(); ++itr) {
-    manager.addToList(itr->c_str());
+    // staged once, before its first use
+    if (m_useCount[*itr]++ == 0)
+      manager.addToList(itr->c_str());
     std::string outColl = manager.getTmpFilename(itr->c_str());
     m_outCollection.push_back( outColl );
   }
+
+  if (m_useCount.size() < m_inCollection.size())
+    log << MSG::INFO << m_inCollection.size() << " uses of " << m_useCount.size()
+    << " input files: every file is staged once and released after its last use." << endmsg;
 }
 
 //====================================================
@@ -258,6 +406,7 @@ void FileStagerSvc::setupNextFile() {
     // wait till file finishes staging ...
     log << MSG::DEBUG <<name()<< ": before manager.getFile()" << endmsg;
     manager.getFile(m_fItr->c_str());
+    m_currentFile = *m_fItr;
     ++m_fItr;
   }
 
@@ -4,11 +4,13 @@
 #include "GaudiKernel/IIncidentListener.h"
 #include "GaudiKernel/MsgStream.h"
 #include "FileStager/IFileStagerSvc.h"
+#include "FileStager/IFileStagerProgress.h"
 #include "StageManager.h"
 #include "IInputStreamParser.h"
 #include "GaudiKernel/IInterface.h"
 #include <string>
 #include <vector>
+#include <map>
 
 class StoreGateSvc;
 class TStopwatch;
@@ -17,6 +19,7 @@ class IDataStreamTool;
 class IEvtSelector;
 class IIncidentSvc;
 class IChronoStatSvc;
+class IMonitorSvc;
 class IDataManagerSvc;
 class IInputStreamParser;
 class IToolSvc;
@@ -30,7 +33,7 @@ namespace Gaudi {
 
 /**  @class FileStagerSvc  FileStagerSvc.h
  *  File Stager Service:
- *   Implements the IFileStagerSvc interface and provides the
+ *   Implements the IFileStagerSvc and IFileStagerProgress interfaces and provides the
  *   basic staging functionality when used with a particular job. It implements the IIncidentListener
  *   in order to provide a handle() method for handling incidents of type 
  *   BeginInputFile, EndInputFile, and COLLECTION_INPUT_FILE. It is responsible for communicating with the StageManager
@@ -41,7 +44,7 @@ namespace Gaudi {
  *   
  */
 
-class FileStagerSvc : public extends2<Service, IFileStagerSvc, IIncidentListener> {
+class FileStagerSvc : public extends3<Service, IFileStagerSvc, IIncidentListener, IFileStagerProgress> {
 public:
   typedef std::vector<std::string>               StreamSpecs;
 
@@ -62,6 +65,7 @@ public:
 
   /** Implementation of IIncidentListener::handle method.
    *  Handles incidents of type EndInputFile and COLLECTION_INPUT_FILE. 
+   *  On BeginEvent, the StageManager is asked to pick up finished transfers.
    *  Calls the StageManager methods for releasing the previous file and 
    *  setting up the next file on the list of files to be staged.
    *  @see IIncidentListener
@@ -74,6 +78,11 @@ public:
   virtual StatusCode getLocalDataset(const std::string& dataset,
                                      std::string & local);
 
+  /** Implementation of IFileStagerProgress::getProgress
+  *  @see IFileStagerProgress
+  */
+  virtual StatusCode getProgress(const std::string& dataset, Progress& progress);
+
   /**
    *  Overrides the Service::finalize() function.
    *  @see Service
@@ -110,13 +119,18 @@ private:
    */
   void configStager();
 
-  /** Adds the input file name collection (m_inCollection) to the list of files-to-be-staged of the StageManager
+  /** Declares the live staging figures of the StageManager to the MonitorSvc, if the job has one
+    */
+  void declareMetrics();
+
+  /** Adds the input file name collection (m_inCollection) to the list of files-to-be-staged of the StageManager,
+    * every file once, in the order of its first use, and counts the uses of every file in m_useCount.
     * Adds the output file names to the m_outCollection collection
     */
   void loadStager();
 
   /** Releases the file referenced by _prevFile from the list of
-    * files-to-be-staged maintained by the StageManager
+    * files-to-be-staged maintained by the StageManager, after its last use
     */
   void releasePrevFile();
 
@@ -139,6 +153,96 @@ private:
   /// to make N files available ahead, on local disk space
   int  m_pipeSize;
 
+  /// If FileStagerSvc().AdaptivePipe = True, PipeSize is only the starting value:
+  /// the pipe length is adapted between MinPipeSize and MaxPipeSize from the measured
+  /// transfer and processing times. Requires the StagerChronoSvc to measure the processing time.
+  bool m_adaptivePipe;
+  int  m_minPipeSize;
+  int  m_maxPipeSize;
+
+  /// Limits the bytes held in the prefetch window (files being staged or staged and not
+  /// yet released): FileStagerSvc().PrefetchBudgetMB = N allows at most N MB, and
+  /// FileStagerSvc().PrefetchFreeFraction = f at most the fraction f of the free space
+  /// of the tmpdir. The tighter of both applies; 0 disables a limit. PipeSize still caps
+  /// the number of files.
+  int    m_prefetchBudgetMB;
+  double m_prefetchFreeFraction;
+
+  /// FileStagerSvc().PreallocateSpace = True allocates the full size of every staged file
+  /// with posix_fallocate before its transfer starts. Off by default, as allocating the
+  /// blocks takes time on file systems without native fallocate support.
+  bool   m_preallocate;
+
+  /// FileStagerSvc().ProgressiveRead = True lets the job open the files whose name ends in one of
+  /// ProgressiveExtensions (default .raw and .mdf) while they are still staging. Reads beyond the
+  /// bytes transferred so far wait for the transfer, or continue from the remote original if the
+  /// transfer fails or makes no progress for ProgressiveStallTimeout seconds.
+  bool   m_progressiveRead;
+  std::vector<std::string> m_progressiveExtensions;
+  double m_progressiveStall;
+
+  /// FileStagerSvc().TransferThreads = N runs the transfers in N worker threads inside the
+  /// job process. With 0 (default) the pool is sized by the pipe length if the job runs probe
+  /// threads (see ProbeThreads, on by default), and every file is staged by a child process
+  /// forked from the job otherwise. A worker runs each lcg copy as an lcg-cp process of its
+  /// own, which is killed when the file is released or its transfer times out.
+  int  m_transferThreads;
+
+  /// Number of threads looking up the sizes of all input files in the background,
+  /// as soon as they are loaded (FileStagerSvc().ProbeThreads, default 4).
+  /// With 0, each size is looked up on the event loop when its file is staged.
+  /// A multithreaded job is not forked: with probe threads, the transfers run in
+  /// worker threads even if TransferThreads is 0
+  int  m_probeThreads;
+
+  /// FileStagerSvc().RangeSizeMB = N downloads files of at least 2N MB as N MB ranges,
+  /// RangeStreams (default 4) of them at a time, spread over all replicas of the file
+  /// unless RangeReplicas = False. 0 (default) keeps one lcg-cp per file.
+  int  m_rangeSizeMB;
+  int  m_rangeStreams;
+  bool m_rangeReplicas;
+
+  /// A failed transfer is retried MaxRetries times (default 0, no retries), from the next replica
+  /// of the file, RetryBackoff seconds later (default 5, doubled at every retry).
+  /// Each attempt is limited to AttemptTimeout seconds (default 500).
+  int    m_maxRetries;
+  double m_retryBackoff;
+  int    m_attemptTimeout;
+
+  /// With RankReplicas (default False), the replicas of every file are listed in the background and
+  /// copied from the one expected to finish first, from the throughput and failures per SE host
+  /// of past transfers. The history is kept in ReplicaModelFile (default $HOME/.FileStagerReplicas).
+  bool        m_rankReplicas;
+  std::string m_replicaModel;
+
+  /// FileStagerSvc().NodeCacheDir = "/scratch/stagecache" shares the staged files between the jobs
+  /// of a node: files found there are hard-linked instead of copied, and every staged file is added.
+  /// The directory must be on the same file system as BaseTmpdir. Unused files are evicted, least
+  /// recently used first, once the cache exceeds NodeCacheSizeMB, which must be set (default 0:
+  /// cache disabled), and whenever BaseTmpdir runs short of space.
+  /// A file being staged by one job is not transferred again by the others, which wait for it.
+  std::string m_nodeCacheDir;
+  int         m_nodeCacheSizeMB;
+
+  /// With CatalogChecksums (default True), the Adler-32 checksum of every input file is looked up
+  /// with lcg-get-checksum along with its size; files on mounted file systems have none.
+  /// Checksums = { "LFN:/lhcb/data/...": "ad:1a2b3c4d" } overrides the looked up value.
+  /// A staged file whose checksum differs is handled like a failed transfer and retried from
+  /// another replica; files without a known checksum are not verified.
+  std::map<std::string,std::string> m_checksums;
+  bool        m_catalogChecksums;
+
+  /// FileStagerSvc().TimelineTraceFile = "staging.json" and TimelineCsvFile = "staging.csv" record
+  /// when every input file was queued, probed, transferred, verified, opened, closed and released,
+  /// written at finalize as a Chrome trace-event file and as a CSV table. Empty (default) for none.
+  std::string m_timelineTrace;
+  std::string m_timelineCsv;
+
+  /// FileStagerSvc().StatusBoardFile = "staging.status" publishes the live staging figures (files queued,
+  /// staging, staged and failed, bytes in flight, throughput, scratch space used and the file the job
+  /// waits for) in a small memory-mapped text file, for a pilot or an operator to poll while the job runs.
+  std::string m_statusBoardFile;
+
   /// Flag for keeping the log files created by the StageManager during child process execvp call
   bool m_keepLogfiles;
 
@@ -148,6 +252,9 @@ private:
   /// Pointer to IncidentSvc
   IIncidentSvc* m_incidentSvc;
 
+  /// Pointer to MonitorSvc, if the job has one: the live staging figures are declared to it
+  IMonitorSvc* m_monitorSvc;
+
   bool m_is_collection;
   bool m_firstFileInStream;
 
@@ -163,8 +270,9 @@ private:
   ///default value = "file:"
   std::string m_outfilePrefix;
 
-  ///The copy command issued by the child processes for invoking the tool for staging the files.
-  ///default value = "lcg-cp"
+  ///Transfer backend staging the files (FileStagerSvc().TransferBackend): "lcg" for the grid
+  ///middleware, "posix" for copies from a mounted file system, "auto" (default) to pick
+  ///posix for absolute paths and "file:" URLs and lcg otherwise.
   std::string m_cpCommand;
 
   ///Base temporary directory used for staging the files on a local storage.
@@ -172,7 +280,8 @@ private:
   ///If specified, the log files will be kept in a (possibly) different log file directory.
   std::string m_logfileDir;
   
-  ///Additional arguments to pass to the copy command given above
+  ///Additional arguments to the transfer backends (FileStagerSvc().TransferBackendArgs), e.g.
+  ///["-n", "4"] for lcg or ["--buffer-size", "16"] for posix
   std::vector< std::string > m_cpArg;
   ///Additional arguments to pass to a replicate command given above
   std::vector< std::string > m_repArg;
@@ -188,6 +297,13 @@ private:
   ///Keeps the previous file name for releasing the appropriate file after the event data is processed
   std::string m_prevFile;
 
+  ///Remaining uses of each file of m_inCollection, in which a file of an ETC appears once per run of
+  ///consecutive events reading it; the file is released after its last use
+  std::map<std::string,int> m_useCount;
+
+  ///Input file last set up with getFile, i.e. the one the event loop is reading
+  std::string m_currentFile;
+
   ///Number of parallel streams to use for each file staged with the gridFTP protocol; default value is 1
   int m_parallelStreams;
 };
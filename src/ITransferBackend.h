@@ -0,0 +1,83 @@
+#ifndef ITRANSFERBACKEND_H
+#define ITRANSFERBACKEND_H 1
+
+#include <string>
+#include <vector>
+
+using namespace std ;
+
+/// Transfer settings taken from the StagerInfo for one call
+struct TransferOptions {
+  TransferOptions() : nbstreams(1), verbose(0), timeout(0) {}
+  string vo;
+  int nbstreams;
+  int verbose;
+  int timeout;
+};
+
+/** @class ITransferBackend ITransferBackend.h
+ *
+ *   Interface of the tools moving the input files to the local disk. The StageManager
+ *   picks a backend per input file, from the name of the file or from the configured
+ *   copy command, and only talks to the middleware through it.
+ *   All methods may be called concurrently from the worker and probe threads.
+ *   @version 1.0
+ *
+*/
+class ITransferBackend {
+public:
+
+  virtual ~ITransferBackend() {}
+
+  /// name used to select the backend in the job options
+  virtual string name() const = 0;
+
+  /// true if the backend can read the given source
+  virtual bool accepts(const std::string& source) const = 0;
+
+  /** Applies backend specific arguments (the copy command arguments of the StagerInfo).
+   *  Unknown arguments are ignored.
+   */
+  virtual void configure(const vector<string>& args) = 0;
+
+  /** Looks up the size of a source
+   *  @return 0 on success, the errno of the failure otherwise
+   */
+  virtual int stat(const std::string& source, unsigned long long& size) = 0;
+
+  /** Looks up the Adler-32 checksum the storage element or catalogue holds for a source
+   *  @return 0 on success, ENOTSUP if the backend knows no checksums, the errno of the
+   *  failure otherwise
+   */
+  virtual int checksum(const std::string& source, const TransferOptions& options,
+                       unsigned long& adler32) = 0;
+
+  /** Copies a source into a local file, which may exist already (preallocated)
+   *  @param dest local file name, with or without the "file:" prefix
+   *  @return 0 on success
+   */
+  virtual int copy(const std::string& source, const std::string& dest,
+                   const TransferOptions& options, std::string& error) = 0;
+
+  /** Replicates a source to another storage element
+   *  @return 0 on success
+   */
+  virtual int replicate(const std::string& source, const std::string& dest,
+                        const TransferOptions& options, std::string& error) = 0;
+
+  /** Lists the replicas of a source
+   *  @return false if the lookup failed; an empty list means the backend has no replicas
+   */
+  virtual bool listReplicas(const std::string& source, const TransferOptions& options,
+                            vector<string>& replicas, std::string& error) = 0;
+
+  /** Asks a running copy into dest to stop as soon as possible
+   *  @return false if there is no copy into dest, or the backend can not interrupt it:
+   *  the copy then runs into its timeout and may write dest until then
+   */
+  virtual bool cancel(const std::string& dest) = 0;
+
+  /// true if the sources can be read in byte ranges with gfal, see RangeDownload
+  virtual bool ranges() const = 0;
+};
+#endif // ITRANSFERBACKEND_H
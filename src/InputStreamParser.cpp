@@ -8,10 +8,19 @@
 #include "InputStreamParser.h"
 #include "GaudiKernel/ToolFactory.h"
 #include "GaudiKernel/SvcFactory.h"
+#include "Adler32.h"
 #include <cstdio>
+#include <cerrno>
+#include <fstream>
+#include <algorithm>
+#include <set>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "TFile.h"
 #include "TTree.h"
 #include "TBranch.h"
+#include "TLeaf.h"
+#include "TThread.h"
 #include <boost/regex.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/replace.hpp>
@@ -25,6 +34,62 @@ DECLARE_TOOL_FACTORY( InputStreamParser )
 const std::string c_SRECOLLECTION = "([=]*)COLLECTION=\'([^\']*)\'";
 const std::string c_SREDATA = "([=]*)(DATA|FILE|DATAFILE)=\'([^\']*)\'";
 
+/// the link buffer is never smaller than this, in case the branch under-reports its longest link
+static const int s_minLinkLength = 16000;
+/** first lines of a link cache file: the header, with the collection and leaf the events were
+ *  read from, then the order of the GUIDs that follow, one per line until the last line
+ */
+static const std::string s_cacheHeader = "# FileStager link table v2";
+static const std::string s_cacheEventOrder = "# event order";
+static const std::string s_cacheLinkOrder = "# link order";
+static const std::string s_cacheTrailer = "# end";
+
+/** Database (GUID) of a link to an /Event container, e.g. "[DB=<guid>][CNT=/Event][CLID=...]":
+ *  the text of the first (case insensitive) DB= up to the next bracket
+ */
+static bool linkDatabase(const char* text, std::string& db) {
+  if (strstr(text, "CNT=/Event")==0)
+    return false;
+  for (const char* p = text; *p; ++p) {
+    if ((p[0]=='D' || p[0]=='d') && (p[1]=='B' || p[1]=='b') && p[2]=='=') {
+      db.assign(p+3, strcspn(p+3, "[]"));
+      return !db.empty();
+    }
+  }
+  return false;
+}
+
+/** Files used by the events of a collection, in event order, once per run of consecutive events
+ *  @param linkGuids GUID of every /Event link, by index in ##Links; empty for the other links
+ *  @return false if the collection tree or the leaf is missing
+ */
+static bool eventSequence(TFile* f, const std::string& collection, const std::string& leafName,
+                          const std::vector<std::string>& linkGuids, std::vector<std::string>& sequence) {
+  TTree* events = dynamic_cast<TTree*>(f->Get(collection.c_str()));
+  if (events==0) {
+    // trees of collections with a path are named with '_' in place of '/'
+    std::string treeName(collection);
+    std::replace(treeName.begin(), treeName.end(), '/', '_');
+    events = dynamic_cast<TTree*>(f->Get(treeName.c_str()));
+  }
+  TLeaf* leaf = events ? events->GetLeaf(leafName.c_str()) : 0;
+  if (leaf==0)
+    return false;
+
+  // only the branch of the leaf is read
+  TBranch* branch = leaf->GetBranch();
+  Long64_t entries = events->GetEntries();
+  for (Long64_t i=0; i<entries; ++i) {
+    branch->GetEntry(i);
+    long link = long(leaf->GetValue());
+    if (link<0 || link>=long(linkGuids.size()) || linkGuids[link].empty())
+      continue;
+    if (sequence.empty() || sequence.back()!=linkGuids[link])
+      sequence.push_back(linkGuids[link]);
+  }
+  return !sequence.empty();
+}
+
 //=============================================================================
 // Standard constructor, initializes variables
 //=============================================================================
@@ -33,12 +98,23 @@ InputStreamParser::InputStreamParser( const std::string& type,
                                       const IInterface* parent )
     : base_class ( type, name , parent )
     , m_inCollection(0)
+    , m_dataRegex(c_SREDATA, boost::regex_constants::icase)
+    , m_collectionRegex(c_SRECOLLECTION, boost::regex_constants::icase)
+    , m_parseThreads(1)
+    , m_nextPending(0)
     //     , m_isCollection(false)
-{}
+{
+  declareProperty("ParseThreads", m_parseThreads);
+  declareProperty("LinkCacheDir", m_linkCacheDir);
+  declareProperty("EventLinkLeaf", m_eventLinkLeaf);
+  pthread_mutex_init(&m_mutex, 0);
+}
 //=============================================================================
 // Destructor
 //=============================================================================
-InputStreamParser::~InputStreamParser() {}
+InputStreamParser::~InputStreamParser() {
+  pthread_mutex_destroy(&m_mutex);
+}
 
 //=============================================================================
 StatusCode InputStreamParser::initialize() {
@@ -58,43 +134,224 @@ StatusCode InputStreamParser::initialize() {
 //=============================================================================
 StatusCode InputStreamParser::extractFileReferences(std::string input) {
   MsgStream log(msgSvc(), name());
-  TFile *f(0);
-  f = TFile::Open(input.c_str(),"READ");
-  if (f ==0) {
-    log << MSG::ERROR << "Couldn't access the file: "<< input <<endmsg;
+  if (m_linkTables.find(input)==m_linkTables.end())
+    loadLinkTables(StreamSpecs(1, input));
+
+  const LinkTable& table = m_linkTables[input];
+  if (!table.parsed) {
+    log << MSG::ERROR << "File " << input << " " << table.error << endmsg;
     return StatusCode::FAILURE;
   }
-  if (!f->IsOpen()) {
-    log << MSG::ERROR << "File "<<input <<" cannot be "
-    << "opened for reading."<< endmsg;
-    return StatusCode::FAILURE;
+
+  // the FileStagerSvc stages every file once and releases it after its last use
+  std::set<std::string> files;
+  for (StreamSpecs::const_iterator itr = table.guids.begin(); itr != table.guids.end(); ++itr) {
+    std::string reference = "gfal:guid:" + *itr;
+    files.insert(reference);
+    // the last file of the previous input, read on by the first events of this one
+    if (!m_inCollection->empty() && m_inCollection->back()==reference)
+      continue;
+    m_inCollection->push_back(reference);
+    log << MSG::DEBUG << "Match db: " << *itr << endmsg ;
   }
+  log << MSG::INFO << input << " references " << files.size() << " files, used "
+  << table.guids.size() << " times " << (table.eventOrder ? "in event order" : "in link order")
+  << (table.fromCache ? " (from the link cache)" : "") << endmsg;
+  if (!m_eventLinkLeaf.empty() && !table.eventOrder)
+    log << MSG::WARNING << "Could not read the event order of " << input << " from leaf "
+    << m_eventLinkLeaf << " of " << table.collection << ": files listed in link order." << endmsg;
+  return StatusCode::SUCCESS;
+}
 
-  std::string sre = "([=]*)DB=([^\\]\\[]*)";
-  boost::smatch matches;
-  boost::match_flag_type flags = boost::match_default;
-  char text[16000];
-  TBranch* b=0;
-  int i;
-  b = ((TTree*)f->Get("##Links"))->GetBranch("db_string");
-  Tokenizer tok(true);
-  for(i=0,b->SetAddress(text); i < b->GetEntries(); ++i) {
-    b->GetEvent(i);
-    const std::string text1(text);
-    //         log << MSG::INFO <<"The text: "<< text <<endmsg;
-    if(!boost::find_first(text, "CNT=/Event"))
+//====================================================
+void InputStreamParser::loadLinkTables(const StreamSpecs& etcs) {
+  MsgStream log(msgSvc(), name());
+
+  // the tables are created before the threads start, which only fill them in
+  m_pending.clear();
+  m_nextPending = 0;
+  for (StreamSpecs::const_iterator itr = etcs.begin(); itr != etcs.end(); ++itr) {
+    if (m_linkTables[*itr].parsed || std::find(m_pending.begin(), m_pending.end(), *itr)!=m_pending.end())
       continue;
-    else {
-      m_regex.assign (sre, boost::regex_constants::icase);
-      if(boost::regex_search(text1.begin(),text1.end(), matches, m_regex, flags)) {
-        std::string match_db(matches[2].first, matches[2].second);
-        m_inCollection->push_back("gfal:guid:"+match_db);
-        log << MSG::DEBUG << "Match db: " << match_db << endmsg ;
-      }
+    m_pending.push_back(*itr);
+  }
+
+  size_t nThreads = std::min(m_pending.size(), size_t(std::max(m_parseThreads, 1)));
+  std::vector<pthread_t> threads;
+  if (nThreads>1) {
+    // ROOT reads from several threads only with its global locks enabled
+    TThread::Initialize();
+    for (size_t i=0; i<nThreads; ++i) {
+      pthread_t thread;
+      if (pthread_create(&thread, 0, runParser, this)==0)
+        threads.push_back(thread);
     }
   }
+  if (threads.empty())
+    parseWorker();
+  for (size_t i=0; i<threads.size(); ++i)
+    pthread_join(threads[i], 0);
+
+  for (StreamSpecs::const_iterator itr = m_pending.begin(); itr != m_pending.end(); ++itr) {
+    const LinkTable& table = m_linkTables[*itr];
+    if (table.parsed && !table.fromCache && !table.cacheFile.empty() && !table.cached)
+      log << MSG::WARNING << "Could not write the link cache file " << table.cacheFile << endmsg;
+  }
+  m_pending.clear();
+}
+
+//====================================================
+void* InputStreamParser::runParser(void* arg) {
+  static_cast<InputStreamParser*>(arg)->parseWorker();
+  return 0;
+}
+
+//====================================================
+void InputStreamParser::parseWorker() {
+  pthread_mutex_lock(&m_mutex);
+  while (m_nextPending < m_pending.size()) {
+    const std::string etc = m_pending[m_nextPending++];
+    LinkTable& table = m_linkTables.find(etc)->second;
+    pthread_mutex_unlock(&m_mutex);
+
+    readLinkTable(etc, table);
+
+    pthread_mutex_lock(&m_mutex);
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+//====================================================
+void InputStreamParser::readLinkTable(const std::string& etc, LinkTable& table) const {
+  table.cacheFile = cacheFile(etc);
+  if (!table.cacheFile.empty() && readCache(table.cacheFile, table)) {
+    table.parsed = true;
+    table.fromCache = true;
+    return;
+  }
+
+  table.parsed = parseLinks(etc, table);
+  if (table.parsed && !table.cacheFile.empty())
+    table.cached = writeCache(table.cacheFile, etc, table);
+}
+
+//====================================================
+bool InputStreamParser::parseLinks(const std::string& etc, LinkTable& table) const {
+  TFile* f = TFile::Open(etc.c_str(), "READ");
+  if (f==0 || !f->IsOpen()) {
+    table.error = "cannot be opened for reading.";
+    delete f;
+    return false;
+  }
+
+  TTree* links = dynamic_cast<TTree*>(f->Get("##Links"));
+  TBranch* b = links ? links->GetBranch("db_string") : 0;
+  if (b==0) {
+    table.error = "has no ##Links/db_string branch.";
+    f->Close("R");
+    delete f;
+    return false;
+  }
+
+  // room for the longest link of the table
+  TLeaf* leaf = b->GetLeaf("db_string");
+  int length = leaf ? std::max(leaf->GetMaximum(), leaf->GetLenStatic()) : 0;
+  std::vector<char> text(std::max(length, s_minLinkLength) + 1, '\0');
+  b->SetAddress(&text[0]);
+
+  // GUID of every link to an /Event container, by link index
+  Long64_t entries = b->GetEntries();
+  std::vector<std::string> linkGuids(entries);
+  std::set<std::string> seen;
+  for (Long64_t i=0; i<entries; ++i) {
+    b->GetEvent(i);
+    if (linkDatabase(&text[0], linkGuids[i]) && seen.insert(linkGuids[i]).second)
+      table.guids.push_back(linkGuids[i]);
+  }
+
+  if (!m_eventLinkLeaf.empty() && !table.collection.empty()) {
+    std::vector<std::string> sequence;
+    table.eventOrder = eventSequence(f, table.collection, m_eventLinkLeaf, linkGuids, sequence);
+    if (table.eventOrder)
+      table.guids.swap(sequence);
+  }
   f->Close("R");
-  return StatusCode::SUCCESS;
+  delete f;
+  return true;
+}
+
+//====================================================
+std::string InputStreamParser::cacheFile(const std::string& etc) const {
+  if (m_linkCacheDir.empty())
+    return "";
+
+  // only a local ETC can be checksummed without reading it twice from the network
+  std::string path(etc);
+  if (boost::algorithm::istarts_with(path, "file:"))
+    path.erase(0, 5);
+  struct stat statbuf;
+  unsigned long adler;
+  if (stat(path.c_str(), &statbuf)!=0 || !S_ISREG(statbuf.st_mode) || !Adler32::ofFile(path, adler))
+    return "";
+
+  char name[64];
+  snprintf(name, sizeof(name), "/%s-%lld.links", Adler32::format(adler).c_str(), (long long)statbuf.st_size);
+  return m_linkCacheDir + name;
+}
+
+//====================================================
+std::string InputStreamParser::cacheHeader(const LinkTable& table) const {
+  // a table read with another collection or leaf is parsed again
+  if (m_eventLinkLeaf.empty() || table.collection.empty())
+    return s_cacheHeader;
+  return s_cacheHeader + " " + table.collection + " " + m_eventLinkLeaf;
+}
+
+//====================================================
+bool InputStreamParser::readCache(const std::string& path, LinkTable& table) const {
+  std::ifstream in(path.c_str());
+  std::string line;
+  if (!std::getline(in, line) || line!=cacheHeader(table) || !std::getline(in, line))
+    return false;
+
+  // the order tag is followed by the name of the file the table was read from
+  table.eventOrder = (line.compare(0, s_cacheEventOrder.size(), s_cacheEventOrder)==0);
+  table.guids.clear();
+  while (std::getline(in, line)) {
+    if (line==s_cacheTrailer)
+      return true;
+    table.guids.push_back(line);
+  }
+  // cut short: parsed again
+  table.guids.clear();
+  return false;
+}
+
+//====================================================
+bool InputStreamParser::writeCache(const std::string& path, const std::string& etc, const LinkTable& table) const {
+  std::string dir = path.substr(0, path.rfind('/'));
+  if (mkdir(dir.c_str(), 0755)!=0 && errno!=EEXIST)
+    return false;
+
+  // written aside and renamed, as the jobs sharing the cache may read it at any time
+  char host[256] = "";
+  gethostname(host, sizeof(host)-1);
+  char suffix[300];
+  snprintf(suffix, sizeof(suffix), ".%s.%d", host, int(getpid()));
+  std::string tmpPath = path + suffix;
+
+  std::ofstream out(tmpPath.c_str());
+  out << cacheHeader(table) << "\n";
+  out << (table.eventOrder ? s_cacheEventOrder : s_cacheLinkOrder) << " " << etc << "\n";
+  for (StreamSpecs::const_iterator itr = table.guids.begin(); itr != table.guids.end(); ++itr)
+    out << *itr << "\n";
+  out << s_cacheTrailer << "\n";
+  out.close();
+  if (!out || rename(tmpPath.c_str(), path.c_str())!=0) {
+    unlink(tmpPath.c_str());
+    return false;
+  }
+  return true;
 }
 
 //====================================================
@@ -102,6 +359,18 @@ StatusCode InputStreamParser::extractStreams(const StreamSpecs & inputs, StreamS
   m_inCollection = & parsedInputs;
   StatusCode sc = StatusCode::FAILURE;
   MsgStream log(msgSvc(), name());
+
+  // the link tables of all the collections are read up front, in parallel
+  StreamSpecs etcs;
+  std::string descriptor, collection;
+  for ( std::vector<std::string>::const_iterator itr = inputs.begin(); itr != inputs.end(); ++itr ) {
+    if (collectionOf(*itr, collection) && descriptorOf(*itr, descriptor)) {
+      m_linkTables[descriptor].collection = collection;
+      etcs.push_back(descriptor);
+    }
+  }
+  loadLinkTables(etcs);
+
   for ( std::vector<std::string>::const_iterator itr = inputs.begin(); itr != inputs.end(); ++itr ) {
     sc = extractStream(*itr);
     if (!sc.isSuccess()) {
@@ -109,10 +378,29 @@ StatusCode InputStreamParser::extractStreams(const StreamSpecs & inputs, StreamS
       ::abort();
     }
   }
+  m_linkTables.clear();
 
   return sc;
 }
 
+//====================================================
+bool InputStreamParser::descriptorOf(const std::string& input, std::string& descriptor) const {
+  boost::smatch matches;
+  if (!boost::regex_search(input.begin(), input.end(), matches, m_dataRegex, boost::match_default))
+    return false;
+  descriptor.assign(matches[3].first, matches[3].second);
+  return true;
+}
+
+//====================================================
+bool InputStreamParser::collectionOf(const std::string& input, std::string& collection) const {
+  boost::smatch matches;
+  if (!boost::regex_search(input.begin(), input.end(), matches, m_collectionRegex, boost::match_default))
+    return false;
+  collection.assign(matches[2].first, matches[2].second);
+  return true;
+}
+
 //====================================================
 StatusCode InputStreamParser::extractStream(const std::string & input) {
   // parses a string containing multiple tag='value',
@@ -120,13 +408,10 @@ StatusCode InputStreamParser::extractStream(const std::string & input) {
 
   StatusCode sc = StatusCode::SUCCESS;
   MsgStream log(msgSvc(), name());
-  boost::smatch matches;
-  boost::match_flag_type flags = boost::match_default;
 
   // find the file descriptor
-  m_regex.assign (c_SREDATA, boost::regex_constants::icase);
-  if(boost::regex_search(input.begin(),input.end(), matches, m_regex, flags)) {
-    std::string match_descriptor(matches[3].first, matches[3].second);
+  std::string match_descriptor;
+  if(descriptorOf(input, match_descriptor)) {
     m_inCollection->push_back(match_descriptor);
     log << MSG::DEBUG <<  match_descriptor << endmsg ;
 
@@ -136,8 +421,8 @@ StatusCode InputStreamParser::extractStream(const std::string & input) {
   }
 
   // check if it is a collection:
-  m_regex.assign(c_SRECOLLECTION, boost::regex_constants::icase);
-  if(boost::regex_search(input.begin(),input.end(), matches, m_regex, flags)) {
+  std::string collection;
+  if(collectionOf(input, collection)) {
     //     m_isCollection = true;
     std::string ETC(m_inCollection->back());
     m_inCollection->pop_back();
@@ -4,6 +4,8 @@
 // Include files
 
 #include <vector>
+#include <map>
+#include <pthread.h>
 #include "IInputStreamParser.h"
 #include "GaudiKernel/AlgTool.h"
 #include "GaudiKernel/IMessageSvc.h"
@@ -17,6 +19,13 @@ class IMessageSvc;
  *   of the FileStagerSvc service, and mapping them to the appropriate 
  *   local URLs of staged copies.
  *   The tool supports the current input file types used by the LHCb experiment.
+ *   The link tables of COLLECTION inputs are read on up to ParseThreads threads, and
+ *   kept in LinkCacheDir (if set) under the Adler-32 of the ETC, so that a job run
+ *   again on the same ETC does not parse it again.
+ *   If EventLinkLeaf names the leaf of the collection tree holding the link index of
+ *   every event, the files of an ETC are listed in the order the events use them: once
+ *   per run of consecutive events, so a file may appear more than once. Otherwise
+ *   every file is listed once, in link order.
  *   @author Daniela Remenska
  *   @version 1.0
  *   
@@ -68,7 +77,63 @@ private:
    * @see LinkParserTool::extractStream()
    */
   virtual StatusCode extractFileReferences(std::string input);
-  boost::regex m_regex;
+
+  /** GUIDs of the files referenced by the /Event links of one ETC: once per run of consecutive
+   *  events using the file if eventOrder is set, otherwise once per file, in link order
+   */
+  struct LinkTable {
+    LinkTable() : parsed(false), eventOrder(false), fromCache(false), cached(false) {}
+    bool parsed;
+    bool eventOrder;
+    bool fromCache;
+    bool cached;
+    /// name of the collection tree, from COLLECTION='...'
+    std::string collection;
+    std::string cacheFile;
+    std::string error;
+    std::vector<std::string> guids;
+  };
+
+  /// file descriptor of an input specification, e.g. DATAFILE='...'
+  bool descriptorOf(const std::string& input, std::string& descriptor) const;
+  /// collection of an input specification, e.g. COLLECTION='TagCreator/1'
+  bool collectionOf(const std::string& input, std::string& collection) const;
+
+  /** Reads the link tables of the given ETCs into m_linkTables, from the
+   *  link cache or with ROOT, on up to m_parseThreads threads
+   */
+  void loadLinkTables(const StreamSpecs& etcs);
+  static void* runParser(void* arg);
+  /// takes ETCs from m_pending until none are left
+  void parseWorker();
+  void readLinkTable(const std::string& etc, LinkTable& table) const;
+  /// reads the ##Links tree, and the event order if configured, of an ETC with ROOT
+  bool parseLinks(const std::string& etc, LinkTable& table) const;
+
+  /// link cache file of an ETC, empty if there is no cache or the ETC is not a local file
+  std::string cacheFile(const std::string& etc) const;
+  /// first line of a link cache file, which tells how the table was read
+  std::string cacheHeader(const LinkTable& table) const;
+  bool readCache(const std::string& path, LinkTable& table) const;
+  bool writeCache(const std::string& path, const std::string& etc, const LinkTable& table) const;
+
+  boost::regex m_dataRegex;
+  boost::regex m_collectionRegex;
+
+  /// number of ETCs parsed at the same time
+  int m_parseThreads;
+  /// directory of the link cache, none if empty
+  std::string m_linkCacheDir;
+  /// leaf of the collection tree holding the ##Links index of each event, none if empty
+  std::string m_eventLinkLeaf;
+
+  /// link tables of the COLLECTION inputs of the current extractStreams() call
+  std::map<std::string, LinkTable> m_linkTables;
+
+  /// ETCs to parse, and index of the next one; guarded by m_mutex
+  StreamSpecs m_pending;
+  size_t m_nextPending;
+  pthread_mutex_t m_mutex;
 
 };
 #endif //INPUTSTREAMPARSER_H
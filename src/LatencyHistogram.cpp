@@ -0,0 +1,88 @@
+#include "LatencyHistogram.h"
+#include <cmath>
+
+/// 1/ln(2), for the base 2 logarithm of C++03
+static const double s_invLn2 = 1.4426950408889634;
+
+//====================================================
+
+LatencyHistogram::LatencyHistogram(double lowest)
+    : m_lowest(lowest)
+    , m_count(0)
+    , m_sum(0)
+    , m_min(0)
+    , m_max(0) {
+  for (int i=0; i<s_nBuckets; ++i)
+    m_buckets[i] = 0;
+}
+
+
+//====================================================
+void LatencyHistogram::add(double seconds) {
+  if (seconds<0)
+    seconds = 0;
+
+  int bucket(0);
+  if (seconds>=m_lowest) {
+    bucket = 1 + int(std::floor(s_perOctave*s_invLn2*std::log(seconds/m_lowest)));
+    if (bucket>=s_nBuckets)
+      bucket = s_nBuckets-1;
+  }
+  ++m_buckets[bucket];
+
+  if (m_count==0 || seconds<m_min)
+    m_min = seconds;
+  if (seconds>m_max)
+    m_max = seconds;
+  ++m_count;
+  m_sum += seconds;
+}
+
+
+//====================================================
+void LatencyHistogram::add(const LatencyHistogram& other) {
+  if (other.m_count==0)
+    return;
+  for (int i=0; i<s_nBuckets; ++i)
+    m_buckets[i] += other.m_buckets[i];
+  if (m_count==0 || other.m_min<m_min)
+    m_min = other.m_min;
+  if (other.m_max>m_max)
+    m_max = other.m_max;
+  m_count += other.m_count;
+  m_sum += other.m_sum;
+}
+
+
+//====================================================
+double LatencyHistogram::lowerEdge(int bucket) const {
+  if (bucket==0)
+    return 0;
+  return m_lowest*std::pow(2., double(bucket-1)/s_perOctave);
+}
+
+
+//====================================================
+double LatencyHistogram::percentile(double fraction) const {
+  if (m_count==0)
+    return 0;
+
+  double rank = fraction*m_count;
+  long below(0);
+  for (int i=0; i<s_nBuckets; ++i) {
+    if (m_buckets[i]==0 || below+m_buckets[i] < rank) {
+      below += m_buckets[i];
+      continue;
+    }
+    // linear inside the bucket, clamped to the values actually seen
+    double low = lowerEdge(i);
+    double high = (i+1<s_nBuckets) ? lowerEdge(i+1) : m_max;
+    double value = low + (high-low)*(rank-below)/m_buckets[i];
+    if (value<m_min)
+      value = m_min;
+    if (value>m_max)
+      value = m_max;
+    return value;
+  }
+  return m_max;
+}
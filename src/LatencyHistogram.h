@@ -0,0 +1,63 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H 1
+
+/**  @class LatencyHistogram  LatencyHistogram.h
+ *   Distribution of durations in logarithmic buckets, eight per factor of two,
+ *   over 30 factors of two from the lowest bucket edge (by default 1 ms, up to about
+ *   12 days); shorter durations share the first bucket.
+ *   Adding a value costs a logarithm and an increment, and the memory is
+ *   fixed, so that every input file of a job can be recorded. Percentiles
+ *   are interpolated inside their bucket, within about 5% of the true value.
+ *
+ *   @version 1.0
+ */
+class LatencyHistogram {
+public:
+
+  /// @param lowest upper edge of the first bucket, in seconds
+  explicit LatencyHistogram(double lowest=1E-3);
+
+  /// adds a duration in seconds; negative values count as 0
+  void add(double seconds);
+
+  /// adds all durations of another histogram with the same lowest bucket edge
+  void add(const LatencyHistogram& other);
+
+  /** Estimates a percentile of the recorded durations
+   *  @param fraction the percentile as a fraction, e.g. 0.99 for p99
+   *  @return the duration in seconds, 0 if nothing was recorded
+   */
+  double percentile(double fraction) const;
+
+  long count() const {
+    return m_count;
+  }
+
+  double sum() const {
+    return m_sum;
+  }
+
+  double max() const {
+    return m_max;
+  }
+
+private:
+
+  /// buckets per factor of two
+  static const int s_perOctave = 8;
+  /// factors of two covered above the lowest bucket
+  static const int s_octaves = 30;
+  static const int s_nBuckets = s_perOctave*s_octaves + 1;
+
+  /// lower edge of a bucket in seconds; bucket 0 starts at 0
+  double lowerEdge(int bucket) const;
+
+  double m_lowest;
+  long m_buckets[s_nBuckets];
+  long m_count;
+  double m_sum;
+  double m_min;
+  double m_max;
+} ;
+
+#endif // LATENCYHISTOGRAM_H
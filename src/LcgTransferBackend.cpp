@@ -0,0 +1,313 @@
+#include "LcgTransferBackend.h"
+#include "RangeDownload.h"
+#include "Adler32.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "gfal_api.h"
+
+extern "C" {
+#include "lcg_util.h"
+}
+
+/// size of the error buffers passed to lcg_util
+static const int s_errbufsz = 1024;
+/// command running the copies, see spawnCopy()
+static const char* s_copyCommand = "lcg-cp";
+/// command looking up the checksums, see checksum()
+static const char* s_checksumCommand = "lcg-get-checksum";
+
+extern char** environ;
+
+//====================================================
+LcgTransferBackend::LcgTransferBackend()
+    : m_streams(0)
+    , m_verbose(-1)
+    , m_timeout(0) {
+  pthread_mutex_init(&m_mutex, 0);
+}
+
+
+LcgTransferBackend::~LcgTransferBackend() {
+  pthread_mutex_destroy(&m_mutex);
+}
+
+
+//====================================================
+void LcgTransferBackend::configure(const vector<string>& args) {
+  m_streams = 0;
+  m_vo.clear();
+  m_verbose = -1;
+  m_timeout = 0;
+  for (unsigned int i=0; i<args.size(); ++i) {
+    bool hasValue = (i+1 < args.size());
+    if (args[i]=="-n" && hasValue)
+      m_streams = atoi(args[++i].c_str());
+    else if (args[i]=="--vo" && hasValue)
+      m_vo = args[++i];
+    else if (args[i]=="-v" || args[i]=="--verbose")
+      m_verbose = 1;
+    else if (args[i]=="--sendreceive-timeout" && hasValue)
+      m_timeout = atoi(args[++i].c_str());
+  }
+}
+
+
+//====================================================
+TransferOptions LcgTransferBackend::effective(const TransferOptions& options) const {
+  TransferOptions result(options);
+  if (m_streams>0)
+    result.nbstreams = m_streams;
+  if (!m_vo.empty())
+    result.vo = m_vo;
+  if (m_verbose>=0)
+    result.verbose = m_verbose;
+  if (m_timeout>0)
+    result.timeout = m_timeout;
+  return result;
+}
+
+
+//====================================================
+int LcgTransferBackend::stat(const std::string& source, unsigned long long& size) {
+  struct stat64 statbuf;
+  if (gfal_stat64(source.c_str(), &statbuf) < 0)
+    return errno ? errno : EIO;
+  size = statbuf.st_size;
+  return 0;
+}
+
+
+//====================================================
+int LcgTransferBackend::checksum(const std::string& source, const TransferOptions& options,
+                                 unsigned long& adler32) {
+  TransferOptions opts = effective(options);
+  vector<string> args;
+  args.push_back(s_checksumCommand);
+  if (!opts.vo.empty()) {
+    args.push_back("--vo");
+    args.push_back(opts.vo);
+  }
+  args.push_back(source);
+
+  int status;
+  string output;
+  if (!spawn(args, 1, "", status, output))
+    return ENOTSUP;
+  if (status>=0 && !(WIFEXITED(status) && WEXITSTATUS(status)==0))
+    return EIO;
+
+  // one "<checksum> <surl>" line; storage elements keeping other checksum types
+  // report no Adler-32
+  vector<char> text(output.begin(), output.end());
+  text.push_back('\0');
+  char* saveptr;
+  for (char* token = strtok_r(&text[0], " \t\n", &saveptr); token;
+       token = strtok_r(0, " \t\n", &saveptr)) {
+    if (Adler32::parse(token, adler32))
+      return 0;
+  }
+  return ENOTSUP;
+}
+
+
+//====================================================
+int LcgTransferBackend::copy(const std::string& source, const std::string& dest,
+                             const TransferOptions& options, std::string& error) {
+  TransferOptions opts = effective(options);
+  int rc;
+  if (spawnCopy(source, dest, opts, rc, error))
+    return rc;
+
+  // the lcg_util API takes non-const buffers
+  vector<char> src(source.begin(), source.end());
+  vector<char> dst(dest.begin(), dest.end());
+  vector<char> vo(opts.vo.begin(), opts.vo.end());
+  vector<char> error_buf(s_errbufsz, '\0');
+  src.push_back('\0');
+  dst.push_back('\0');
+  vo.push_back('\0');
+
+  rc = lcg_cpxt(&src[0],
+              &dst[0],
+              &vo[0],
+              opts.nbstreams,
+              0, 0,
+              opts.verbose,
+              opts.timeout,
+              &error_buf[0],
+              s_errbufsz);
+  if (rc != 0)
+    error = &error_buf[0];
+  return rc;
+}
+
+
+//====================================================
+bool LcgTransferBackend::spawnCopy(const std::string& source, const std::string& dest,
+                                   const TransferOptions& opts, int& rc, std::string& error) {
+  char number[32];
+  vector<string> args;
+  args.push_back(s_copyCommand);
+  if (!opts.vo.empty()) {
+    args.push_back("--vo");
+    args.push_back(opts.vo);
+  }
+  if (opts.nbstreams>0) {
+    sprintf(number, "%d", opts.nbstreams);
+    args.push_back("-n");
+    args.push_back(number);
+  }
+  if (opts.verbose>0)
+    args.push_back("-v");
+  if (opts.timeout>0) {
+    sprintf(number, "%d", opts.timeout);
+    args.push_back("--sendreceive-timeout");
+    args.push_back(number);
+  }
+  args.push_back(source);
+  args.push_back(dest);
+
+  int status;
+  string messages;
+  if (!spawn(args, 2, dest, status, messages))
+    return false;
+  if (status<0) {
+    // reaped elsewhere (SIGCHLD ignored): the size of the local copy decides
+    rc = 0;
+    return true;
+  }
+  rc = (WIFEXITED(status) && WEXITSTATUS(status)==0) ? 0 : 1;
+  if (rc!=0) {
+    if (WIFSIGNALED(status))
+      error = "copy of " + source + " cancelled";
+    else
+      error = messages.empty() ? string(s_copyCommand) + " failed for " + source : messages;
+  }
+  return true;
+}
+
+
+//====================================================
+bool LcgTransferBackend::spawn(const vector<string>& args, int output, const std::string& dest,
+                               int& status, std::string& messages) {
+  vector<char*> argv;
+  for (unsigned int i=0; i<args.size(); ++i)
+    argv.push_back(const_cast<char*>(args[i].c_str()));
+  argv.push_back(0);
+
+  // the messages of the command come back through a pipe
+  int outPipe[2];
+  if (pipe(outPipe)!=0)
+    return false;
+  fcntl(outPipe[0], F_SETFD, FD_CLOEXEC);
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, output==1 ? 2 : 1, "/dev/null", O_WRONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, outPipe[1], output);
+  posix_spawn_file_actions_addclose(&actions, outPipe[1]);
+  // a group of its own, so that cancel() also stops the processes the command starts
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attr, 0);
+
+  // registered under the lock, so that cancel() never misses a started copy
+  pid_t pid;
+  pthread_mutex_lock(&m_mutex);
+  int spawned = posix_spawnp(&pid, argv[0], &actions, &attr, &argv[0], environ);
+  if (spawned==0 && !dest.empty())
+    m_copies[dest] = pid;
+  pthread_mutex_unlock(&m_mutex);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  close(outPipe[1]);
+  if (spawned!=0) {
+    close(outPipe[0]);
+    return false;
+  }
+
+  messages.clear();
+  char buffer[512];
+  ssize_t n;
+  while ((n = read(outPipe[0], buffer, sizeof(buffer)))!=0) {
+    if (n<0 && errno==EINTR)
+      continue;
+    if (n<0)
+      break;
+    if (messages.size() < (string::size_type)s_errbufsz)
+      messages.append(buffer, n);
+  }
+  close(outPipe[0]);
+
+  status = 0;
+  pid_t ret;
+  while ((ret = waitpid(pid, &status, 0))<0 && errno==EINTR) {}
+  if (!dest.empty()) {
+    pthread_mutex_lock(&m_mutex);
+    m_copies.erase(dest);
+    pthread_mutex_unlock(&m_mutex);
+  }
+
+  if (ret<0) {
+    status = -1;
+    return true;
+  }
+  // the command could not be run after all
+  return !(WIFEXITED(status) && WEXITSTATUS(status)==127);
+}
+
+
+//====================================================
+bool LcgTransferBackend::cancel(const std::string& dest) {
+  pthread_mutex_lock(&m_mutex);
+  map<string,pid_t>::const_iterator itr = m_copies.find(dest);
+  bool running = (itr!=m_copies.end() && kill(-itr->second, SIGKILL)==0);
+  pthread_mutex_unlock(&m_mutex);
+  return running;
+}
+
+
+//====================================================
+int LcgTransferBackend::replicate(const std::string& source, const std::string& dest,
+                                  const TransferOptions& options, std::string& error) {
+  TransferOptions opts = effective(options);
+  vector<char> src(source.begin(), source.end());
+  vector<char> dst(dest.begin(), dest.end());
+  vector<char> vo(opts.vo.begin(), opts.vo.end());
+  vector<char> error_buf(s_errbufsz, '\0');
+  src.push_back('\0');
+  dst.push_back('\0');
+  vo.push_back('\0');
+
+  int rc = lcg_repxt(&src[0],
+                     &dst[0],
+                     &vo[0],
+                     0,
+                     opts.nbstreams,
+                     0,
+                     0,
+                     opts.verbose,
+                     opts.timeout,
+                     &error_buf[0],
+                     s_errbufsz);
+  if (rc != 0)
+    error = &error_buf[0];
+  return rc;
+}
+
+
+//====================================================
+bool LcgTransferBackend::listReplicas(const std::string& source, const TransferOptions& options,
+                                      vector<string>& replicas, std::string& error) {
+  TransferOptions opts = effective(options);
+  return RangeDownload::listReplicas(source, opts.vo, opts.verbose, replicas, error);
+}
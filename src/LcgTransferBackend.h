@@ -0,0 +1,82 @@
+#ifndef LCGTRANSFERBACKEND_H
+#define LCGTRANSFERBACKEND_H 1
+
+#include "ITransferBackend.h"
+#include <pthread.h>
+#include <sys/types.h>
+#include <map>
+
+/**  @class LcgTransferBackend  LcgTransferBackend.h
+ *   Transfers through the grid middleware: gfal_stat64, lcg-cp, lcg-get-checksum,
+ *   lcg_repxt and lcg_lr3.
+ *   Accepts every source, so it is the default backend.
+ *   Each copy runs the lcg-cp command in a process of its own, started with posix_spawn,
+ *   which is safe in a multithreaded job and lets cancel() kill the copy. Where the
+ *   command is not installed, lcg_cpxt is called in the calling thread and can not be
+ *   interrupted. Checksums are looked up with the lcg-get-checksum command in the same
+ *   way; without it, the backend reports no checksums.
+ *   Its arguments follow lcg-cp: "-n <streams>", "--vo <vo>", "-v" and
+ *   "--sendreceive-timeout <seconds>" override the StagerInfo settings.
+ *
+ *   @version 1.0
+ */
+class LcgTransferBackend : public ITransferBackend {
+public:
+
+  LcgTransferBackend();
+  ~LcgTransferBackend();
+
+  string name() const {
+    return "lcg";
+  }
+  bool accepts(const std::string&) const {
+    return true;
+  }
+  void configure(const vector<string>& args);
+  int stat(const std::string& source, unsigned long long& size);
+  int checksum(const std::string& source, const TransferOptions& options,
+               unsigned long& adler32);
+  int copy(const std::string& source, const std::string& dest,
+           const TransferOptions& options, std::string& error);
+  int replicate(const std::string& source, const std::string& dest,
+                const TransferOptions& options, std::string& error);
+  bool listReplicas(const std::string& source, const TransferOptions& options,
+                    vector<string>& replicas, std::string& error);
+  /// kills the lcg-cp processes copying into dest; lcg_cpxt can not be interrupted
+  bool cancel(const std::string& dest);
+  bool ranges() const {
+    return true;
+  }
+
+private:
+  LcgTransferBackend(const LcgTransferBackend&);
+  LcgTransferBackend& operator= (const LcgTransferBackend&);
+
+  /// options with the configured overrides applied
+  TransferOptions effective(const TransferOptions& options) const;
+  /** Runs lcg-cp in a child process until it ends
+   *  @return false if the command could not be started
+   */
+  bool spawnCopy(const std::string& source, const std::string& dest,
+                 const TransferOptions& opts, int& rc, std::string& error);
+  /** Runs a command in a process group of its own until it ends
+   *  @param output descriptor of the command (1 or 2) read into messages; the other goes
+   *  to /dev/null
+   *  @param dest if not empty, cancel(dest) kills the command while it runs
+   *  @param status wait status of the command, -1 if it was reaped elsewhere
+   *  @return false if the command could not be started
+   */
+  bool spawn(const vector<string>& args, int output, const std::string& dest,
+             int& status, std::string& messages);
+
+  int m_streams;
+  string m_vo;
+  int m_verbose;
+  int m_timeout;
+
+  pthread_mutex_t m_mutex;
+  /// lcg-cp processes of the running copies, by destination
+  map<string,pid_t> m_copies;
+} ;
+
+#endif // LCGTRANSFERBACKEND_H
@@ -0,0 +1,243 @@
+#include "NodeCache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <utime.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <vector>
+
+namespace {
+  /// FNV-1a, 64 bit
+  unsigned long long hashName(const std::string& name) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (string::size_type i=0; i<name.size(); ++i) {
+      hash ^= (unsigned char)name[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  struct Candidate {
+    time_t used;
+    string path;
+    unsigned long long size;
+    bool operator<(const Candidate& other) const {
+      return used < other.used;
+    }
+  };
+}
+
+//====================================================
+NodeCache::NodeCache()
+    : m_limit(0) {}
+
+
+//====================================================
+bool NodeCache::configure(const std::string& dir, unsigned long long limit) {
+  m_dir = dir;
+  m_limit = limit;
+  if (m_dir.empty())
+    return true;
+
+  // without a limit the cache would keep every staged file on the node
+  if (m_limit==0) {
+    m_dir.clear();
+    return false;
+  }
+
+  // shared by the jobs of the node
+  if (mkdir(m_dir.c_str(), 0777)!=0 && errno!=EEXIST) {
+    m_dir.clear();
+    return false;
+  }
+  if (access(m_dir.c_str(), W_OK|X_OK)!=0) {
+    m_dir.clear();
+    return false;
+  }
+  return true;
+}
+
+
+//====================================================
+string NodeCache::entryName(const std::string& name, unsigned long long size) const {
+  char entry[64];
+  sprintf(entry, "%016llx_%llu", hashName(name), size);
+  return m_dir + "/" + entry;
+}
+
+
+//====================================================
+bool NodeCache::fetch(const std::string& name, unsigned long long size, const std::string& localPath) {
+  if (!enabled())
+    return false;
+
+  string entry = entryName(name, size);
+  struct stat statbuf;
+  if (stat(entry.c_str(), &statbuf)!=0 || (unsigned long long)statbuf.st_size!=size)
+    return false;
+
+  // an entry evicted in between makes the link fail: a plain miss
+  if (link(entry.c_str(), localPath.c_str())!=0)
+    return false;
+
+  // the modification time orders the entries for eviction
+  utime(entry.c_str(), 0);
+  return true;
+}
+
+
+//====================================================
+bool NodeCache::publish(const std::string& name, unsigned long long size, const std::string& localPath) {
+  if (!enabled())
+    return false;
+
+  string entry = entryName(name, size);
+  // link() does not replace an existing entry: a concurrent publisher wins
+  bool published = (link(localPath.c_str(), entry.c_str())==0 || errno==EEXIST);
+  if (published)
+    utime(entry.c_str(), 0);
+  evict();
+  return published;
+}
+
+
+//====================================================
+bool NodeCache::claim(const std::string& name, unsigned long long size, const std::string& localPath) {
+  if (!enabled())
+    return true;
+
+  string path = claimName(name, size);
+  while (true) {
+    int fd = open(path.c_str(), O_RDWR|O_CREAT, 0666);
+    if (fd<0)
+      return true;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    struct flock lock;
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+    if (fcntl(fd, F_SETLK, &lock)!=0) {
+      close(fd);
+      return !(errno==EACCES || errno==EAGAIN);
+    }
+
+    // the previous owner may have removed the file between our open and lock:
+    // the lock only counts on the file still in the directory
+    struct stat locked, current;
+    if (fstat(fd, &locked)==0 && stat(path.c_str(), &current)==0 &&
+        locked.st_dev==current.st_dev && locked.st_ino==current.st_ino) {
+      // read by the waiters, see ownerActivity()
+      if (ftruncate(fd, 0)==0 && pwrite(fd, localPath.c_str(), localPath.size(), 0)!=(ssize_t)localPath.size())
+        ftruncate(fd, 0); // a partial path is worse than none
+      Claim& claim = m_claims[localPath];
+      claim.path = path;
+      claim.fd = fd;
+      return true;
+    }
+    close(fd);
+  }
+}
+
+
+//====================================================
+string NodeCache::claimName(const std::string& name, unsigned long long size) const {
+  string entry = entryName(name, size);
+  string::size_type pos = entry.find_last_of('/');
+  return entry.substr(0, pos+1) + ".claim_" + entry.substr(pos+1);
+}
+
+
+//====================================================
+bool NodeCache::ownerActivity(const std::string& name, unsigned long long size, time_t& modified) const {
+  if (!enabled())
+    return false;
+
+  int fd = open(claimName(name, size).c_str(), O_RDONLY);
+  if (fd<0)
+    return false;
+  char path[4096];
+  ssize_t length = read(fd, path, sizeof(path)-1);
+  close(fd);
+  if (length<=0)
+    return false;
+  path[length] = '\0';
+
+  struct stat statbuf;
+  if (stat(path, &statbuf)!=0)
+    return false;
+  modified = statbuf.st_mtime;
+  return true;
+}
+
+
+//====================================================
+void NodeCache::release(const std::string& localPath) {
+  map<string,Claim>::iterator itr = m_claims.find(localPath);
+  if (itr==m_claims.end())
+    return;
+  // removed while still locked, so that nobody locks a file which is going away
+  unlink((itr->second).path.c_str());
+  close((itr->second).fd);
+  m_claims.erase(itr);
+}
+
+
+//====================================================
+void NodeCache::evict() {
+  if (!enabled() || m_limit==0)
+    return;
+  shrink(m_limit, (unsigned long long)-1);
+}
+
+
+//====================================================
+unsigned long long NodeCache::reclaim(unsigned long long bytes) {
+  if (!enabled() || bytes==0)
+    return 0;
+  return shrink(0, bytes);
+}
+
+
+//====================================================
+unsigned long long NodeCache::shrink(unsigned long long target, unsigned long long needed) {
+  DIR* dp = opendir(m_dir.c_str());
+  if (!dp)
+    return 0;
+
+  unsigned long long total(0);
+  vector<Candidate> candidates;
+  struct dirent* dirp;
+  while ((dirp = readdir(dp)) != NULL) {
+    if (dirp->d_name[0]=='.')
+      continue;
+    Candidate candidate;
+    candidate.path = m_dir + "/" + dirp->d_name;
+    struct stat statbuf;
+    if (stat(candidate.path.c_str(), &statbuf)!=0)
+      continue;
+    total += statbuf.st_size;
+    // entries linked into a job directory are in use
+    if (statbuf.st_nlink>1)
+      continue;
+    candidate.used = statbuf.st_mtime;
+    candidate.size = statbuf.st_size;
+    candidates.push_back(candidate);
+  }
+  closedir(dp);
+
+  sort(candidates.begin(), candidates.end());
+  unsigned long long freed(0);
+  for (unsigned int i=0; i<candidates.size() && total>target && freed<needed; ++i) {
+    if (unlink(candidates[i].path.c_str())==0) {
+      total -= candidates[i].size;
+      freed += candidates[i].size;
+    }
+  }
+  return freed;
+}
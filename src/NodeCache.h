@@ -0,0 +1,107 @@
+#ifndef NODECACHE_H
+#define NODECACHE_H 1
+
+#include <map>
+#include <string>
+#include <time.h>
+
+using namespace std ;
+
+/**  @class NodeCache  NodeCache.h
+ *   Node-wide cache of staged files, shared by all jobs running on the node.
+ *   Entries are named after a hash of the input file name and its size.
+ *   A file is published by hard-linking the job's completed local copy into the
+ *   cache, which is atomic: readers never see a partial entry. A job takes a read
+ *   reference on an entry by hard-linking it into its own temporary directory,
+ *   so the cache must be on the same file system as the temporary directories.
+ *   Entries without any reference (link count 1) are evicted, least recently
+ *   used first, when the cache grows over its size limit, and when a job runs
+ *   short of space on the file system it shares with the cache.
+ *   A job about to transfer a file claims it with an fcntl lock on a claim file in
+ *   the cache directory, so that the other jobs wait for its result instead of
+ *   transferring the same file. The kernel drops the lock when the owner dies,
+ *   after which a waiter takes the claim over. The claim file holds the path of the
+ *   owner's local copy, so that the waiters can follow its progress.
+ *
+ *   @version 1.0
+ */
+class NodeCache {
+public:
+
+  NodeCache();
+
+  /** Sets the cache directory, created if needed
+   *  @param dir cache directory, empty to disable the cache
+   *  @param limit size limit in bytes, required to be positive with a directory
+   *  @return false if the directory can not be used or there is no limit
+   */
+  bool configure(const std::string& dir, unsigned long long limit);
+
+  bool enabled() const {
+    return !m_dir.empty();
+  }
+
+  /** Takes a reference on a cached file
+   *  @param name normalised input file name (LFN, GUID or SURL)
+   *  @param size size of the file
+   *  @param localPath where the job expects its local copy; a hard link is created there
+   *  @return true on a cache hit
+   */
+  bool fetch(const std::string& name, unsigned long long size, const std::string& localPath);
+
+  /** Publishes a completely staged file, then evicts old entries if needed
+   *  @return true if the file is in the cache afterwards
+   */
+  bool publish(const std::string& name, unsigned long long size, const std::string& localPath);
+
+  /** Claims the transfer of a file for this process
+   *  @param localPath local copy the transfer writes, used to release the claim
+   *  @return false if another live process holds the claim; true otherwise,
+   *  also when the claim could not be set up at all
+   */
+  bool claim(const std::string& name, unsigned long long size, const std::string& localPath);
+
+  /** Drops the claim taken for a local copy, if any. Must follow publish() on success,
+   *  so that the waiters find the file in the cache.
+   */
+  void release(const std::string& localPath);
+
+  /** Gets the last time the owner of a claim wrote to its local copy
+   *  @param modified set to the modification time of the owner's copy
+   *  @return false if there is no claim or its copy can not be looked at
+   */
+  bool ownerActivity(const std::string& name, unsigned long long size, time_t& modified) const;
+
+  /** Removes unreferenced entries, least recently used first, until the cache fits its limit
+   */
+  void evict();
+
+  /** Removes unreferenced entries, least recently used first, until enough space is freed
+   *  @param bytes space needed
+   *  @return space freed, in bytes
+   */
+  unsigned long long reclaim(unsigned long long bytes);
+
+  /// cache file name of an input file
+  string entryName(const std::string& name, unsigned long long size) const;
+
+private:
+  /// claim file of a cache entry, hidden from evict() by the leading dot
+  string claimName(const std::string& name, unsigned long long size) const;
+
+  /// removes unreferenced entries, least recently used first, until the cache is not above target
+  /// or needed bytes are freed; returns the bytes freed
+  unsigned long long shrink(unsigned long long target, unsigned long long needed);
+
+  string m_dir;
+  unsigned long long m_limit;
+
+  struct Claim {
+    string path;
+    int fd;
+  };
+  /// claims held by this process, by local path
+  map<string,Claim> m_claims;
+} ;
+
+#endif // NODECACHE_H
@@ -0,0 +1,199 @@
+#include "PosixTransferBackend.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <boost/algorithm/string.hpp>
+
+namespace ba = boost::algorithm;
+
+/// default bytes moved between two cancellation checks
+static const size_t s_defaultChunk = 8*1024*1024;
+
+//====================================================
+PosixTransferBackend::PosixTransferBackend()
+    : m_chunkSize(s_defaultChunk) {
+  pthread_mutex_init(&m_mutex, 0);
+}
+
+
+PosixTransferBackend::~PosixTransferBackend() {
+  pthread_mutex_destroy(&m_mutex);
+}
+
+
+//====================================================
+string PosixTransferBackend::path(const std::string& name) {
+  string result(name);
+  if (ba::starts_with(result, "file:"))
+    result.erase(0, 5);
+  // file:///data/x and file:/data/x name the same file
+  while (result.size()>1 && result[0]=='/' && result[1]=='/')
+    result.erase(0, 1);
+  return result;
+}
+
+
+//====================================================
+bool PosixTransferBackend::accepts(const std::string& source) const {
+  return !source.empty() && (source[0]=='/' || ba::starts_with(source, "file:"));
+}
+
+
+//====================================================
+void PosixTransferBackend::configure(const vector<string>& args) {
+  m_chunkSize = s_defaultChunk;
+  for (unsigned int i=0; i+1<args.size(); ++i) {
+    if (args[i]=="--buffer-size" && atoi(args[i+1].c_str())>0)
+      m_chunkSize = size_t(atoi(args[++i].c_str()))*1024*1024;
+  }
+}
+
+
+//====================================================
+int PosixTransferBackend::stat(const std::string& source, unsigned long long& size) {
+  struct stat64 statbuf;
+  if (stat64(path(source).c_str(), &statbuf) < 0)
+    return errno ? errno : EIO;
+  size = statbuf.st_size;
+  return 0;
+}
+
+
+//====================================================
+int PosixTransferBackend::checksum(const std::string&, const TransferOptions&, unsigned long&) {
+  return ENOTSUP;
+}
+
+
+//====================================================
+int PosixTransferBackend::copy(const std::string& source, const std::string& dest,
+                               const TransferOptions&, std::string& error) {
+  string src = path(source);
+  string dst = path(dest);
+
+  int in = open(src.c_str(), O_RDONLY);
+  if (in<0) {
+    error = "cannot open " + src + ": " + strerror(errno);
+    return 1;
+  }
+  posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  // not truncated: the file may be preallocated
+  int out = open(dst.c_str(), O_WRONLY|O_CREAT, 0644);
+  if (out<0) {
+    error = "cannot create " + dst + ": " + strerror(errno);
+    close(in);
+    return 1;
+  }
+  // cancellable from here on
+  pthread_mutex_lock(&m_mutex);
+  m_running.insert(dst);
+  pthread_mutex_unlock(&m_mutex);
+
+  int rc(0);
+  bool useSendfile(true);
+  vector<char> buffer;
+  off_t done(0);
+  while (true) {
+    if (cancelled(dest)) {
+      error = "copy of " + src + " cancelled";
+      rc = 1;
+      break;
+    }
+
+    ssize_t n(-1);
+    if (useSendfile) {
+      n = sendfile(out, in, 0, m_chunkSize);
+      if (n<0 && (errno==EINVAL || errno==ENOSYS)) {
+        // file systems without sendfile support
+        useSendfile = false;
+        continue;
+      }
+    } else {
+      if (buffer.empty())
+        buffer.resize(m_chunkSize);
+      n = read(in, &buffer[0], buffer.size());
+      ssize_t written(0);
+      while (n>0 && written<n) {
+        ssize_t w = write(out, &buffer[written], n-written);
+        if (w<0 && errno==EINTR)
+          continue;
+        if (w<0) {
+          n = -1;
+          break;
+        }
+        written += w;
+      }
+    }
+
+    if (n<0 && errno==EINTR)
+      continue;
+    if (n<0) {
+      error = "cannot copy " + src + " to " + dst + ": " + strerror(errno);
+      rc = 1;
+      break;
+    }
+    if (n==0)
+      break;
+    done += n;
+  }
+
+  // cut a preallocated file to the copied size
+  if (rc==0 && ftruncate(out, done)!=0) {
+    error = "cannot truncate " + dst + ": " + strerror(errno);
+    rc = 1;
+  }
+  if (close(out)!=0 && rc==0) {
+    error = "cannot write " + dst + ": " + strerror(errno);
+    rc = 1;
+  }
+  close(in);
+  pthread_mutex_lock(&m_mutex);
+  m_running.erase(dst);
+  pthread_mutex_unlock(&m_mutex);
+  cancelled(dest, true);
+  return rc;
+}
+
+
+//====================================================
+int PosixTransferBackend::replicate(const std::string& source, const std::string&,
+                                    const TransferOptions&, std::string& error) {
+  error = "cannot replicate " + source + ": no storage element behind a local path";
+  return 1;
+}
+
+
+//====================================================
+bool PosixTransferBackend::listReplicas(const std::string&, const TransferOptions&,
+                                        vector<string>& replicas, std::string&) {
+  replicas.clear();
+  return true;
+}
+
+
+//====================================================
+bool PosixTransferBackend::cancel(const std::string& dest) {
+  pthread_mutex_lock(&m_mutex);
+  bool running = m_running.count(path(dest))>0;
+  if (running)
+    m_cancelled.insert(path(dest));
+  pthread_mutex_unlock(&m_mutex);
+  return running;
+}
+
+
+//====================================================
+bool PosixTransferBackend::cancelled(const std::string& dest, bool clear) {
+  pthread_mutex_lock(&m_mutex);
+  set<string>::iterator itr = m_cancelled.find(path(dest));
+  bool found = (itr!=m_cancelled.end());
+  if (found && clear)
+    m_cancelled.erase(itr);
+  pthread_mutex_unlock(&m_mutex);
+  return found;
+}
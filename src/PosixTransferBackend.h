@@ -0,0 +1,62 @@
+#ifndef POSIXTRANSFERBACKEND_H
+#define POSIXTRANSFERBACKEND_H 1
+
+#include "ITransferBackend.h"
+#include <pthread.h>
+#include <set>
+
+/**  @class PosixTransferBackend  PosixTransferBackend.h
+ *   Copies from a mounted file system (NFS, cluster file systems) with plain POSIX calls,
+ *   without any grid middleware. Accepts absolute paths and "file:" URLs.
+ *   The data is moved in the kernel with sendfile where possible, with a read/write
+ *   loop as fallback; the source is read sequentially and the destination written
+ *   in order, so progressive reads work. Copies can be cancelled between chunks.
+ *   Argument: "--buffer-size <MB>" sets the chunk size (default 8 MB).
+ *
+ *   @version 1.0
+ */
+class PosixTransferBackend : public ITransferBackend {
+public:
+
+  PosixTransferBackend();
+  ~PosixTransferBackend();
+
+  string name() const {
+    return "posix";
+  }
+  bool accepts(const std::string& source) const;
+  void configure(const vector<string>& args);
+  int stat(const std::string& source, unsigned long long& size);
+  /// a path has no catalogue checksum: ENOTSUP
+  int checksum(const std::string& source, const TransferOptions& options,
+               unsigned long& adler32);
+  int copy(const std::string& source, const std::string& dest,
+           const TransferOptions& options, std::string& error);
+  /// there are no storage elements to replicate to
+  int replicate(const std::string& source, const std::string& dest,
+                const TransferOptions& options, std::string& error);
+  /// a path has no replicas: the list is left empty
+  bool listReplicas(const std::string& source, const TransferOptions& options,
+                    vector<string>& replicas, std::string& error);
+  bool cancel(const std::string& dest);
+  bool ranges() const {
+    return false;
+  }
+
+private:
+  PosixTransferBackend(const PosixTransferBackend&);
+  PosixTransferBackend& operator= (const PosixTransferBackend&);
+
+  /// path without the "file:" prefix
+  static string path(const std::string& name);
+  /// true if the copy into dest was cancelled; clears the request if clear is set
+  bool cancelled(const std::string& dest, bool clear=false);
+
+  size_t m_chunkSize;
+  pthread_mutex_t m_mutex;
+  /// destinations of the running copies, and those asked to stop
+  set<string> m_running;
+  set<string> m_cancelled;
+} ;
+
+#endif // POSIXTRANSFERBACKEND_H
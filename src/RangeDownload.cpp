@@ -0,0 +1,261 @@
+#include "RangeDownload.h"
+#include "Adler32.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "gfal_api.h"
+
+extern "C" {
+#include "lcg_util.h"
+}
+
+/// bytes read from the remote file per gfal_read call
+static const size_t s_bufferSize = 1024*1024;
+
+//====================================================
+
+RangeDownload::RangeDownload(const std::string& src, const std::string& dest, unsigned long long size,
+                             unsigned long long rangeSize, int nStreams)
+    : m_dest(dest)
+    , m_size(size)
+    , m_rangeSize(rangeSize>0 ? rangeSize : size)
+    , m_nStreams(nStreams>0 ? nStreams : 1)
+    , m_bytesDone(0)
+    , m_listener(0)
+    , m_destFd(-1)
+    , m_failed(false) {
+  m_replicas.push_back(src);
+  pthread_mutex_init(&m_mutex, 0);
+}
+
+
+RangeDownload::~RangeDownload() {
+  if (m_destFd>=0)
+    close(m_destFd);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+
+//====================================================
+void RangeDownload::setReplicas(const vector<string>& replicas) {
+  if (!replicas.empty())
+    m_replicas = replicas;
+}
+
+
+//====================================================
+bool RangeDownload::listReplicas(const std::string& src, const std::string& vo, int verbose,
+                                 vector<string>& replicas, std::string& error) {
+  const int errbufsz = 1024;
+  vector<char> file(src.begin(), src.end());
+  vector<char> voName(vo.begin(), vo.end());
+  vector<char> error_buf(errbufsz, '\0');
+  file.push_back('\0');
+  voName.push_back('\0');
+
+  char** pfns = 0;
+  replicas.clear();
+  if (lcg_lr3(&file[0], 0, &voName[0], &pfns, verbose, &error_buf[0], errbufsz)!=0) {
+    error = &error_buf[0];
+    return false;
+  }
+
+  // the array and its strings are allocated by lcg_util
+  for (int i=0; pfns && pfns[i]; ++i) {
+    replicas.push_back(pfns[i]);
+    free(pfns[i]);
+  }
+  free(pfns);
+  return true;
+}
+
+
+//====================================================
+int RangeDownload::run(std::string& error) {
+  m_destFd = open(m_dest.c_str(), O_WRONLY|O_CREAT, 0600);
+  if (m_destFd<0) {
+    error = "cannot create " + m_dest + ": " + strerror(errno);
+    return 1;
+  }
+  // the ranges are written out of order: reserve the whole file first,
+  // or else extend it to its size, with the blocks allocated as they are written
+  if (posix_fallocate(m_destFd, 0, m_size)==0) {
+    if (m_listener)
+      m_listener->preallocated();
+  } else if (ftruncate(m_destFd, m_size)!=0) {
+    error = "cannot allocate " + m_dest + ": " + strerror(errno);
+    return 1;
+  }
+
+  unsigned int nRanges(0);
+  for (unsigned long long offset=0; offset<m_size; offset+=m_rangeSize) {
+    Range range;
+    range.offset = offset;
+    range.length = (m_size-offset < m_rangeSize) ? m_size-offset : m_rangeSize;
+    // spread the ranges over the replicas
+    range.replica = nRanges++ % m_replicas.size();
+    range.attempts = 0;
+    range.index = nRanges-1;
+    m_ranges.push_back(range);
+  }
+  m_checksums.assign(nRanges, Adler32::initial);
+
+  vector<pthread_t> threads;
+  int nStreams = (int(nRanges) < m_nStreams) ? int(nRanges) : m_nStreams;
+  for (int i=0; i<nStreams; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, 0, &RangeDownload::runStream, this)==0)
+      threads.push_back(thread);
+  }
+  if (threads.empty() && nRanges>0)
+    stream(); // no thread could be created, fetch on the calling thread
+  for (unsigned int i=0; i<threads.size(); ++i)
+    pthread_join(threads[i], 0);
+
+  if (fsync(m_destFd)!=0 && !m_failed) {
+    m_failed = true;
+    m_error = "cannot write " + m_dest + ": " + strerror(errno);
+  }
+  close(m_destFd);
+  m_destFd = -1;
+
+  if (!m_failed && m_bytesDone!=m_size) {
+    char message[128];
+    sprintf(message, "incomplete download: %llu of %llu bytes", m_bytesDone, m_size);
+    m_failed = true;
+    m_error = message;
+  }
+  if (m_failed) {
+    error = m_error;
+    return 1;
+  }
+  return 0;
+}
+
+
+//====================================================
+unsigned long RangeDownload::checksum() const {
+  unsigned long adler = Adler32::initial;
+  for (unsigned int i=0; i<m_checksums.size(); ++i) {
+    unsigned long long length = (i+1==m_checksums.size()) ? m_size - i*m_rangeSize : m_rangeSize;
+    adler = Adler32::combine(adler, m_checksums[i], length);
+  }
+  return adler;
+}
+
+
+//====================================================
+void* RangeDownload::runStream(void* arg) {
+  static_cast<RangeDownload*>(arg)->stream();
+  return 0;
+}
+
+
+//====================================================
+void RangeDownload::stream() {
+  int fd(-1);
+  int fdReplica(-1);
+  // every replica is tried a few times before the range is given up
+  const int maxAttempts = 3*int(m_replicas.size());
+
+  pthread_mutex_lock(&m_mutex);
+  while (!m_failed && !m_ranges.empty()) {
+    if (stopRequested()) {
+      m_failed = true;
+      m_error = "download of " + m_dest + " cancelled";
+      break;
+    }
+    Range range = m_ranges.front();
+    m_ranges.pop_front();
+    pthread_mutex_unlock(&m_mutex);
+
+    string error;
+    unsigned long checksum(Adler32::initial);
+    bool ok = fetch(range, fd, fdReplica, checksum, error);
+
+    pthread_mutex_lock(&m_mutex);
+    if (ok) {
+      m_bytesDone += range.length;
+      m_checksums[range.index] = checksum;
+      if (m_listener)
+        m_listener->progress(m_bytesDone);
+    } else if (++range.attempts < maxAttempts) {
+      range.replica = (range.replica+1) % m_replicas.size();
+      m_ranges.push_back(range);
+    } else {
+      m_failed = true;
+      m_error = error;
+    }
+  }
+  pthread_mutex_unlock(&m_mutex);
+
+  if (fd>=0)
+    gfal_close(fd);
+}
+
+
+//====================================================
+bool RangeDownload::stopRequested() {
+  return m_listener && m_listener->cancelled();
+}
+
+
+//====================================================
+bool RangeDownload::fetch(const Range& range, int& fd, int& fdReplica, unsigned long& checksum, std::string& error) {
+  const string& src = m_replicas[range.replica];
+  if (fd>=0 && fdReplica!=int(range.replica)) {
+    gfal_close(fd);
+    fd = -1;
+  }
+  if (fd<0) {
+    fd = gfal_open(src.c_str(), O_RDONLY, 0);
+    if (fd<0) {
+      error = "cannot open " + src + ": " + strerror(errno);
+      return false;
+    }
+    fdReplica = range.replica;
+  }
+
+  if (gfal_lseek64(fd, range.offset, SEEK_SET) < 0) {
+    error = "cannot seek in " + src + ": " + strerror(errno);
+    gfal_close(fd);
+    fd = -1;
+    return false;
+  }
+
+  vector<char> buffer(s_bufferSize);
+  unsigned long long done(0);
+  while (done < range.length) {
+    if (stopRequested()) {
+      error = "download of " + m_dest + " cancelled";
+      return false;
+    }
+    size_t want = (range.length-done < s_bufferSize) ? size_t(range.length-done) : s_bufferSize;
+    ssize_t got = gfal_read(fd, &buffer[0], want);
+    if (got<=0) {
+      error = "cannot read " + src + ": " + (got<0 ? strerror(errno) : "unexpected end of file");
+      // the stream state is unknown after a failure, reopen for the next range
+      gfal_close(fd);
+      fd = -1;
+      return false;
+    }
+    ssize_t written(0);
+    while (written < got) {
+      ssize_t n = pwrite(m_destFd, &buffer[written], got-written, range.offset+done+written);
+      if (n<0) {
+        if (errno==EINTR)
+          continue;
+        error = "cannot write " + m_dest + ": " + strerror(errno);
+        return false;
+      }
+      written += n;
+    }
+    checksum = Adler32::update(checksum, reinterpret_cast<unsigned char*>(&buffer[0]), got);
+    done += got;
+  }
+  return true;
+}
@@ -0,0 +1,117 @@
+#ifndef RANGEDOWNLOAD_H
+#define RANGEDOWNLOAD_H 1
+
+#include <pthread.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+using namespace std ;
+
+/**  @class RangeDownload  RangeDownload.h
+ *   Downloads one file as a set of byte ranges fetched concurrently with the
+ *   gfal POSIX-like API, optionally spreading the ranges over several replicas
+ *   of the file. Every range is written at its offset into the preallocated
+ *   local file and a failed range is retried on its own, on the next replica.
+ *   The download only succeeds when all ranges are complete.
+ *   The Adler-32 of every range is computed while it is written, and the
+ *   checksum of the file combined from them at the end.
+ *
+ *   Runs on a StageWorkerPool thread; it creates its own threads for the ranges.
+ *
+ *   @version 1.0
+ */
+class RangeDownload {
+public:
+
+  /// Receives the progress of a download
+  class Listener {
+  public:
+    virtual ~Listener() {}
+    /// called from the stream threads, one at a time, whenever a range is complete
+    virtual void progress(unsigned long long bytesDone) = 0;
+    /// called once the blocks of the whole local file are allocated, before the first range
+    virtual void preallocated() {}
+    /// polled by the stream threads between reads; true stops the download
+    virtual bool cancelled() { return false; }
+  };
+
+  /** @param src gfal name of the remote file
+   *  @param dest local file name, without protocol prefix
+   *  @param size size of the remote file in bytes
+   *  @param rangeSize size of one range in bytes
+   *  @param nStreams number of ranges fetched at the same time
+   */
+  RangeDownload(const std::string& src, const std::string& dest, unsigned long long size,
+                unsigned long long rangeSize, int nStreams);
+  ~RangeDownload();
+
+  /** Sets the sources to read from, in order of preference. By default only src is used.
+   */
+  void setReplicas(const vector<string>& replicas);
+
+  /** Sets the receiver of the progress of the download; it must outlive run()
+   */
+  void setListener(Listener* listener) {
+    m_listener = listener;
+  }
+
+  /** Lists the replicas of a file with lcg_lr3
+   *  @return false if the lookup failed; replicas is then left empty
+   */
+  static bool listReplicas(const std::string& src, const std::string& vo, int verbose,
+                           vector<string>& replicas, std::string& error);
+
+  /** Runs the download
+   *  @param error description of the failure
+   *  @return 0 on success
+   */
+  int run(std::string& error);
+
+  /// Adler-32 of the downloaded file, valid after a successful run()
+  unsigned long checksum() const;
+
+private:
+
+  RangeDownload(const RangeDownload&);
+  RangeDownload& operator= (const RangeDownload&);
+
+  struct Range {
+    unsigned long long offset;
+    unsigned long long length;
+    /// position in m_checksums
+    unsigned int index;
+    /// index in m_replicas of the source of the next attempt
+    unsigned int replica;
+    int attempts;
+  };
+
+  static void* runStream(void* arg);
+  /// loop of one stream: takes ranges until none are left or the download failed or was cancelled
+  void stream();
+  /// true if the listener asks to stop the download
+  bool stopRequested();
+  /** Fetches one range into the local file.
+   *  fd and fdReplica are the open remote file of the stream and its replica index, reused between ranges
+   */
+  bool fetch(const Range& range, int& fd, int& fdReplica, unsigned long& checksum, std::string& error);
+
+  string m_dest;
+  unsigned long long m_size;
+  unsigned long long m_rangeSize;
+  int m_nStreams;
+  vector<string> m_replicas;
+
+  pthread_mutex_t m_mutex;
+  deque<Range> m_ranges;
+  /// Adler-32 of each range, in file order
+  vector<unsigned long> m_checksums;
+  unsigned long long m_bytesDone;
+  Listener* m_listener;
+  int m_destFd;
+  bool m_failed;
+  string m_error;
+} ;
+
+#endif // RANGEDOWNLOAD_H
@@ -0,0 +1,204 @@
+#include "ReplicaRanker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+/// weight of the last transfer in the throughput average
+static const double s_ewmaWeight = 0.3;
+/// throughput assumed for hosts without history, when no host is known at all (bytes/s)
+static const double s_defaultThroughput = 5.*1024*1024;
+/// fixed cost of one transfer (connection, SRM negotiation), in seconds
+static const double s_latency = 5.;
+/// transfers after which the counts are halved, so that old failures fade out
+static const int s_maxHistory = 100;
+
+namespace {
+  /// orders replicas by the expected time computed once per replica
+  struct ByTime {
+    bool operator()(const pair<double,string>& a, const pair<double,string>& b) const {
+      return a.first < b.first;
+    }
+  };
+}
+
+//====================================================
+ReplicaRanker::ReplicaRanker() {}
+
+
+//====================================================
+string ReplicaRanker::hostOf(const std::string& source) {
+  string::size_type begin = source.find("://");
+  if (begin==string::npos)
+    return string();
+  begin += 3;
+  string::size_type end = source.find_first_of(":/", begin);
+  return source.substr(begin, end==string::npos ? string::npos : end-begin);
+}
+
+
+//====================================================
+void ReplicaRanker::record(const std::string& source, unsigned long long bytes, double seconds, bool ok) {
+  string host = hostOf(source);
+  if (host.empty())
+    return;
+
+  HostStats& stats = m_hosts[host];
+  HostStats& recorded = m_recorded[host];
+  ++stats.transfers;
+  ++recorded.transfers;
+  if (!ok) {
+    ++stats.failures;
+    ++recorded.failures;
+  } else if (seconds>0) {
+    double throughput = bytes/seconds;
+    stats.throughput = (stats.throughput>0) ? (1-s_ewmaWeight)*stats.throughput + s_ewmaWeight*throughput
+                       : throughput;
+    recorded.throughput = stats.throughput;
+  }
+
+  if (stats.transfers > s_maxHistory) {
+    stats.transfers /= 2;
+    stats.failures /= 2;
+  }
+}
+
+
+//====================================================
+double ReplicaRanker::expectedTime(const std::string& source, unsigned long long bytes) const {
+  map<string,HostStats>::const_iterator itr = m_hosts.find(hostOf(source));
+
+  double throughput(0);
+  double success(0.5);
+  if (itr!=m_hosts.end()) {
+    throughput = (itr->second).throughput;
+    // Laplace estimate: one success and one failure assumed up front
+    success = double((itr->second).transfers - (itr->second).failures + 1) /
+              ((itr->second).transfers + 2);
+  }
+  if (throughput<=0) {
+    // unknown host: average of the known ones
+    double sum(0);
+    int n(0);
+    for (map<string,HostStats>::const_iterator i=m_hosts.begin(); i!=m_hosts.end(); ++i) {
+      if ((i->second).throughput>0) {
+        sum += (i->second).throughput;
+        ++n;
+      }
+    }
+    throughput = n ? sum/n : s_defaultThroughput;
+  }
+
+  // a failed attempt costs about as much again: divide by the success probability
+  return (s_latency + bytes/throughput) / success;
+}
+
+
+//====================================================
+void ReplicaRanker::rank(vector<string>& replicas, unsigned long long bytes) const {
+  vector< pair<double,string> > timed;
+  for (unsigned int i=0; i<replicas.size(); ++i)
+    timed.push_back(make_pair(expectedTime(replicas[i], bytes), replicas[i]));
+  stable_sort(timed.begin(), timed.end(), ByTime());
+  for (unsigned int i=0; i<timed.size(); ++i)
+    replicas[i] = timed[i].second;
+}
+
+
+//====================================================
+bool ReplicaRanker::load(const std::string& fileName) {
+  ifstream in(fileName.c_str());
+  if (!in)
+    return true;
+
+  string line;
+  while (getline(in, line)) {
+    if (line.empty() || line[0]=='#')
+      continue;
+    istringstream fields(line);
+    string host;
+    HostStats stats;
+    if (!(fields >> host >> stats.throughput >> stats.transfers >> stats.failures))
+      return false;
+    m_hosts[host] = stats;
+  }
+  return true;
+}
+
+
+//====================================================
+bool ReplicaRanker::save(const std::string& fileName) const {
+  // serializes the jobs of the node saving at the same time; without the lock the last one wins
+  string lockName = fileName + ".lock";
+  int lock = open(lockName.c_str(), O_RDWR|O_CREAT, 0644);
+  if (lock>=0)
+    flock(lock, LOCK_EX);
+
+  // the model as saved by the other jobs, plus what this job has seen
+  ReplicaRanker saved;
+  map<string,HostStats> merged;
+  if (saved.load(fileName)) {
+    merged = saved.m_hosts;
+    for (map<string,HostStats>::const_iterator i=m_recorded.begin(); i!=m_recorded.end(); ++i) {
+      HostStats& stats = merged[i->first];
+      stats.transfers += (i->second).transfers;
+      stats.failures += (i->second).failures;
+      if ((i->second).throughput>0)
+        stats.throughput = (i->second).throughput;
+      while (stats.transfers > s_maxHistory) {
+        stats.transfers /= 2;
+        stats.failures /= 2;
+      }
+    }
+  } else {
+    merged = m_hosts; // an unreadable file is replaced
+  }
+
+  bool ok = write(merged, fileName);
+  if (ok)
+    m_recorded.clear();
+  if (lock>=0) {
+    flock(lock, LOCK_UN);
+    close(lock);
+  }
+  return ok;
+}
+
+
+//====================================================
+bool ReplicaRanker::write(const map<string,HostStats>& hosts, const std::string& fileName) {
+  // a name of its own, in case another job writes without the lock
+  char pid[32];
+  sprintf(pid, ".%d.XXXXXX", int(getpid()));
+  string tmpName = fileName + pid;
+  vector<char> name(tmpName.begin(), tmpName.end());
+  name.push_back('\0');
+  int fd = mkstemp(&name[0]);
+  if (fd<0)
+    return false;
+  close(fd);
+  tmpName = &name[0];
+
+  {
+    ofstream out(tmpName.c_str());
+    if (out) {
+      out << "# host throughput[B/s] transfers failures" << endl;
+      for (map<string,HostStats>::const_iterator i=hosts.begin(); i!=hosts.end(); ++i)
+        out << i->first << " " << (i->second).throughput << " "
+        << (i->second).transfers << " " << (i->second).failures << endl;
+    }
+    if (!out) {
+      unlink(tmpName.c_str());
+      return false;
+    }
+  }
+  if (rename(tmpName.c_str(), fileName.c_str())!=0) {
+    unlink(tmpName.c_str());
+    return false;
+  }
+  return true;
+}
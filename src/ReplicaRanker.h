@@ -0,0 +1,73 @@
+#ifndef REPLICARANKER_H
+#define REPLICARANKER_H 1
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std ;
+
+/**  @class ReplicaRanker  ReplicaRanker.h
+ *   Model of the storage elements seen by past transfers: the achieved
+ *   throughput and the failure rate per SE host. It ranks the replicas of a
+ *   file by their expected completion time, and is kept in a small text file
+ *   so that the next job on the same node starts from what this one learned.
+ *
+ *   @version 1.0
+ */
+class ReplicaRanker {
+public:
+
+  ReplicaRanker();
+
+  /** Records the outcome of a transfer
+   *  @param source source handle of the transfer; handles without a host (e.g. lfn:) are ignored
+   *  @param bytes size of the file
+   *  @param seconds duration of the transfer
+   *  @param ok false if the transfer failed
+   */
+  void record(const std::string& source, unsigned long long bytes, double seconds, bool ok);
+
+  /** Expected time to copy a file of the given size from the source, failures included
+   *  @return the time in seconds
+   */
+  double expectedTime(const std::string& source, unsigned long long bytes) const;
+
+  /** Sorts the replicas by expected completion time, fastest first
+   */
+  void rank(vector<string>& replicas, unsigned long long bytes) const;
+
+  /** Reads the model from a file written by save(); a missing file is not an error
+   *  @return false if the file exists but could not be read
+   */
+  bool load(const std::string& fileName);
+
+  /** Writes the model to a file, replacing it atomically. The jobs of a node share the file:
+   *  under a lock on fileName.lock, the transfers recorded by this job are merged into the
+   *  model saved by the others since load().
+   *  @return false on write errors
+   */
+  bool save(const std::string& fileName) const;
+
+  /// host part of a URL such as srm://host:port/path, empty if there is none
+  static string hostOf(const std::string& source);
+
+private:
+
+  struct HostStats {
+    HostStats() : throughput(0), transfers(0), failures(0) {}
+    /// running (exponentially weighted) average, in bytes per second
+    double throughput;
+    int transfers;
+    int failures;
+  };
+
+  /// writes a model to a new file
+  static bool write(const map<string,HostStats>& hosts, const std::string& fileName);
+
+  map<string,HostStats> m_hosts;
+  /// transfers and failures recorded by this job since the last save, with the throughput average if it changed
+  mutable map<string,HostStats> m_recorded;
+} ;
+
+#endif // REPLICARANKER_H
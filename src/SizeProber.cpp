@@ -0,0 +1,217 @@
+#include "SizeProber.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+/// seconds after which a lookup failed with a transient error is repeated
+static const double s_errorLifetime = 30.;
+
+/// current time in seconds since the epoch
+static inline double currentTime() {
+  struct timeval tp;
+  gettimeofday( &tp, NULL );
+  return static_cast<double>( tp.tv_sec ) + static_cast<double>( tp.tv_usec )/1E6;
+}
+
+//====================================================
+
+SizeProber::SizeProber()
+    : m_notifyFd(-1)
+    , m_stop(false)
+    , m_listReplicas(false)
+    , m_lookupChecksums(false) {
+  pthread_mutex_init(&m_mutex, 0);
+  pthread_cond_init(&m_requestCond, 0);
+  pthread_cond_init(&m_doneCond, 0);
+}
+
+
+SizeProber::~SizeProber() {
+  stop();
+  pthread_cond_destroy(&m_doneCond);
+  pthread_cond_destroy(&m_requestCond);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+
+//====================================================
+void SizeProber::start(int nThreads) {
+  if (running())
+    return;
+
+  m_stop = false;
+  for (int i=0; i<nThreads; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, 0, &SizeProber::run, this)==0)
+      m_threads.push_back(thread);
+  }
+}
+
+
+//====================================================
+void SizeProber::stop() {
+  if (!running())
+    return;
+
+  pthread_mutex_lock(&m_mutex);
+  m_stop = true;
+  // forget the queued names, so that they can be submitted again
+  for (unsigned int i=0; i<m_requests.size(); ++i)
+    m_cache.erase(m_requests[i].key);
+  m_requests.clear();
+  pthread_cond_broadcast(&m_requestCond);
+  pthread_mutex_unlock(&m_mutex);
+
+  for (unsigned int i=0; i<m_threads.size(); ++i)
+    pthread_join(m_threads[i], 0);
+  m_threads.clear();
+}
+
+
+//====================================================
+void SizeProber::submit(const std::string& key, const std::string& url, ITransferBackend* backend, bool front) {
+  pthread_mutex_lock(&m_mutex);
+  Probe& probe = m_cache[key];
+  if (probe.state==UNKNOWN || expired(probe)) {
+    probe = Probe();
+    probe.state = PENDING;
+    Request request;
+    request.key = key;
+    request.url = url;
+    request.backend = backend;
+    if (front)
+      m_requests.push_front(request);
+    else
+      m_requests.push_back(request);
+    pthread_cond_signal(&m_requestCond);
+  } else if (probe.state==PENDING && front) {
+    deque<Request>::iterator itr = m_requests.begin();
+    for (; itr!=m_requests.end(); ++itr) {
+      if (itr->key == key) {
+        Request request = *itr;
+        m_requests.erase(itr);
+        m_requests.push_front(request);
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+//====================================================
+SizeProber::State SizeProber::lookup(const std::string& key, Probe& probe) {
+  pthread_mutex_lock(&m_mutex);
+  boost::unordered_map<string,Probe>::const_iterator itr = m_cache.find(key);
+  probe = (itr!=m_cache.end() && !expired(itr->second)) ? itr->second : Probe();
+  pthread_mutex_unlock(&m_mutex);
+  return probe.state;
+}
+
+
+//====================================================
+bool SizeProber::expired(const Probe& probe) {
+  return probe.state==DONE && probe.error!=0 && probe.error!=ENOENT &&
+         currentTime() - probe.finished > s_errorLifetime;
+}
+
+
+//====================================================
+void SizeProber::wait(const std::string& key, Probe& probe) {
+  pthread_mutex_lock(&m_mutex);
+  if (!running()) {
+    // no threads: run the queued lookup here
+    deque<Request>::iterator itr = m_requests.begin();
+    for (; itr!=m_requests.end(); ++itr) {
+      if (itr->key == key) {
+        Request request = *itr;
+        m_requests.erase(itr);
+        pthread_mutex_unlock(&m_mutex);
+        Probe result;
+        probeUrl(request, result);
+        pthread_mutex_lock(&m_mutex);
+        store(request.key, result);
+        break;
+      }
+    }
+  }
+  while (m_cache[key].state==PENDING)
+    pthread_cond_wait(&m_doneCond, &m_mutex);
+  probe = m_cache[key];
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+//====================================================
+bool SizeProber::poll(std::string& key, Probe& probe) {
+  bool found(false);
+  pthread_mutex_lock(&m_mutex);
+  if (!m_done.empty()) {
+    key = m_done.front();
+    m_done.pop_front();
+    probe = m_cache[key];
+    found = true;
+  }
+  pthread_mutex_unlock(&m_mutex);
+  return found;
+}
+
+
+//====================================================
+void* SizeProber::run(void* arg) {
+  static_cast<SizeProber*>(arg)->work();
+  return 0;
+}
+
+
+//====================================================
+void SizeProber::work() {
+  pthread_mutex_lock(&m_mutex);
+  while (true) {
+    while (m_requests.empty() && !m_stop)
+      pthread_cond_wait(&m_requestCond, &m_mutex);
+    if (m_stop)
+      break;
+
+    Request request = m_requests.front();
+    m_requests.pop_front();
+    pthread_mutex_unlock(&m_mutex);
+
+    Probe result;
+    probeUrl(request, result);
+
+    pthread_mutex_lock(&m_mutex);
+    store(request.key, result);
+    if (m_notifyFd>=0) {
+      char token(0);
+      // a full pipe already holds a pending notification
+      if (write(m_notifyFd, &token, 1) < 0) {}
+    }
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+//====================================================
+void SizeProber::probeUrl(const Request& request, Probe& probe) const {
+  probe.state = DONE;
+  probe.size = 0;
+  probe.error = request.backend->stat(request.url, probe.size);
+  if (probe.error==0 && m_listReplicas) {
+    string error;
+    // without the list, the middleware picks the source
+    request.backend->listReplicas(request.url, m_options, probe.replicas, error);
+  }
+  if (probe.error==0 && m_lookupChecksums)
+    probe.hasChecksum = (request.backend->checksum(request.url, m_options, probe.checksum)==0);
+
+  probe.finished = currentTime();
+}
+
+
+//====================================================
+void SizeProber::store(const std::string& key, const Probe& probe) {
+  m_cache[key] = probe;
+  m_done.push_back(key);
+  pthread_cond_broadcast(&m_doneCond);
+}
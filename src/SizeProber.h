@@ -0,0 +1,149 @@
+#ifndef SIZEPROBER_H
+#define SIZEPROBER_H 1
+
+#include <pthread.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include "ITransferBackend.h"
+
+using namespace std ;
+
+/**  @class SizeProber  SizeProber.h
+ *   Looks up the size (and existence, optionally the replicas and checksum) of the remote
+ *   input files through their ITransferBackend in a few background threads, so that the
+ *   StageManager never
+ *   waits on a metadata round trip to the storage element when it decides
+ *   what to stage next. Results are cached per input name for the whole job.
+ *
+ *   Like the StageWorkerPool, the threads only fill the cache; the
+ *   StageManager picks up the outcome on its own thread.
+ *
+ *   @version 1.0
+ */
+class SizeProber {
+public:
+
+  enum State { UNKNOWN, PENDING, DONE };
+
+  /// Outcome of one lookup
+  struct Probe {
+    Probe() : state(UNKNOWN), error(0), size(0), finished(0), hasChecksum(false), checksum(0) {}
+    State state;
+    /// errno of the lookup, 0 on success
+    int error;
+    unsigned long long size;
+    /// time at which the lookup ended (seconds since the epoch)
+    double finished;
+    /// replicas listed by the backend, if enabled with setReplicaLookup()
+    vector<string> replicas;
+    /// Adler-32 checksum held by the storage element, if enabled with setChecksumLookup()
+    bool hasChecksum;
+    unsigned long checksum;
+  };
+
+  SizeProber();
+  ~SizeProber();
+
+  /** Starts the probing threads. Calling it on a running prober has no effect.
+   *  @param nThreads maximal number of concurrent lookups
+   */
+  void start(int nThreads);
+
+  /** Drops the queued lookups and joins the threads. The cache is kept.
+   */
+  void stop();
+
+  bool running() const {
+    return !m_threads.empty();
+  }
+
+  /** Sets a file descriptor to which one byte is written every time a lookup finishes.
+   *  @param fd the write end of a non-blocking pipe, or -1 to disable
+   */
+  void setNotifyFd(int fd) {
+    m_notifyFd = fd;
+  }
+
+  /** Lists the replicas of every probed file as well.
+   *  Must be called before start().
+   */
+  void setReplicaLookup(const TransferOptions& options) {
+    m_options = options;
+    m_listReplicas = true;
+  }
+
+  /** Looks up the checksum of every probed file as well.
+   *  Must be called before start().
+   */
+  void setChecksumLookup(const TransferOptions& options) {
+    m_options = options;
+    m_lookupChecksums = true;
+  }
+
+  /** Queues a lookup, unless the name is already known or queued.
+   *  @param key input file name as used by the StageManager
+   *  @param url name as understood by the backend
+   *  @param backend backend looking up the file; must outlive the prober
+   *  @param front if true, the lookup is moved in front of the queue
+   */
+  void submit(const std::string& key, const std::string& url, ITransferBackend* backend, bool front=false);
+
+  /** Copies the current state of a lookup. A lookup which failed with another error than
+   *  ENOENT (e.g. a transient SRM failure) is forgotten after 30 seconds, so
+   *  that the next submit() looks the file up again.
+   *  @return the state, UNKNOWN if the name was never submitted or its lookup was forgotten
+   */
+  State lookup(const std::string& key, Probe& probe);
+
+  /** Blocks until the lookup of a submitted name has finished.
+   *  Without running threads, the lookup is done on the calling thread.
+   */
+  void wait(const std::string& key, Probe& probe);
+
+  /** Non-blocking retrieval of the names whose lookup finished since the last call
+   *  @return true if a name was available
+   */
+  bool poll(std::string& key, Probe& probe);
+
+private:
+
+  SizeProber(const SizeProber&);
+  SizeProber& operator= (const SizeProber&);
+
+  struct Request {
+    string key;
+    string url;
+    ITransferBackend* backend;
+  };
+
+  /// true for a lookup which failed with a transient error long enough ago to be repeated
+  static bool expired(const Probe& probe);
+
+  static void* run(void* arg);
+  void work();
+  void probeUrl(const Request& request, Probe& probe) const;
+  /// stores a finished lookup; m_mutex must be held
+  void store(const std::string& key, const Probe& probe);
+
+  pthread_mutex_t m_mutex;
+  /// signalled when a lookup is queued or the prober is stopped
+  pthread_cond_t m_requestCond;
+  /// signalled when a lookup has finished
+  pthread_cond_t m_doneCond;
+
+  deque<Request> m_requests;
+  boost::unordered_map<string,Probe> m_cache;
+  /// names finished and not yet returned by poll()
+  deque<string> m_done;
+  vector<pthread_t> m_threads;
+  int m_notifyFd;
+  bool m_stop;
+  bool m_listReplicas;
+  bool m_lookupChecksums;
+  TransferOptions m_options;
+} ;
+
+#endif // SIZEPROBER_H
@@ -0,0 +1,74 @@
+#include "SpaceLedger.h"
+#include <sys/stat.h>
+
+//====================================================
+void SpaceLedger::reserve(const std::string& path, unsigned long long bytes, bool preallocated) {
+  Reservation& reservation = m_reservations[path];
+  reservation.bytes = bytes;
+  reservation.preallocated = preallocated;
+  reservation.reported = false;
+  reservation.written = 0;
+}
+
+
+//====================================================
+void SpaceLedger::setWritten(const std::string& path, unsigned long long bytes) {
+  map<string,Reservation>::iterator itr = m_reservations.find(path);
+  if (itr==m_reservations.end())
+    return;
+  (itr->second).reported = true;
+  (itr->second).written = bytes;
+}
+
+
+//====================================================
+bool SpaceLedger::release(const std::string& path) {
+  return m_reservations.erase(path)>0;
+}
+
+
+//====================================================
+unsigned long long SpaceLedger::reserved() const {
+  unsigned long long total(0);
+  map<string,Reservation>::const_iterator itr = m_reservations.begin();
+  for (; itr!=m_reservations.end(); ++itr)
+    total += (itr->second).bytes;
+  return total;
+}
+
+
+//====================================================
+bool SpaceLedger::written(const std::string& path, unsigned long long& bytes) const {
+  map<string,Reservation>::const_iterator itr = m_reservations.find(path);
+  if (itr==m_reservations.end() || (itr->second).preallocated)
+    return false;
+
+  bytes = onDisk(path, itr->second);
+  return true;
+}
+
+
+//====================================================
+unsigned long long SpaceLedger::outstanding() const {
+  unsigned long long total(0);
+  map<string,Reservation>::const_iterator itr = m_reservations.begin();
+  for (; itr!=m_reservations.end(); ++itr) {
+    if ((itr->second).preallocated)
+      continue;
+
+    // a local stat per running transfer, bounded by the pipe length
+    unsigned long long written = onDisk(itr->first, itr->second);
+    if (written < (itr->second).bytes)
+      total += (itr->second).bytes - written;
+  }
+  return total;
+}
+
+
+//====================================================
+unsigned long long SpaceLedger::onDisk(const std::string& path, const Reservation& reservation) {
+  if (reservation.reported)
+    return reservation.written;
+  struct stat statbuf;
+  return (stat(path.c_str(), &statbuf)==0) ? statbuf.st_size : 0;
+}
@@ -0,0 +1,71 @@
+#ifndef SPACELEDGER_H
+#define SPACELEDGER_H 1
+
+#include <map>
+#include <string>
+
+using namespace std ;
+
+/**  @class SpaceLedger  SpaceLedger.h
+ *   Keeps track of the disk space promised to the transfers running into one
+ *   directory. statvfs only sees the bytes already written, so every admitted
+ *   file is charged with its full size until its transfer is over; the part
+ *   still to be written is subtracted from the free space when the next file
+ *   is admitted.
+ *
+ *   @version 1.0
+ */
+class SpaceLedger {
+public:
+
+  /** Charges a file against the free space of the directory
+   *  @param path local file the transfer writes to
+   *  @param bytes expected size of the file
+   *  @param preallocated true if the blocks have already been allocated with posix_fallocate,
+   *  in which case statvfs already accounts for them
+   */
+  void reserve(const std::string& path, unsigned long long bytes, bool preallocated);
+
+  /** Removes the charge of a file, once its transfer is over
+   *  @return true if the file was charged
+   */
+  bool release(const std::string& path);
+
+  /// bytes the running transfers still have to write, i.e. reserved minus already on disk
+  unsigned long long outstanding() const;
+
+  /// bytes reserved by the running transfers, i.e. the sizes of the files being written
+  unsigned long long reserved() const;
+
+  /** Bytes written so far to a charged file, from its size on disk or as set with setWritten()
+   *  @return false if the file is not charged, or preallocated so that its size tells nothing
+   */
+  bool written(const std::string& path, unsigned long long& bytes) const;
+
+  /** Sets the bytes on disk of a charged file whose size tells nothing, e.g. a range download
+   *  extended to its full size before its ranges are written. From then on, the file is no
+   *  longer looked at on disk.
+   */
+  void setWritten(const std::string& path, unsigned long long bytes);
+
+  bool empty() const {
+    return m_reservations.empty();
+  }
+
+private:
+  struct Reservation {
+    unsigned long long bytes;
+    bool preallocated;
+    /// bytes on disk as set with setWritten(), if reported is set
+    bool reported;
+    unsigned long long written;
+  };
+
+  /// bytes on disk of a charged file
+  static unsigned long long onDisk(const std::string& path, const Reservation& reservation);
+
+  /// reservations per local file name
+  map<string,Reservation> m_reservations;
+} ;
+
+#endif // SPACELEDGER_H
@@ -29,7 +29,8 @@ public:
                 RELEASED, ERRORSTAGING, TOBEREPLICATED,
                 REPLICATING, REPLICATED, ERRORREPLICATION};
   enum FallbackStrategy { NONE, SHARED_DIR, REPLICATION};
-  StageFileInfo() : pid(-999),fallbackStrategy(NONE) {}
+  StageFileInfo() : pid(-999),transferId(0),status(UNKNOWN),fallbackStrategy(NONE),originalFileSize(0),stageStart(0),stageEnd(0),verifyTime(0),
+                    progressTime(0),progressBytes(0),rate(0) {}
   ;
   ~StageFileInfo() {}
   ;
@@ -37,11 +38,17 @@ public:
   ///pid of the child process responsible for staging the file
   int  pid;
 
+  ///id of the StageWorkerPool job responsible for staging the file, when transfers run in-process
+  long transferId;
+
   /// original input file handle, prefix removed
   string inFile;
 
   /// local "staged" input file handle
   string outFile;
+
+  /// source handle of the current transfer attempt
+  string source;
   bool fromETC;
   /// value from StageFileInfo::Status enumeration
   Status status;
@@ -49,6 +56,20 @@ public:
   struct stat statFile;
   unsigned long originalFileSize;
 
+  ///time at which the transfer was started (seconds since the epoch)
+  double stageStart;
+
+  ///time at which the transfer ended (seconds since the epoch)
+  double stageEnd;
+
+  ///part of the transfer spent verifying the checksum of the copy (seconds)
+  double verifyTime;
+
+  ///time and bytes written of the last progress sample, and the transfer rate from the samples (bytes/s)
+  double progressTime;
+  unsigned long long progressBytes;
+  double rate;
+
   ///standard output used for redirection of stream in the child process
   string stout;
 
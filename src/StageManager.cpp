@@ -1,7 +1,6 @@
 #define _LARGEFILE64_SOURCE
 #include "StageManager.h"
 #include <fcntl.h>
-#include "gfal_api.h"
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -21,11 +20,14 @@
 #include <vector>
 #include <map>
 #include <algorithm>
+#include <cmath>
 #include "GaudiKernel/MsgStream.h"
 #include "GaudiKernel/SvcFactory.h"
 #include "GaudiKernel/ISvcLocator.h"
 #include "GaudiKernel/Service.h"
 #include "GaudiKernel/GaudiException.h"
+#include "RangeDownload.h"
+#include "Adler32.h"
 
 #include <boost/range.hpp>
 #include <boost/format.hpp>
@@ -37,10 +39,29 @@
 #define _XOPEN_SOURCE 600
 #include <sys/time.h>
 
-extern "C" {
-#include "lcg_util.h"
-}
 StagerInfo StageManager::s_stagerInfo;
+int StageManager::s_notifyPipe[2] = { -1, -1 };
+// weight of the newest sample in the running time estimates
+static const double s_ewmaWeight = 0.3;
+/// polling interval of waitForBytes(), in microseconds
+static const useconds_t s_progressPoll = 50000;
+/// interval at which a job waiting for another job's transfer checks the node cache
+static const useconds_t s_claimPoll = 200000;
+/// a job waiting for another job's transfer takes it over once the owner wrote nothing for this long, in seconds
+static const double s_claimStall = 30.;
+/// interval at which stageNext() looks again at a file another job is transferring, in seconds
+static const double s_claimRecheck = 2.;
+/// minimal interval between two refreshes of the live staging figures, in seconds
+static const double s_metricsInterval = 1.;
+/// waits of the event loop for a file shorter than this are not counted as stalls, in seconds
+static const double s_minStall = 0.01;
+/// transfers below this fraction of the average throughput are attributed to a slow source
+static const double s_slowFraction = 0.5;
+/// minimal interval between two samples of the transfer rate of a file, in seconds
+static const double s_rateInterval = 0.5;
+/// queued files looked at by stageNext(), past the ones waiting for a retry or a size lookup
+static const unsigned int s_lookahead = 32;
+struct sigaction StageManager::s_oldChildAction;
 
 namespace ba = boost::algorithm;
 using boost::iterator_range;
@@ -49,11 +70,23 @@ using boost::iterator_range;
 //====================================================
 
 StageManager::StageManager()
-    : m_submittedGarbageCollector(false)
-    , m_keepLogfiles(true)
-, m_msg(0) {
+    : m_msg(0)
+    , m_windowBytes(0)
+    , m_backend(0)
+    , m_liveMetrics(false)
+    , m_metricsTime(0)
+    , m_metricsProgress(0)
+    , m_transferTime(0)
+    , m_processingTime(0)
+    , m_stagedFiles(0)
+    , m_stagedBytes(0)
+    , m_stagedSeconds(0)
+    , m_submittedGarbageCollector(false)
+    , m_keepLogfiles(true) {
   m_stageMap.clear();
   m_toBeStagedList.clear();
+  for (int i=0; i<=StageFileInfo::ERRORREPLICATION; ++i)
+    m_statusCount[i] = 0;
   MsgStream log(m_msg, "StageManager");
 }
 
@@ -67,6 +100,15 @@ void StageManager::setOutputLevel(int new_level) {
 
 StageManager::~StageManager() {
   print();
+  // stop the in-process transfers and wait for them, so that their output can be removed
+  map<string,StageFileInfo>::const_iterator itr = m_stageMap.begin();
+  for (; itr!=m_stageMap.end(); ++itr) {
+    bool running;
+    if ((itr->second).status==StageFileInfo::STAGING && (itr->second).transferId>0)
+      stopTransfer(itr->first, running);
+  }
+  m_workerPool.stop();
+  m_sizeProber.stop();
   releaseAll();
 
   if (s_stagerInfo.tmpdir.compare(s_stagerInfo.baseTmpdir)!=0)
@@ -95,9 +137,9 @@ StageManager::addToList(const std::string& filename) {
   log << MSG::DEBUG << "addToList() : <" << input << ">"<< endmsg;
 
   if (m_stageMap.find(input)==m_stageMap.end()) {
-    list<string>::iterator itrF = find(m_toBeStagedList.begin(),m_toBeStagedList.end(),input);
-    if (itrF==m_toBeStagedList.end()) {
-      m_toBeStagedList.push_back(input);
+    if (m_toBeStagedList.push_back(input)) {
+      m_timeline.mark(input, StageTimeline::QUEUED, currentTime());
+      probeSize(input);
     }
   } // adding filename to m_toBeStagedList, if not present in m_stageMap
 
@@ -119,9 +161,11 @@ StageManager::releaseFile(const std::string& fname) {
   // first update status
   updateStatus();
 
-  list<string>::iterator itrF = find(m_toBeStagedList.begin(),m_toBeStagedList.end(),filename);
-  if(itrF!=m_toBeStagedList.end()) {
-    m_toBeStagedList.erase(itrF);
+  m_deferrals.erase(filename);
+  m_claimedElsewhere.erase(filename);
+  if(m_toBeStagedList.erase(filename)) {
+    m_retries.erase(filename);
+    m_timeline.mark(filename, StageTimeline::RELEASED, currentTime());
     return;
   }
 
@@ -132,6 +176,18 @@ StageManager::releaseFile(const std::string& fname) {
     return;
   }
   log << MSG::DEBUG << "releaseFile() : " << filename << endmsg;
+  m_timeline.mark(filename, StageTimeline::RELEASED, currentTime());
+
+  bool workerRunning(false);
+  if (m_stageMap[filename].status==StageFileInfo::STAGING &&
+      m_stageMap[filename].transferId>0) {
+    // transfer runs in a worker thread: the partial output of a running transfer
+    // is removed by collectWorkers() once the worker reports back
+    if (!stopTransfer(filename, workerRunning))
+      log << MSG::WARNING << "releaseFile() : the transfer of <" << filename
+      << "> can not be interrupted, it runs until it ends or times out." << endmsg;
+    setStatus(m_stageMap[filename], StageFileInfo::RELEASED);
+  }
 
   if (m_stageMap[filename].status==StageFileInfo::STAGING) {
     // kill process first
@@ -144,29 +200,37 @@ StageManager::releaseFile(const std::string& fname) {
       // assume file is done staging
       // fill statistics first
       stat(m_stageMap[filename].outFile.c_str(),&(m_stageMap[filename].statFile));
-      m_stageMap[filename].status=StageFileInfo::RELEASED;
+      setStatus(m_stageMap[filename], StageFileInfo::RELEASED);
     } else if( killReturn == EPERM) {
       // No permission to send kill signal
       // This shouldn't happen
       log << MSG::ERROR << "No permission to send kill signal for child process!"<< endmsg;
 
-      m_stageMap[filename].status=StageFileInfo::RELEASED;
+      setStatus(m_stageMap[filename], StageFileInfo::RELEASED);
     } else {
       log << MSG::INFO << "Kill signal sent. All Ok!"<< endmsg;
-      m_stageMap[filename].status=StageFileInfo::RELEASED;
+      setStatus(m_stageMap[filename], StageFileInfo::RELEASED);
     }
   }
 
   if (m_stageMap[filename].status==StageFileInfo::ERRORSTAGING) {
-    m_stageMap[filename].status=StageFileInfo::RELEASED;
+    setStatus(m_stageMap[filename], StageFileInfo::RELEASED);
   }
 
   if (m_stageMap[filename].status==StageFileInfo::STAGED) {
-    m_stageMap[filename].status=StageFileInfo::RELEASED;
+    setStatus(m_stageMap[filename], StageFileInfo::RELEASED);
   }
 
-  removeFile(m_stageMap[filename].outFile);
+  m_progressiveHandles.erase(s_stagerInfo.outfilePrefix+m_stageMap[filename].outFile);
 
+  // files found missing by the size lookup were never written, nor were dropped transfers
+  struct stat statbuf;
+  if (!workerRunning && !m_stageMap[filename].outFile.empty() &&
+      stat(m_stageMap[filename].outFile.c_str(), &statbuf)==0)
+    removeFile(m_stageMap[filename].outFile);
+
+  // the released bytes may let the next files into the prefetch window
+  refill();
 }
 
 
@@ -177,6 +241,7 @@ void StageManager::releaseAll() {
   for (; itr!=m_stageMap.end(); itr=m_stageMap.begin()) {
     string first = (itr->first);
     releaseFile(first.c_str());
+    --m_statusCount[(itr->second).status];
     m_stageMap.erase(itr);
   }
 }
@@ -186,13 +251,30 @@ void StageManager::releaseAll() {
 
 void
 StageManager::getFile(const std::string& fname) {
-  MsgStream log(m_msg, "StageManager");
-  log.setLevel(m_outputLevel);
   std::string tmpname(fname);
   trim(tmpname);
   fixRootInPrefix(tmpname);
   const std::string filename(tmpname);
 
+  // a file already in transfer when asked for was prefetched, but not early or fast enough
+  map<string,StageFileInfo>::const_iterator iEntry = m_stageMap.find(filename);
+  bool wasStaging = (iEntry!=m_stageMap.end() && (iEntry->second).status==StageFileInfo::STAGING);
+  double start = currentTime();
+
+  waitForFile(filename);
+
+  double waited = currentTime() - start;
+  if (waited >= s_minStall)
+    recordStall(filename, wasStaging, waited);
+}
+
+//====================================================
+
+void
+StageManager::waitForFile(const std::string& filename) {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+
   string name(filename);
   trim(name);
   removePrefixOf(name);
@@ -203,9 +285,8 @@ StageManager::getFile(const std::string& fname) {
   updateStatus();
 
   // file not found ->  start staging immediately
-  list<string>::iterator itrF = find(m_toBeStagedList.begin(),m_toBeStagedList.end(),filename);
   if (m_stageMap.find(filename)==m_stageMap.end() &&
-      (itrF==m_toBeStagedList.end()) ) {
+      !m_toBeStagedList.contains(filename) ) {
     log << MSG::DEBUG << "getFile() : " << filename
     << " not found. Start immediate staging." << endmsg;
 
@@ -213,11 +294,9 @@ StageManager::getFile(const std::string& fname) {
   } // filename not in m_stageMap and not in m_toBeStagedList
 
   // file needs to be staged
-  itrF = find(m_toBeStagedList.begin(),m_toBeStagedList.end(),filename);
-  if (itrF!=m_toBeStagedList.end() &&
+  if (m_toBeStagedList.contains(filename) &&
       m_stageMap.find(filename)==m_stageMap.end()) {
     // move file to front
-    m_toBeStagedList.erase(itrF);
     m_toBeStagedList.push_front(filename);
 
     log << MSG::DEBUG << "getFile() : " << filename
@@ -229,98 +308,92 @@ StageManager::getFile(const std::string& fname) {
   if (m_stageMap.find(filename)!=m_stageMap.end()) {
     log << MSG::INFO << "getFile() : Checking staging status of " << filename  << endmsg;
 
+    if (m_stageMap[filename].status==StageFileInfo::STAGING && progressive(filename)) {
+      log << MSG::INFO << "getFile() : <" << filename
+      << "> will be read while it is staging." << endmsg;
+      refill();
+      return;
+    }
+
     // file still staging
     if (m_stageMap[filename].status==StageFileInfo::STAGING) {
-
-      // check status
-      pid_t pID = m_stageMap[filename].pid;
-      int childExitStatus;
-
-      // wait till staging is done
-
-      log << MSG::INFO << "getFile()   : Waiting till <"
-      << filename << "> is staged." << endmsg;
-
-      waitpid( pID, &childExitStatus, 0);
-
-      //       log << MSG::DEBUG << "Passed the waitpid(,,0)" << "for "<< filename << endmsg;
-
-      if( !WIFEXITED(childExitStatus) ) {
-
-        log << MSG::WARNING << "getFile()::waitpid() "<<pID
-        <<" exited with status= "<< WEXITSTATUS(childExitStatus) << endmsg;
-        m_stageMap[filename].status = StageFileInfo::ERRORSTAGING;
-      } else if( WIFSIGNALED(childExitStatus) ) {
-        log << MSG::WARNING << "getFile()::waitpid() " <<pID
-        <<" exited with signal: " << WTERMSIG(childExitStatus)<< endmsg;
-        m_stageMap[filename].status = StageFileInfo::ERRORSTAGING;
-      } else {
-        //lcg-rep ends up always here
-        // child exited okay
-        log << MSG::DEBUG << "getFile()::waitpid() okay for file "
-        <<filename<<". WIFEXITED = "<<WEXITSTATUS(childExitStatus)
-        <<", exitStatus="<<childExitStatus<< endmsg;
+      m_metrics.waitingSince = currentTime();
+      m_metrics.waitingFor = filename;
+      updateMetrics(true);
+      waitForStaging(filename);
+
+      // a failed transfer is queued again: the job is blocked on it, so retry right away
+      while (m_toBeStagedList.contains(filename)) {
+        double backoff = m_retries[filename].notBefore - currentTime();
+        if (backoff>0) {
+          log << MSG::INFO << "getFile() : retrying <" << filename
+          << "> in " << backoff << " s." << endmsg;
+          usleep(useconds_t(backoff*1e6));
+        }
+        m_toBeStagedList.push_front(filename);
+        stageNext(true);
+        if (m_stageMap.find(filename)==m_stageMap.end() ||
+            m_stageMap[filename].status!=StageFileInfo::STAGING) {
+          // read from its original location now: a later refill() must not stage it any more
+          if (m_toBeStagedList.erase(filename))
+            m_retries.erase(filename);
+          break;
+        }
+        waitForStaging(filename);
       }
 
-      int ret = stat(m_stageMap[filename].outFile.c_str(),&(m_stageMap[filename].statFile));
-      if( 0 == ret) {
-        //      bool fexists = fileExists(m_stageMap[filename].outFile.c_str()); //TODO: remove function
-        log << MSG::INFO << "Local file size:"
-        << m_stageMap[filename].statFile.st_size << endmsg;
-
-        log << MSG::INFO << "Original file size:"
-        << m_stageMap[filename].originalFileSize << endmsg;
+      m_metrics.waitingSince = 0;
+      m_metrics.waitingFor.clear();
+      updateMetrics(true);
+    }
 
-        if (m_stageMap[filename].originalFileSize > m_stageMap[filename].statFile.st_size) {
-          m_stageMap[filename].status = StageFileInfo::ERRORSTAGING;
-          log << MSG::ERROR << "File only partialy staged, probably "
-          << " due to lack of free disk space in the process of staging. " << endmsg;
-          // 	  stageNext(true); //force staging again
-        } else {
-          m_stageMap[filename].status = StageFileInfo::STAGED;
-          // TODO: replicating turned off temporarily
-          //       else
-          //         replicateNext(true);
-        }
-      } else {
-        log << MSG::ERROR << "File does not exist on local storage. "<< endmsg;
-        m_stageMap[filename].status = StageFileInfo::ERRORSTAGING;
-      }
+    if (m_stageMap.find(filename)==m_stageMap.end()) {
+      log << MSG::ERROR << "getFile() : ERROR : staging of <"
+      << filename << "> could not be started. Original file location will be used."<< endmsg;
+      refill();
+      return;
+    }
 
-    } else if(m_stageMap[filename].status==StageFileInfo::REPLICATING) {
-      // check status
-      pid_t pID = m_stageMap[filename].pid;
-      int childExitStatus;
+    if(m_stageMap[filename].status==StageFileInfo::REPLICATING) {
       // wait till staging is done
       log << MSG::INFO << "getFile()   : Waiting till <"
       << filename << "> is replicated." << endmsg;
-      waitpid( pID, &childExitStatus, 0);
 
-      if( !WIFEXITED(childExitStatus) ) {
-        log << MSG::WARNING << "getFile()::waitpid() "
-        <<pID<<" exited with status= "<< WEXITSTATUS(childExitStatus) << endmsg;
-        m_stageMap[filename].status = StageFileInfo::ERRORREPLICATION;
-      } else if( WIFSIGNALED(childExitStatus) ) {
+      if (m_stageMap[filename].transferId>0) {
+        StageWorkerPool::Result result;
+        if (!m_workerPool.wait(m_stageMap[filename].transferId, result, s_stagerInfo.timeout))
+          log << MSG::WARNING << "getFile() : no end of the replication of " << filename
+          << " after " << s_stagerInfo.timeout << " s." << endmsg;
+        else if (result.rc!=0) {
+          log << MSG::WARNING << "getFile() : replication of "<< filename
+          <<" failed with: "<< result.error << endmsg;
+        }
+      } else {
+        // check status
+        pid_t pID = m_stageMap[filename].pid;
+        int childExitStatus;
+        waitpid( pID, &childExitStatus, 0);
+        m_children.erase(pID);
 
-        log << MSG::WARNING << "getFile()::waitpid() "
-        <<pID <<" exited with signal: " << WTERMSIG(childExitStatus)<< endmsg;
-        m_stageMap[filename].status = StageFileInfo::ERRORREPLICATION;
+        if( !WIFEXITED(childExitStatus) ) {
+          log << MSG::WARNING << "getFile()::waitpid() "
+          <<pID<<" exited with status= "<< WEXITSTATUS(childExitStatus) << endmsg;
+        } else if( WIFSIGNALED(childExitStatus) ) {
 
-      } else {
-        //lcg-rep ends up always here
-        // child exited okay
-        log << MSG::INFO << "getFile()::waitpid() okay for file "
-        <<filename<<". WIFEXITED = "<<WEXITSTATUS(childExitStatus)
-        <<", exitStatus="<<childExitStatus<< endmsg;
+          log << MSG::WARNING << "getFile()::waitpid() "
+          <<pID <<" exited with signal: " << WTERMSIG(childExitStatus)<< endmsg;
 
+        } else {
+          //lcg-rep ends up always here
+          // child exited okay
+          log << MSG::INFO << "getFile()::waitpid() okay for file "
+          <<filename<<". WIFEXITED = "<<WEXITSTATUS(childExitStatus)
+          <<", exitStatus="<<childExitStatus<< endmsg;
+
+        }
       }
 
-      log << MSG::INFO << "before replicaExists " << endmsg;
-      bool replicaexists = replicaExists(filename);
-      if (replicaexists)
-        m_stageMap[filename].status = StageFileInfo::REPLICATED;
-      else
-        m_stageMap[filename].status = StageFileInfo::ERRORREPLICATION;
+      finishReplication(filename);
     } // filename status == REPLICATING
 
     // file is staged
@@ -330,31 +403,350 @@ StageManager::getFile(const std::string& fname) {
 
       //       stat(m_stageMap[filename].outFile.c_str(),&(m_stageMap[filename].statFile));
       // start next stage
-      stageNext();
+      refill();
       return;
     } else if(m_stageMap[filename].status == StageFileInfo::REPLICATED) {
       log << MSG::INFO << "getFile() : <" << filename
       << "> finished replicating." << endmsg;
-      stageNext();
+      refill();
       return;
     } else {
       log << MSG::ERROR << "getFile() : ERROR : staging/replicating of <"
       << filename << "> failed. Giving up. Original file location will be used."<< endmsg;
     }
-    stageNext();
+    refill();
   } // child exists, waitpid - to finish staging
 }
 
 //====================================================
 
+void
+StageManager::waitForStaging(const std::string& filename) {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  bool transferOk(true);
+
+  // wait till staging is done
+
+  log << MSG::INFO << "getFile()   : Waiting till <"
+  << filename << "> is staged." << endmsg;
+
+  if (m_stageMap[filename].transferId>0) {
+    StageWorkerPool::Result result;
+    if (!m_workerPool.wait(m_stageMap[filename].transferId, result, s_stagerInfo.timeout)) {
+      // a late result no longer matches the transfer id of a retry, and is ignored
+      log << MSG::WARNING << "getFile() : no end of the transfer of " << filename
+      << " after " << s_stagerInfo.timeout << " s." << endmsg;
+      bool running;
+      if (!stopTransfer(filename, running))
+        log << MSG::WARNING << "getFile() : the transfer of " << filename
+        << " can not be interrupted, it runs until it ends or times out." << endmsg;
+      transferOk = false;
+    } else if (result.rc!=0) {
+      log << MSG::WARNING << "getFile() : transfer of "<< filename
+      <<" failed with: "<< result.error << endmsg;
+      transferOk = false;
+    } else {
+      m_stageMap[filename].verifyTime = result.verifySeconds;
+    }
+  } else {
+    // check status
+    pid_t pID = m_stageMap[filename].pid;
+    int childExitStatus;
+
+    waitpid( pID, &childExitStatus, 0);
+    m_children.erase(pID);
+
+    //       log << MSG::DEBUG << "Passed the waitpid(,,0)" << "for "<< filename << endmsg;
+
+    if( !WIFEXITED(childExitStatus) ) {
+
+      log << MSG::WARNING << "getFile()::waitpid() "<<pID
+      <<" exited with status= "<< WEXITSTATUS(childExitStatus) << endmsg;
+      transferOk = false;
+    } else if( WIFSIGNALED(childExitStatus) ) {
+      log << MSG::WARNING << "getFile()::waitpid() " <<pID
+      <<" exited with signal: " << WTERMSIG(childExitStatus)<< endmsg;
+      transferOk = false;
+    } else if( WEXITSTATUS(childExitStatus)!=0 ) {
+      log << MSG::WARNING << "getFile()::waitpid() " <<pID
+      <<" exited with status= "<< WEXITSTATUS(childExitStatus) << endmsg;
+      transferOk = false;
+    } else {
+      //lcg-rep ends up always here
+      // child exited okay
+      log << MSG::DEBUG << "getFile()::waitpid() okay for file "
+      <<filename<<". WIFEXITED = "<<WEXITSTATUS(childExitStatus)
+      <<", exitStatus="<<childExitStatus<< endmsg;
+    }
+  }
+
+  finishStaging(filename, transferOk);
+}
+
+//====================================================
+
+void
+StageManager::finishStaging(const std::string& filename, bool transferOk) {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  m_stageMap[filename].stageEnd = currentTime();
+
+  if (!transferOk) {
+    log << MSG::ERROR << "Transfer of <" << filename << "> failed." << endmsg;
+    m_timeline.mark(filename, StageTimeline::TRANSFER_FINISHED, currentTime(), false);
+    m_replicaRanker.record(m_stageMap[filename].source, 0, 0, false);
+    if (!retryStaging(filename))
+      setStatus(m_stageMap[filename], StageFileInfo::ERRORSTAGING);
+    return;
+  }
+
+  int ret = stat(m_stageMap[filename].outFile.c_str(),&(m_stageMap[filename].statFile));
+  if( 0 == ret) {
+    log << MSG::INFO << "Local file size:"
+    << m_stageMap[filename].statFile.st_size << endmsg;
+
+    log << MSG::INFO << "Original file size:"
+    << m_stageMap[filename].originalFileSize << endmsg;
+
+    if (m_stageMap[filename].originalFileSize > m_stageMap[filename].statFile.st_size) {
+      log << MSG::ERROR << "File only partialy staged, probably "
+      << " due to lack of free disk space in the process of staging. " << endmsg;
+      m_timeline.mark(filename, StageTimeline::TRANSFER_FINISHED, currentTime(), false);
+      m_replicaRanker.record(m_stageMap[filename].source, 0, 0, false);
+      if (!retryStaging(filename))
+        setStatus(m_stageMap[filename], StageFileInfo::ERRORSTAGING);
+    } else {
+      // published before the claim on the transfer is dropped, for the jobs waiting on it
+      if (m_stageMap[filename].fallbackStrategy == StageFileInfo::NONE &&
+          m_nodeCache.publish(middlewareName(filename), m_stageMap[filename].originalFileSize,
+                              m_stageMap[filename].outFile))
+        log << MSG::DEBUG << "Published <" << filename << "> in the node cache." << endmsg;
+      setStatus(m_stageMap[filename], StageFileInfo::STAGED);
+      m_timeline.mark(filename, StageTimeline::TRANSFER_FINISHED, currentTime());
+      unsigned long checksum;
+      // a copy with a wrong checksum was reported as a failed transfer
+      if (expectedChecksum(filename, checksum))
+        m_timeline.mark(filename, StageTimeline::VERIFIED, currentTime());
+
+      double seconds = m_stageMap[filename].stageEnd - m_stageMap[filename].stageStart;
+      ++m_stagedFiles;
+      m_stagedBytes += m_stageMap[filename].originalFileSize;
+      m_stagedSeconds += seconds;
+      m_stagedIntervals.push_back(make_pair(m_stageMap[filename].stageStart, m_stageMap[filename].stageEnd));
+      m_replicaRanker.record(m_stageMap[filename].source, m_stageMap[filename].originalFileSize, seconds, true);
+      m_transferTime = (m_transferTime>0) ? (1-s_ewmaWeight)*m_transferTime + s_ewmaWeight*seconds : seconds;
+      adaptPipeLength();
+    }
+  } else {
+    log << MSG::ERROR << "File does not exist on local storage. "<< endmsg;
+    m_timeline.mark(filename, StageTimeline::TRANSFER_FINISHED, currentTime(), false);
+    m_replicaRanker.record(m_stageMap[filename].source, 0, 0, false);
+    if (!retryStaging(filename))
+      setStatus(m_stageMap[filename], StageFileInfo::ERRORSTAGING);
+  }
+}
+
+//====================================================
+
+bool
+StageManager::retryStaging(const std::string& filename) {
+  map<string,StageFileInfo>::iterator itr = m_stageMap.find(filename);
+  if (itr==m_stageMap.end() || (itr->second).status!=StageFileInfo::STAGING)
+    return false;
+
+  RetryInfo& retry = m_retries[filename];
+  if (retry.attempts >= s_stagerInfo.maxRetries)
+    return false;
+
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+
+  // the following attempts go through the other replicas of the file, listed by the size lookup
+  retry.tried.insert((itr->second).source);
+
+  double backoff = s_stagerInfo.retryBackoff * pow(2., retry.attempts);
+  ++retry.attempts;
+  retry.notBefore = currentTime() + backoff;
+
+  struct stat statbuf;
+  if (stat((itr->second).outFile.c_str(), &statbuf)==0)
+    removeFile((itr->second).outFile);
+
+  dropEntry(filename);
+  m_toBeStagedList.push_front(filename);
+  log << MSG::WARNING << "retryStaging() : attempt " << retry.attempts+1 << " of "
+  << s_stagerInfo.maxRetries+1 << " for <" << filename << "> in " << backoff
+  << " s, from <" << copySource(filename) << ">." << endmsg;
+  return true;
+}
+
+//====================================================
+
+string
+StageManager::copySource(const std::string& filename) {
+  vector<string> replicas = replicasOf(filename);
+  if (replicas.empty())
+    return middlewareName(filename);
+
+  map<string,StageFileInfo>::const_iterator iEntry = m_stageMap.find(filename);
+  m_replicaRanker.rank(replicas, (iEntry!=m_stageMap.end()) ? (iEntry->second).originalFileSize : 0);
+
+  // fastest replica not tried yet for this file
+  map<string,RetryInfo>::const_iterator iRetry = m_retries.find(filename);
+  if (iRetry==m_retries.end())
+    return replicas.front();
+  for (unsigned int i=0; i<replicas.size(); ++i) {
+    if ((iRetry->second).tried.count(replicas[i])==0)
+      return replicas[i];
+  }
+  return replicas[(iRetry->second).attempts % replicas.size()];
+}
+
+//====================================================
+
+string
+StageManager::middlewareName(const std::string& filename) {
+  string src(filename);
+  trim(src);
+  removePrefixOf(src);
+  iterator_range< string::iterator > inFileCorrected;
+
+  //lcg-cp does not like LFN: just lfn:....
+  if ( inFileCorrected = ba::find_first( src , "LFN:" ) )
+    ba::to_lower( inFileCorrected );
+
+  ba::replace_first(src , "lfn:/lhcb", "lfn:/grid/lhcb");
+  return src;
+}
+
+//====================================================
+
+vector<string>
+StageManager::replicasOf(const std::string& filename) {
+  map<string, vector<string> >::const_iterator itr = m_replicas.find(filename);
+  if (itr!=m_replicas.end())
+    return itr->second;
+
+  SizeProber::Probe probe;
+  if (m_sizeProber.lookup(filename, probe)==SizeProber::DONE && !probe.replicas.empty()) {
+    m_replicas[filename] = probe.replicas;
+    return probe.replicas;
+  }
+  return vector<string>();
+}
+
+//====================================================
+
+void
+StageManager::finishReplication(const std::string& filename) {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  log << MSG::INFO << "before replicaExists " << endmsg;
+  bool replicaexists = replicaExists(filename);
+  if (replicaexists)
+    setStatus(m_stageMap[filename], StageFileInfo::REPLICATED);
+  else
+    setStatus(m_stageMap[filename], StageFileInfo::ERRORREPLICATION);
+}
+
+//====================================================
+
+void
+StageManager::collectWorkers() {
+  if (!m_workerPool.running())
+    return;
+
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+
+  StageWorkerPool::Result result;
+  while (m_workerPool.poll(result)) {
+    map<string,StageFileInfo>::iterator itr = m_stageMap.find(result.key);
+    if (itr==m_stageMap.end() || (itr->second).transferId!=result.id)
+      continue;
+
+    log << MSG::DEBUG << "collectWorkers() : transfer of <" << result.key
+    << "> ended with rc=" << result.rc << endmsg;
+    if (result.rc!=0)
+      log << MSG::WARNING << "collectWorkers() : " << result.error << endmsg;
+
+    if ((itr->second).status==StageFileInfo::STAGING) {
+      (itr->second).verifyTime = result.verifySeconds;
+      finishStaging(result.key, result.rc==0);
+    }
+    else if ((itr->second).status==StageFileInfo::REPLICATING)
+      finishReplication(result.key);
+    else if ((itr->second).status==StageFileInfo::RELEASED &&
+             result.type!=StageWorkerPool::REPLICATE)
+      removeFile((itr->second).outFile); // released while still transferring
+  }
+}
+
+//====================================================
+
+StageWorkerPool::Job
+StageManager::makeJob(const std::string& cf, StageWorkerPool::JobType type,
+                      const std::string& src, const std::string& dest) {
+  StageWorkerPool::Job job;
+  job.id = 0;
+  job.type = type;
+  job.key = cf;
+  // replicas are only known to the grid middleware
+  job.backend = (type==StageWorkerPool::REPLICATE) ? &m_lcgBackend : &backendFor(cf);
+  job.src = src;
+  job.dest = dest;
+  job.vo = s_stagerInfo.vo;
+  job.nbstreams = s_stagerInfo.gridFTPstreams;
+  job.verbose = s_stagerInfo.verbose;
+  job.timeout = s_stagerInfo.timeout;
+  job.size = 0;
+  job.rangeSize = 0;
+  job.allReplicas = false;
+  job.replicas.clear();
+  job.verify = (type != StageWorkerPool::REPLICATE) && expectedChecksum(cf, job.checksum);
+  job.local = m_stageMap[cf].outFile;
+  return job;
+}
+
+//====================================================
+
+void
+StageManager::startWorkers() {
+  if (s_stagerInfo.transferThreads>0)
+    m_workerPool.start(s_stagerInfo.transferThreads);
+  else
+    m_workerPool.start(std::max(s_stagerInfo.pipeLength, s_stagerInfo.maxPipeLength));
+}
+
+//====================================================
+
+bool
+StageManager::useWorkers() const {
+  return s_stagerInfo.transferThreads>0 || m_sizeProber.running() || m_workerPool.running();
+}
+
+//====================================================
+
+bool
+StageManager::useRanges(const StageFileInfo& info) {
+  return s_stagerInfo.rangeSize>0 && s_stagerInfo.rangeStreams>1 &&
+         info.originalFileSize >= 2*s_stagerInfo.rangeSize &&
+         backendFor(info.inFile).ranges();
+}
+
+//====================================================
+
 
 const string
 StageManager::getTmpFilename(const std::string& filename) {
   MsgStream log(m_msg, "StageManager");
   log.setLevel(m_outputLevel);
-  if (m_stageMap.find(filename)!=m_stageMap.end())
-    if (!m_stageMap[filename].outFile.empty())
-      return m_stageMap[filename].outFile.c_str();
+  // look up without operator[], which would insert an empty entry for every queued file
+  map<string,StageFileInfo>::iterator iEntry = m_stageMap.find(filename);
+  if (iEntry!=m_stageMap.end())
+    if (!(iEntry->second).outFile.empty())
+      return (iEntry->second).outFile.c_str();
 
   string infile(filename);
   trim(infile);
@@ -363,12 +755,20 @@ StageManager::getTmpFilename(const std::string& filename) {
   string::size_type pos = tmpfile.find_last_of("/:");
 
   string dir;
-  if(m_stageMap[filename].fallbackStrategy == StageFileInfo::NONE)
+  if(iEntry==m_stageMap.end() ||
+     (iEntry->second).fallbackStrategy == StageFileInfo::NONE)
     dir = s_stagerInfo.tmpdir;
   else
     dir = s_stagerInfo.fallbackDir;
 
-  tmpfile = dir + "/tcf_" +  tmpfile.substr(pos+1,tmpfile.size()-pos-1);
+  // every retry writes a file of its own: the copy of a timed-out attempt which could not
+  // be interrupted may still be writing the previous one
+  string attempt;
+  map<string,RetryInfo>::const_iterator iRetry = m_retries.find(filename);
+  if (iRetry!=m_retries.end() && (iRetry->second).attempts>0)
+    attempt = boost::str(boost::format("%d_") % (iRetry->second).attempts);
+
+  tmpfile = dir + "/tcf_" + attempt + tmpfile.substr(pos+1,tmpfile.size()-pos-1);
   log << MSG::DEBUG << "getTmpFilename() : <"
   << tmpfile << "> <"<< tmpfile.c_str() << ">"<< endmsg;
   return tmpfile;
@@ -382,8 +782,7 @@ StageManager::getStatusOf(const std::string& filename, bool update) {
   if (update)
     updateStatus();
 
-  list<string>::iterator itrF = find(m_toBeStagedList.begin(),m_toBeStagedList.end(),filename);
-  if(itrF!=m_toBeStagedList.end()) {
+  if(m_toBeStagedList.contains(filename)) {
     return StageFileInfo::TOBESTAGED;
   }
 
@@ -407,7 +806,7 @@ StageManager::print() {
   long sumsize(0);
   long sumfiles(0);
 
-  list<string>::iterator itrb = m_toBeStagedList.begin();
+  StageQueue::const_iterator itrb = m_toBeStagedList.begin();
   for (; itrb!=m_toBeStagedList.end(); ++itrb) {
     filename = *itrb;
     status = getStatusOf(filename.c_str(),false);
@@ -443,21 +842,93 @@ StageManager::print() {
 
 //====================================================
 int StageManager::getNstaging() {
-  int nentries(0);
+  int nentries = m_statusCount[StageFileInfo::STAGING] + m_statusCount[StageFileInfo::REPLICATING];
 
   MsgStream log(m_msg, "StageManager");
   log.setLevel(m_outputLevel);
-  map<string,StageFileInfo>::iterator itr = m_stageMap.begin();
-  for (; itr!=m_stageMap.end(); ++itr) {
-    if ((itr->second).status == StageFileInfo::STAGING || (itr->second).status == StageFileInfo::REPLICATING)
-      nentries++;
-  }
-
   log <<  MSG::DEBUG << "getNstaging() = " << nentries << endmsg;
 
   return nentries;
 }
 
+//====================================================
+void StageManager::setStatus(StageFileInfo& info, StageFileInfo::Status status) {
+  if (info.status==StageFileInfo::STAGING && status!=StageFileInfo::STAGING) {
+    releaseSpace(info);
+    m_nodeCache.release(info.outFile);
+  }
+  --m_statusCount[info.status];
+  if (inWindow(info.status))
+    m_windowBytes -= info.originalFileSize;
+  info.status = status;
+  ++m_statusCount[status];
+  if (inWindow(status))
+    m_windowBytes += info.originalFileSize;
+}
+
+//====================================================
+StageFileInfo& StageManager::newEntry(const std::string& cf) {
+  map<string,StageFileInfo>::iterator itr = m_stageMap.find(cf);
+  if (itr==m_stageMap.end()) {
+    itr = m_stageMap.insert(make_pair(cf, StageFileInfo())).first;
+  } else {
+    setStatus(itr->second, StageFileInfo::UNKNOWN);
+    --m_statusCount[StageFileInfo::UNKNOWN];
+    itr->second = StageFileInfo();
+  }
+  ++m_statusCount[(itr->second).status];
+  return itr->second;
+}
+
+//====================================================
+void StageManager::dropEntry(const std::string& cf) {
+  map<string,StageFileInfo>::iterator itr = m_stageMap.find(cf);
+  if (itr==m_stageMap.end())
+    return;
+  setStatus(itr->second, StageFileInfo::UNKNOWN);
+  --m_statusCount[StageFileInfo::UNKNOWN];
+  m_stageMap.erase(itr);
+}
+
+//====================================================
+bool StageManager::inWindow(StageFileInfo::Status status) {
+  return status==StageFileInfo::STAGING ||
+         status==StageFileInfo::STAGED ||
+         status==StageFileInfo::ERRORSTAGING;
+}
+
+//====================================================
+unsigned long long StageManager::windowBudget() {
+  unsigned long long budget = s_stagerInfo.prefetchBytes;
+
+  if (s_stagerInfo.prefetchFreeFraction>0) {
+    struct statvfs info;
+    if (statvfs(s_stagerInfo.tmpdir.c_str(), &info)==0) {
+      // the files already in the window count as available to the window
+      double available = double(info.f_bavail)*double(info.f_bsize) + double(m_windowBytes);
+      unsigned long long fromFree = (unsigned long long)(s_stagerInfo.prefetchFreeFraction*available);
+      if (budget==0 || fromFree<budget)
+        budget = fromFree;
+    }
+  }
+  return budget;
+}
+
+//====================================================
+bool StageManager::admitToWindow(unsigned long size) {
+  if (s_stagerInfo.prefetchBytes==0 && s_stagerInfo.prefetchFreeFraction<=0)
+    return true;
+  if (m_windowBytes==0)
+    return true;
+
+  unsigned long long budget = windowBudget();
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  log << MSG::DEBUG << "admitToWindow() : window " << m_windowBytes/(1024*1024)
+  << " MB + " << size/(1024*1024) << " MB, budget " << budget/(1024*1024) << " MB" << endmsg;
+  return m_windowBytes + size <= budget;
+}
+
 //====================================================
 StatusCode StageManager::getLocalHandle(const std::string& dataset, std::string & dataset_local) {
   MsgStream log(m_msg, "StageManager");
@@ -475,14 +946,81 @@ StatusCode StageManager::getLocalHandle(const std::string& dataset, std::string
     dataset_local = s_stagerInfo.infilePrefix+m_stageMap[dataset].outFile;
   else if(m_stageMap[dataset].status == StageFileInfo::STAGED)
     dataset_local = s_stagerInfo.outfilePrefix+m_stageMap[dataset].outFile;
-  else
+  else if(m_stageMap[dataset].status == StageFileInfo::STAGING && progressive(dataset)) {
+    dataset_local = s_stagerInfo.outfilePrefix+m_stageMap[dataset].outFile;
+    m_progressiveHandles[dataset_local] = dataset;
+  } else
     return StatusCode::FAILURE;
 
   return StatusCode::SUCCESS;
 }
 
 //====================================================
-void StageManager::replicateNext(bool forceReplication) {
+bool StageManager::progressive(const std::string& filename) const {
+  vector<string>::const_iterator itr = s_stagerInfo.progressiveExtensions.begin();
+  for (; itr!=s_stagerInfo.progressiveExtensions.end(); ++itr) {
+    if (ba::iends_with(filename, *itr))
+      return true;
+  }
+  return false;
+}
+
+//====================================================
+bool StageManager::isProgressive(const std::string& dataset_local) const {
+  return m_progressiveHandles.find(dataset_local)!=m_progressiveHandles.end();
+}
+
+//====================================================
+string StageManager::remoteName(const std::string& dataset_local) const {
+  map<string,string>::const_iterator iHandle = m_progressiveHandles.find(dataset_local);
+  return (iHandle!=m_progressiveHandles.end()) ? iHandle->second : string();
+}
+
+//====================================================
+bool StageManager::waitForBytes(const std::string& dataset_local, long long nbytes) {
+  map<string,string>::const_iterator iHandle = m_progressiveHandles.find(dataset_local);
+  if (iHandle==m_progressiveHandles.end())
+    return true; // a complete local copy
+
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  const string filename = iHandle->second;
+  long long lastSize(-1);
+  double lastProgress = currentTime();
+
+  while (true) {
+    updateStatus();
+    map<string,StageFileInfo>::iterator itr = m_stageMap.find(filename);
+    if (itr==m_stageMap.end())
+      return false;
+    if ((itr->second).status==StageFileInfo::STAGED)
+      return true;
+    if ((itr->second).status!=StageFileInfo::STAGING) {
+      log << MSG::WARNING << "waitForBytes() : staging of <" << filename
+      << "> failed while it was read." << endmsg;
+      return false;
+    }
+
+    // the transfer writes sequentially, so the file size is the readable range
+    struct stat statbuf;
+    long long size = (stat((itr->second).outFile.c_str(), &statbuf)==0) ? statbuf.st_size : 0;
+    if (nbytes>=0 && size>=nbytes)
+      return true;
+
+    if (size!=lastSize) {
+      lastSize = size;
+      lastProgress = currentTime();
+    } else if (currentTime()-lastProgress > s_stagerInfo.progressiveStall) {
+      log << MSG::WARNING << "waitForBytes() : no progress staging <" << filename
+      << "> for " << s_stagerInfo.progressiveStall << " s." << endmsg;
+      return false;
+    }
+    usleep(s_progressPoll);
+  }
+}
+
+//====================================================
+void StageManager::replicateNext(const std::string& cf, bool forceReplication) {
 
   MsgStream log(m_msg, "StageManager");
   log.setLevel(m_outputLevel);
@@ -491,9 +1029,7 @@ void StageManager::replicateNext(bool forceReplication) {
   updateStatus();
 
   if (( (getNstaging()<s_stagerInfo.pipeLength) || forceReplication) &&
-      (!m_toBeStagedList.empty()) ) {
-
-    string cf = *(m_toBeStagedList.begin());
+      m_toBeStagedList.contains(cf) ) {
 
     if (forceReplication) {
       log <<  MSG::DEBUG << "replicateNext() : "
@@ -503,10 +1039,9 @@ void StageManager::replicateNext(bool forceReplication) {
     log <<  MSG::DEBUG << "replicateNext() : "
     << "Now replicating  <" << cf << ">."  << endmsg;
 
-    m_toBeStagedList.erase(m_toBeStagedList.begin());
+    m_toBeStagedList.erase(cf);
 
-    m_stageMap[cf] = StageFileInfo();
-    m_stageMap[cf].status = StageFileInfo::REPLICATING;
+    setStatus(newEntry(cf), StageFileInfo::REPLICATING);
     string inFile(cf);
     trim(inFile);
 
@@ -521,43 +1056,45 @@ void StageManager::replicateNext(bool forceReplication) {
 
     ba::replace_first(m_stageMap[cf].inFile , "lfn:/lhcb", "lfn:/grid/lhcb");
 
-    char* src_file = new char[1024];
-    strcpy(src_file,m_stageMap[cf].inFile.c_str());
-    char *error_buf = new char[s_stagerInfo.errbufsz];
+    if (useWorkers()) {
+      startWorkers();
+      m_stageMap[cf].transferId = m_workerPool.submit(makeJob(cf, StageWorkerPool::REPLICATE,
+                                                              m_stageMap[cf].inFile,
+                                                              s_stagerInfo.dest_file),
+                                                      forceReplication);
+      log <<  MSG::DEBUG << "replicateNext() : queued transfer "
+      << m_stageMap[cf].transferId << " for <" << cf << ">." << endmsg;
+      return;
+    }
 
     log <<MSG::INFO<<"About to call lcg-rep "<<endmsg;
 
     if( 0 == (m_stageMap[cf].pid=fork()) ) {
       // Code only executed by child process
+      signal(SIGCHLD, SIG_DFL);
       log <<  MSG::DEBUG << "replicateNext:this is child process "
       << getpid() << " "<< m_stageMap[cf].pid << endmsg;
       log <<MSG::INFO<<"LCG_REP Timeout: "<<s_stagerInfo.timeout <<endmsg;
       //lcg-rep
-      int rc = lcg_repxt(src_file,
-                         s_stagerInfo.dest_file,
-                         s_stagerInfo.vo,
-                         0,
-                         s_stagerInfo.gridFTPstreams,
-                         0,
-                         0,
-                         s_stagerInfo.verbose,
-                         s_stagerInfo.timeout,
-                         error_buf,
-                         s_stagerInfo.errbufsz);
+      string error;
+      int rc = m_lcgBackend.replicate(m_stageMap[cf].inFile, s_stagerInfo.dest_file,
+                                      transferOptions(), error);
 
       if(rc==0) {  //lcg_rep exited without errors
 
-        log << MSG::INFO <<"lcg-rep succesful for file: " << src_file <<endmsg;
+        log << MSG::INFO <<"lcg-rep succesful for file: " << m_stageMap[cf].inFile <<endmsg;
         _exit(0);
       } else { //lcg_rep exited with error!
         log << MSG::FATAL << "Error with lcg_rep utility!" << endmsg;
-        log <<MSG::ERROR << " Error message: " << error_buf <<endmsg;
-        m_stageMap[cf].status = StageFileInfo::ERRORREPLICATION;
+        log <<MSG::ERROR << " Error message: " << error <<endmsg;
+        // the parent looks the replica up once the child has ended
         _exit(1);
       }
     } else { // code executed by parent
       log <<  MSG::DEBUG << "replicateNext:this is parent process"
       << ", pid of child = " << m_stageMap[cf].pid << endmsg;
+      if (m_stageMap[cf].pid>0)
+        m_children[m_stageMap[cf].pid] = cf;
     }
   }
 }
@@ -577,49 +1114,120 @@ StageManager::stageNext(bool forceStage) {
     submitGarbageCollector();
     m_submittedGarbageCollector=true;
   }
+  installChildHandler();
 
   if (( (getNstaging()<s_stagerInfo.pipeLength) || forceStage) &&
       (!m_toBeStagedList.empty()) ) {
-    string cf = *(m_toBeStagedList.begin());
-
+    string cf;
     if (forceStage) {
+      cf = m_toBeStagedList.front();
       log <<  MSG::DEBUG << "stageNext() : forcing stage of <" << cf << ">." << endmsg;
+    } else if (!nextToStage(cf)) {
+      return;
     }
 
     log <<  MSG::DEBUG << "stageNext() : Now staging  <" << cf << ">."  << endmsg;
 
 
-    m_stageMap[cf] = StageFileInfo();
+    newEntry(cf);
+
+    unsigned long size(0);
+    bool sizeKnown = getRemoteSize(cf, size);
+    if (sizeKnown && fetchFromCache(cf, size))
+      return;
+
+    if (!forceStage && sizeKnown && !admitToWindow(size)) {
+      log <<  MSG::DEBUG << "stageNext() : prefetch window full, <"
+      << cf << "> waits for a release." << endmsg;
+      m_deferrals[cf] = StallReport::DISK_SPACE;
+      dropEntry(cf);
+      return;
+    }
 
-    if(!checkLocalSpace()) { // local space not sufficient
+    if(!checkLocalSpace(cf)) { // local space not sufficient
+      if (!forceStage && sizeKnown && spaceWillBeReleased()) {
+        // backpressure: the files ahead free their space when released,
+        // which is cheaper than staging to the shared dir or replicating
+        log <<  MSG::INFO << "stageNext() : not enough free space for <"
+        << cf << "> yet, waiting for a release." << endmsg;
+        m_deferrals[cf] = StallReport::DISK_SPACE;
+        dropEntry(cf);
+        return;
+      }
       log <<  MSG::INFO << "Can't use local disk space. "
       << "/*Switching to shared storage...*/" << endmsg;
       m_stageMap[cf].fallbackStrategy = StageFileInfo::SHARED_DIR;
-      if (!checkLocalSpace()) { //shared NFS storage not sufficient
+      if (!checkLocalSpace(cf)) { //shared NFS storage not sufficient
         log << MSG::INFO << "Can't use shared disk space. "
         <<"/*Switching to replication...*/" <<endmsg;
         m_stageMap[cf].fallbackStrategy = StageFileInfo::REPLICATION;
-        replicateNext();
+        replicateNext(cf);
         return;
       }
     }
 
-    m_stageMap[cf].status = StageFileInfo::STAGING;
-    m_toBeStagedList.erase(m_toBeStagedList.begin());
-
     string inFile(cf);
     trim(inFile);
     removePrefixOf(inFile);
     m_stageMap[cf].inFile = inFile;
     m_stageMap[cf].outFile = getTmpFilename(cf.c_str());
+    m_stageMap[cf].source = copySource(cf);
+
+    if (!claimTransfer(cf, forceStage)) {
+      // the files behind go ahead while another job transfers this one
+      if (!forceStage)
+        stageNext();
+      return;
+    }
+
+    reserveSpace(cf);
+    setStatus(m_stageMap[cf], StageFileInfo::STAGING);
+    m_toBeStagedList.erase(cf);
+    m_stageMap[cf].stageStart = currentTime();
+    m_timeline.mark(cf, StageTimeline::TRANSFER_STARTED, m_stageMap[cf].stageStart);
 
     log <<  MSG::DEBUG << "stageNext() : outFile = <"
     << m_stageMap[cf].outFile << ">." << endmsg;
-    log <<  MSG::DEBUG << "stageNext():about to fork"  << endmsg;
 
+    if (useRanges(m_stageMap[cf])) {
+      StageWorkerPool::Job job = makeJob(cf, StageWorkerPool::RANGES, gfalName(cf), m_stageMap[cf].outFile);
+      job.nbstreams = s_stagerInfo.rangeStreams;
+      job.size = m_stageMap[cf].originalFileSize;
+      job.rangeSize = s_stagerInfo.rangeSize;
+      job.allReplicas = s_stagerInfo.rangeReplicas;
+      if (job.allReplicas) {
+        job.replicas = replicasOf(cf);
+        m_replicaRanker.rank(job.replicas, job.size);
+      }
+      startWorkers();
+      m_stageMap[cf].transferId = m_workerPool.submit(job, forceStage);
+      // the file is extended to its full size before its ranges arrive
+      m_rangeTransfers[m_stageMap[cf].transferId] = cf;
+      SpaceLedger& space = (m_stageMap[cf].fallbackStrategy == StageFileInfo::SHARED_DIR) ? m_sharedSpace : m_localSpace;
+      space.setWritten(m_stageMap[cf].outFile, 0);
+      log <<  MSG::DEBUG << "stageNext() : queued range download "
+      << m_stageMap[cf].transferId << " for <" << cf << ">." << endmsg;
+      return;
+    }
+
+    if (useWorkers()) {
+      startWorkers();
+      m_stageMap[cf].transferId = m_workerPool.submit(makeJob(cf, StageWorkerPool::COPY, m_stageMap[cf].source,
+                                                              s_stagerInfo.outfilePrefix + m_stageMap[cf].outFile),
+                                                      forceStage);
+      log <<  MSG::DEBUG << "stageNext() : queued transfer "
+      << m_stageMap[cf].transferId << " for <" << cf << ">." << endmsg;
+      return;
+    }
+
+    log <<  MSG::DEBUG << "stageNext():about to fork"  << endmsg;
+    // looked up before the fork: the child must not take the locks of the probe threads
+    unsigned long expected;
+    bool verify = expectedChecksum(cf, expected);
 
     if( 0 == (m_stageMap[cf].pid=fork()) ) {
       // Code only executed by child process
+      signal(SIGCHLD, SIG_DFL);
       log <<  MSG::DEBUG << "stageNext:this is child process "
       << getpid() << " "<< m_stageMap[cf].pid << endmsg;
 
@@ -628,69 +1236,34 @@ StageManager::stageNext(bool forceStage) {
       log <<  MSG::DEBUG << "stageNext:child process : tmpFile = <"
       << getTmpFilename(cf.c_str()) << ">."  << endmsg;
 
-      int nargs = 4 + int(s_stagerInfo.cparg.size());
-      const int argsc = 14;
-      pchar args[argsc];
-
-      for (int i=0; i<nargs-1; ++i) {
-        args[i] = new char[1024];
-      }
-
-      strcpy(args[0],s_stagerInfo.cpcommand.c_str());
-      for (int i=1; i<=int(s_stagerInfo.cparg.size()); ++i)
-        strcpy(args[i],(s_stagerInfo.cparg[i-1]).c_str());
-
-
-      iterator_range< string::iterator > inFileCorrected;
-
-      //lcg-cp does not like LFN: just lfn:....
-      if ( inFileCorrected = ba::find_first( m_stageMap[cf].inFile , "LFN:" ) )
-        ba::to_lower( inFileCorrected );
-
-      ba::replace_first(m_stageMap[cf].inFile , "lfn:/lhcb", "lfn:/grid/lhcb");
-
-      strcpy(args[nargs-3],m_stageMap[cf].inFile.c_str());
-
+      ITransferBackend& backend = backendFor(cf);
+      const string& srcFile = m_stageMap[cf].source;
       string outTmpfile = s_stagerInfo.outfilePrefix + m_stageMap[cf].outFile;
-      strcpy(args[nargs-2],outTmpfile.c_str());
-      strcpy(args[nargs-2],outTmpfile.c_str());
 
       log <<  MSG::DEBUG << "stageNext:child processs <"
-      << outTmpfile.c_str() << "> <" << outTmpfile << ">"  << endmsg;
-      //       args[nargs-1] = (char *) 0;
-
-      log <<  MSG::DEBUG << "stageNext:child processs is calling lcg-cp " << endmsg;
-      //       << s_stagerInfo.cpcommand.c_str()
-      //       << " with args: \n" ;
-
-      //       for (int i=0; i<nargs-1; ++i) {
-      //         if (args[i])
-      //           log <<  MSG::DEBUG << args[i] << endmsg;
-      //       }
-      char* src_file = args[nargs-3];
-      char* dest_file = args[nargs-2];
-      char *error_buf = new char[s_stagerInfo.errbufsz];
-
-      log <<MSG::DEBUG<<"About to call lcg-cp "<<endmsg;
-      // lcg-cp
-      int rc = lcg_cpxt(src_file,
-                        dest_file,
-                        s_stagerInfo.vo,
-                        s_stagerInfo.gridFTPstreams,
-                        0, 0,
-                        s_stagerInfo.verbose,
-                        s_stagerInfo.timeout,
-                        error_buf,
-                        s_stagerInfo.errbufsz);
+      << outTmpfile << ">"  << endmsg;
+
+      log <<MSG::DEBUG<<"About to copy with the " << backend.name() << " backend" <<endmsg;
+      string error;
+      int rc = backend.copy(srcFile, outTmpfile, transferOptions(), error);
+
+      unsigned long checksum(0);
+      if (rc==0 && verify) {
+        if (!Adler32::ofFile(m_stageMap[cf].outFile, checksum) || checksum!=expected) {
+          log << MSG::ERROR << "Checksum mismatch for " << srcFile << ": expected adler32 "
+          << Adler32::format(expected) << ", got " << Adler32::format(checksum) << endmsg;
+          _exit(1);
+        }
+      }
 
       if(rc==0) {
-        log << MSG::INFO << "File "<<args[nargs-3] <<" correctly copied to "
-        << "local filesystem: " <<args[nargs-2]<< endmsg;
+        log << MSG::INFO << "File "<< srcFile <<" correctly copied to "
+        << "local filesystem: " << outTmpfile << endmsg;
 
         _exit(0);
       } else {
-        log << MSG::FATAL << "Error with lcg_cp utility!" << endmsg;
-        log <<MSG::ERROR << " Error message: " << error_buf <<endmsg;
+        log << MSG::FATAL << "Error with the " << backend.name() << " transfer backend!" << endmsg;
+        log <<MSG::ERROR << " Error message: " << error <<endmsg;
 
         _exit(1);
       }
@@ -700,115 +1273,245 @@ StageManager::stageNext(bool forceStage) {
 
       log <<  MSG::DEBUG << "stageNext:this is parent process"
       << ", pid of child = " << m_stageMap[cf].pid << endmsg;
+      if (m_stageMap[cf].pid>0)
+        m_children[m_stageMap[cf].pid] = cf;
     }
   }
 }
 
 
 //====================================================
-void
-StageManager::updateStatus() {
-
+bool
+StageManager::nextToStage(std::string& cf) {
   MsgStream log(m_msg, "StageManager");
   log.setLevel(m_outputLevel);
-  log <<  MSG::DEBUG << "updateStatus()"<< endmsg;
 
-  map<string,StageFileInfo>::iterator itr = m_stageMap.begin();
-  for (; itr!=m_stageMap.end(); ++itr) {
-    if ((itr->second).status == StageFileInfo::STAGING) {
-
-      pid_t pID = (itr->second).pid;
-
-      int childExitStatus;
-      waitpid( pID, &childExitStatus, WNOHANG);
-
-      if( WIFEXITED(childExitStatus) ) {
-        // done staging
-        log <<  MSG::DEBUG << "updateStatus::waitpid() "
-        <<pID
-        <<" still staging. Returned with: Status= "
-        << WEXITSTATUS(childExitStatus)
-        << " and Exit= "
-        << WIFEXITED(childExitStatus)<< endmsg;
-      } else if( WIFSIGNALED(childExitStatus) ) {
-        log <<  MSG::DEBUG << "updateStatus::waitpid() "
-        <<pID
-        <<" still staging. Returned with: Signal= "
-        << WTERMSIG(childExitStatus)
-        << " and Exit= "
-        << WIFSIGNALED(childExitStatus)<< endmsg;
+  double now = currentTime();
+  bool probing(false);
+  vector<string> missing;
+  unsigned int looked(0);
+  StageQueue::const_iterator itr = m_toBeStagedList.begin();
+  for (; itr!=m_toBeStagedList.end() && looked<s_lookahead; ++itr, ++looked) {
+    map<string,RetryInfo>::const_iterator iRetry = m_retries.find(*itr);
+    if (iRetry!=m_retries.end() && (iRetry->second).notBefore > now) {
+      log <<  MSG::DEBUG << "stageNext() : <" << *itr << "> waits before its next attempt." << endmsg;
+      m_deferrals[*itr] = StallReport::RETRY;
+      continue;
+    }
 
-      }
-    } // files in m_stageMap with status==STAGING
-  }
-}
+    map<string,double>::const_iterator iClaimed = m_claimedElsewhere.find(*itr);
+    if (iClaimed!=m_claimedElsewhere.end() && iClaimed->second > now) {
+      log <<  MSG::DEBUG << "stageNext() : <" << *itr << "> is being staged by another job." << endmsg;
+      continue;
+    }
+
+    if (m_sizeProber.running()) {
+      SizeProber::Probe probe;
+      if (m_sizeProber.lookup(*itr, probe)!=SizeProber::DONE ||
+          (probe.error!=0 && probe.error!=ENOENT)) {
+        // staged once the lookup reports back through the notification pipe;
+        // a failed lookup is repeated once it expires
+        probeSize(*itr, !probing);
+        probing = true;
+        log <<  MSG::DEBUG << "stageNext() : size of <" << *itr << "> not known yet." << endmsg;
+        m_deferrals[*itr] = StallReport::SIZE_PROBE;
+        continue;
+      }
+      if (probe.error==ENOENT) {
+        missing.push_back(*itr);
+        continue;
+      }
+    }
+
+    cf = *itr;
+    break;
+  }
+
+  for (unsigned int i=0; i<missing.size(); ++i)
+    dropMissing(missing[i]);
+  return !cf.empty();
+}
 
 
 //====================================================
 void
-StageManager::submitGarbageCollector() {
+StageManager::updateStatus() {
 
   MsgStream log(m_msg, "StageManager");
   log.setLevel(m_outputLevel);
-  log <<  MSG::DEBUG << "submitGarbageCollector()" << endmsg;
-  if (s_stagerInfo.gc_command.empty())
+  log <<  MSG::DEBUG << "updateStatus()"<< endmsg;
+
+  if (s_notifyPipe[0]>=0) {
+    char buf[256];
+    bool notified(false);
+    while (read(s_notifyPipe[0], buf, sizeof(buf))>0)
+      notified = true;
+    if (!notified)
+      return;
+  }
+
+  // SIGCHLD signals may be merged, so every in-flight child is checked
+  map<pid_t,string>::iterator itr = m_children.begin();
+  while (itr!=m_children.end()) {
+    int childExitStatus(0);
+    pid_t pID = itr->first;
+    pid_t ret = waitpid( pID, &childExitStatus, WNOHANG);
+    if (ret==0) {
+      ++itr;
+      continue;
+    }
+
+    string filename(itr->second);
+    m_children.erase(itr++);
+
+    // ret==-1: already reaped elsewhere, the local copy decides
+    bool childOk = (ret==-1) ||
+                   (WIFEXITED(childExitStatus) && WEXITSTATUS(childExitStatus)==0);
+    log <<  MSG::DEBUG << "updateStatus::waitpid() "
+    << pID << " done with <" << filename << ">. Status= "
+    << childExitStatus << endmsg;
+    finishChild(filename, childOk);
+  }
+
+  collectWorkers();
+  collectProbes();
+}
+
+
+//====================================================
+void
+StageManager::finishChild(const std::string& filename, bool childOk) {
+  map<string,StageFileInfo>::iterator itr = m_stageMap.find(filename);
+  if (itr==m_stageMap.end())
     return;
 
-  // pass parent pid to stagemonitor for monitoring
-  int ppid = getpid();
+  // children killed by releaseFile() are already RELEASED
+  if ((itr->second).status==StageFileInfo::STAGING)
+    finishStaging(filename, childOk);
+  else if ((itr->second).status==StageFileInfo::REPLICATING)
+    finishReplication(filename);
+}
 
-  int cpid(0);
-  if( (cpid=fork() == 0) ) {
-    // Code only executed by child process
-    log <<  MSG::DEBUG << "GarbageCollector:this is child process "
-    << getpid() << endmsg;
 
-    //The setsid() function creates a new session;
+//====================================================
+void
+StageManager::processCompletions() {
+  updateStatus();
+  refill();
+  updateMetrics();
+}
 
-    pid_t pgid = setsid(); // or setpgid(getpid(), getpid()); ?
-    if( pgid < 0) {
-      log <<  MSG::FATAL << "Failed to create a new session"<< endmsg;
-      _exit(0);
-    }
 
-    const int nargs = 6;
-    pchar args[nargs];
-    for (int i=0; i<nargs-1; ++i) {
-      args[i] = new char[1024];
-    }
+//====================================================
+void
+StageManager::refill() {
+  while (getNstaging()<s_stagerInfo.pipeLength && !m_toBeStagedList.empty()) {
+    size_t nqueued = m_toBeStagedList.size();
+    stageNext();
+    if (m_toBeStagedList.size()==nqueued)
+      break; // nothing could be started
+  }
+}
 
-    strcpy(args[0],s_stagerInfo.gc_command.c_str());
-    sprintf(args[1],"%d",ppid);
-    strcpy(args[2],s_stagerInfo.tmpdir.c_str());
-    strcpy(args[3],s_stagerInfo.baseTmpdir.c_str());
-    if (m_keepLogfiles)
-      strcpy(args[4],"1");
-    else
-      strcpy(args[4],"0");
-    args[5]=(char *) 0;
 
+//====================================================
+void
+StageManager::installChildHandler() {
+  if (s_notifyPipe[0]>=0)
+    return;
+
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+
+  if (pipe(s_notifyPipe)!=0) {
+    log <<  MSG::ERROR << "installChildHandler() : could not create notification pipe: "
+    << strerror(errno) << endmsg;
+    s_notifyPipe[0] = s_notifyPipe[1] = -1;
+    return;
+  }
+  for (int i=0; i<2; ++i) {
+    fcntl(s_notifyPipe[i], F_SETFL, fcntl(s_notifyPipe[i], F_GETFL) | O_NONBLOCK);
+    fcntl(s_notifyPipe[i], F_SETFD, FD_CLOEXEC);
+  }
 
-    log <<  MSG::DEBUG << "GarbageCollector::child processs is executing execv "
-    << s_stagerInfo.gc_command
-    << " with args "<< endmsg;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = &StageManager::childHandler;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_SIGINFO | SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &action, &s_oldChildAction);
 
-    for (int i=0; i<nargs-1; ++i) {
-      if (args[i]) {
-        log << MSG::DEBUG<< args[i] << " "<< endmsg;
-      }
-    }
+  m_workerPool.setNotifyFd(s_notifyPipe[1]);
+  log <<  MSG::DEBUG << "installChildHandler() : SIGCHLD handler installed" << endmsg;
+}
+
+
+//====================================================
+void
+StageManager::childHandler(int sig, siginfo_t* info, void* context) {
+  int savedErrno = errno;
+  char token(0);
+  // a full pipe already holds a pending notification
+  if (write(s_notifyPipe[1], &token, 1) < 0) {}
+  errno = savedErrno;
+
+  if (s_oldChildAction.sa_flags & SA_SIGINFO) {
+    if (s_oldChildAction.sa_sigaction)
+      s_oldChildAction.sa_sigaction(sig, info, context);
+  } else if (s_oldChildAction.sa_handler!=SIG_DFL &&
+             s_oldChildAction.sa_handler!=SIG_IGN) {
+    s_oldChildAction.sa_handler(sig);
+  }
+}
+
+
+//====================================================
+void
+StageManager::submitGarbageCollector() {
 
-    int ret = execvp(s_stagerInfo.gc_command.c_str(), args);
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  log <<  MSG::DEBUG << "submitGarbageCollector()" << endmsg;
+  if (s_stagerInfo.gc_command.empty())
+    return;
+
+  // pass parent pid to stagemonitor for monitoring
+  int ppid = getpid();
+
+  // the arguments are prepared before the fork: the probe threads may already run,
+  // so the child only calls async-signal-safe functions until execvp
+  const int nargs = 6;
+  string args[nargs-1];
+  args[0] = s_stagerInfo.gc_command;
+  args[1] = boost::str(boost::format("%d") % ppid);
+  args[2] = s_stagerInfo.tmpdir;
+  args[3] = s_stagerInfo.baseTmpdir;
+  args[4] = m_keepLogfiles ? "1" : "0";
+  pchar argv[nargs];
+  for (int i=0; i<nargs-1; ++i)
+    argv[i] = const_cast<char*>(args[i].c_str());
+  argv[nargs-1] = (char *) 0;
+
+  log <<  MSG::DEBUG << "GarbageCollector::child process will execute execvp "
+  << s_stagerInfo.gc_command << " with args " << args[1] << " " << args[2] << " "
+  << args[3] << " " << args[4] << endmsg;
+
+  pid_t cpid = fork();
+  if (cpid == 0) {
+    // Code only executed by child process
+    //The setsid() function creates a new session;
+    if (setsid() < 0)
+      _exit(0);
+    execvp(argv[0], argv);
     // execvp should never return -- if it does, we couldn't find the command!!
-    log << MSG::ERROR << " execvp failed " << strerror(errno) << endmsg;
-    ::abort();
+    _exit(127);
+  } else if (cpid < 0) {
+    log << MSG::ERROR << "GarbageCollector: fork failed " << strerror(errno) << endmsg;
   } else {
     // Code only executed by parent process
     log <<  MSG::DEBUG << "GarbageCollector::this is parent process"
     << ", pid of child = " << cpid  << endmsg;
-
   }
-
 }
 
 //====================================================
@@ -876,6 +1579,48 @@ void StageManager::setCpCommand(const std::string& cpcommand) {
 //====================================================
 void StageManager::addCpArg(const std::string& cpargm) {
   s_stagerInfo.cparg.push_back(cpargm);
+  m_lcgBackend.configure(s_stagerInfo.cparg);
+  m_posixBackend.configure(s_stagerInfo.cparg);
+}
+
+
+//====================================================
+bool StageManager::stopTransfer(const std::string& filename, bool& running) {
+  const StageFileInfo& info = m_stageMap[filename];
+  running = !m_workerPool.cancel(info.transferId);
+  if (!running)
+    return true;
+  // range downloads poll their cancellation in the pool
+  if (m_rangeTransfers.find(info.transferId)!=m_rangeTransfers.end())
+    return true;
+  return backendFor(filename).cancel(s_stagerInfo.outfilePrefix + info.outFile);
+}
+
+
+//====================================================
+ITransferBackend& StageManager::backendFor(const std::string& filename) {
+  if (m_backend)
+    return *m_backend;
+  const string& backend = s_stagerInfo.cpcommand;
+  if (backend=="posix" || backend=="cp")
+    return m_posixBackend;
+  if (backend=="lcg" || backend=="lcg-cp")
+    return m_lcgBackend;
+  // auto: by the form of the file name
+  if (m_posixBackend.accepts(middlewareName(filename)))
+    return m_posixBackend;
+  return m_lcgBackend;
+}
+
+
+//====================================================
+TransferOptions StageManager::transferOptions() const {
+  TransferOptions options;
+  options.vo = s_stagerInfo.vo;
+  options.nbstreams = s_stagerInfo.gridFTPstreams;
+  options.verbose = s_stagerInfo.verbose;
+  options.timeout = s_stagerInfo.timeout;
+  return options;
 }
 
 
@@ -890,6 +1635,531 @@ void StageManager::setPipeLength(const int& pipeLength) {
 }
 
 
+//====================================================
+void StageManager::setAdaptivePipe(const int& minPipeLength, const int& maxPipeLength) {
+  s_stagerInfo.adaptivePipe = true;
+  s_stagerInfo.minPipeLength = std::max(1, minPipeLength);
+  s_stagerInfo.maxPipeLength = std::max(s_stagerInfo.minPipeLength, maxPipeLength);
+  s_stagerInfo.pipeLength = std::min(std::max(s_stagerInfo.pipeLength, s_stagerInfo.minPipeLength),
+                                     s_stagerInfo.maxPipeLength);
+}
+
+
+//====================================================
+void StageManager::addProcessingTime(double seconds) {
+  if (seconds<=0)
+    return;
+  m_processingTime = (m_processingTime>0) ? (1-s_ewmaWeight)*m_processingTime + s_ewmaWeight*seconds : seconds;
+  adaptPipeLength();
+  refill();
+}
+
+
+//====================================================
+void StageManager::stagedTotals(long& files, unsigned long long& bytes, double& seconds) const {
+  files = m_stagedFiles;
+  bytes = m_stagedBytes;
+  seconds = m_stagedSeconds;
+}
+
+
+//====================================================
+double StageManager::stagingWallTime() const {
+  vector< pair<double,double> > intervals(m_stagedIntervals);
+  sort(intervals.begin(), intervals.end());
+  double total(0);
+  double start(0), end(0);
+  for (unsigned int i=0; i<intervals.size(); ++i) {
+    if (i==0 || intervals[i].first > end) {
+      total += end - start;
+      start = intervals[i].first;
+      end = intervals[i].second;
+    } else {
+      end = max(end, intervals[i].second);
+    }
+  }
+  return total + end - start;
+}
+
+
+//====================================================
+void StageManager::adaptPipeLength() {
+  if (!s_stagerInfo.adaptivePipe || m_transferTime<=0 || m_processingTime<=0)
+    return;
+
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+
+  // files needed in flight so that each one is staged by the time the job reaches it
+  int target = int(ceil(m_transferTime/m_processingTime));
+  target = std::min(std::max(target, s_stagerInfo.minPipeLength), s_stagerInfo.maxPipeLength);
+
+  // one step at a time, the estimates are noisy
+  int pipeLength = s_stagerInfo.pipeLength;
+  if (target>pipeLength)
+    ++pipeLength;
+  else if (target<pipeLength)
+    --pipeLength;
+
+  if (pipeLength!=s_stagerInfo.pipeLength) {
+    log << MSG::INFO << "adaptPipeLength() : transfer " << m_transferTime
+    << " s/file, processing " << m_processingTime << " s/file. Pipe length "
+    << s_stagerInfo.pipeLength << " -> " << pipeLength << endmsg;
+    s_stagerInfo.pipeLength = pipeLength;
+  }
+}
+
+
+//====================================================
+double StageManager::currentTime() {
+  struct timeval tp;
+  gettimeofday( &tp, NULL );
+  return static_cast<double>( tp.tv_sec ) + static_cast<double>( tp.tv_usec )/1E6;
+}
+
+
+//====================================================
+void StageManager::setPreallocate(bool preallocate) {
+  s_stagerInfo.preallocate = preallocate;
+}
+
+
+//====================================================
+void StageManager::setProgressiveRead(const std::vector<std::string>& extensions, double stallTimeout) {
+  s_stagerInfo.progressiveExtensions = extensions;
+  s_stagerInfo.progressiveStall = stallTimeout;
+}
+
+
+//====================================================
+void StageManager::setReplicaRanking(bool rankReplicas, const std::string& modelFile) {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  s_stagerInfo.rankReplicas = rankReplicas;
+  s_stagerInfo.replicaModel = modelFile;
+  if (!modelFile.empty() && !m_replicaRanker.load(modelFile))
+    log << MSG::WARNING << "Could not read the replica model <" << modelFile << ">" << endmsg;
+}
+
+
+//====================================================
+void StageManager::saveReplicaModel() {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  if (!s_stagerInfo.replicaModel.empty() && !m_replicaRanker.save(s_stagerInfo.replicaModel))
+    log << MSG::WARNING << "Could not write the replica model <" << s_stagerInfo.replicaModel << ">" << endmsg;
+}
+
+
+//====================================================
+void StageManager::setTimeline(const std::string& traceFile, const std::string& csvFile) {
+  s_stagerInfo.timelineTrace = traceFile;
+  s_stagerInfo.timelineCsv = csvFile;
+  m_timeline.enable(!traceFile.empty() || !csvFile.empty());
+}
+
+
+//====================================================
+void StageManager::writeTimeline() {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  // written before releaseAll(): the files still held end with the job
+  m_timeline.finish(currentTime());
+  if (!s_stagerInfo.timelineTrace.empty()) {
+    if (m_timeline.writeTrace(s_stagerInfo.timelineTrace))
+      log << MSG::INFO << "Staging timeline written to <" << s_stagerInfo.timelineTrace << ">" << endmsg;
+    else
+      log << MSG::WARNING << "Could not write the staging timeline <" << s_stagerInfo.timelineTrace << ">" << endmsg;
+  }
+  if (!s_stagerInfo.timelineCsv.empty()) {
+    if (m_timeline.writeCsv(s_stagerInfo.timelineCsv))
+      log << MSG::INFO << "Staging timeline written to <" << s_stagerInfo.timelineCsv << ">" << endmsg;
+    else
+      log << MSG::WARNING << "Could not write the staging timeline <" << s_stagerInfo.timelineCsv << ">" << endmsg;
+  }
+}
+
+
+//====================================================
+void StageManager::setStatusBoard(const std::string& path) {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  if (!m_statusBoard.open(path)) {
+    log << MSG::WARNING << "Could not create the status board <" << path << ">" << endmsg;
+    return;
+  }
+  log << MSG::INFO << "Staging status published in <" << path << ">" << endmsg;
+  m_liveMetrics = true;
+}
+
+
+//====================================================
+void StageManager::updateMetrics(bool force) {
+  if (!m_liveMetrics)
+    return;
+
+  double now = currentTime();
+  double elapsed = now - m_metricsTime;
+  if (!force && elapsed < s_metricsInterval)
+    return;
+
+  // a local stat per running transfer, bounded by the pipe length
+  updateRangeProgress();
+  unsigned long long reserved = m_localSpace.reserved() + m_sharedSpace.reserved();
+  unsigned long long outstanding = m_localSpace.outstanding() + m_sharedSpace.outstanding();
+  m_metrics.queued = m_toBeStagedList.size();
+  m_metrics.staging = m_statusCount[StageFileInfo::STAGING];
+  m_metrics.staged = m_stagedFiles;
+  m_metrics.failed = m_statusCount[StageFileInfo::ERRORSTAGING];
+  m_metrics.bytesInFlight = reserved;
+  m_metrics.scratchBytes = (m_windowBytes > outstanding) ? m_windowBytes - outstanding : 0;
+
+  // bytes written by the finished and the running transfers; forced refreshes keep the last rate
+  double progress = double(m_stagedBytes) + double(reserved) - double(outstanding);
+  if (elapsed >= s_metricsInterval) {
+    m_metrics.throughput = (m_metricsTime>0) ? std::max(0., (progress - m_metricsProgress)/elapsed) : 0;
+    m_metricsTime = now;
+    m_metricsProgress = progress;
+  }
+
+  m_statusBoard.publish(m_metrics);
+}
+
+
+//====================================================
+void StageManager::beginInputFile(const std::string& fname) {
+  string filename(fname);
+  trim(filename);
+  fixRootInPrefix(filename);
+  m_timeline.mark(filename, StageTimeline::OPENED, currentTime());
+}
+
+
+//====================================================
+void StageManager::endInputFile(const std::string& fname) {
+  string filename(fname);
+  trim(filename);
+  fixRootInPrefix(filename);
+  m_timeline.mark(filename, StageTimeline::CLOSED, currentTime());
+}
+
+
+//====================================================
+void StageManager::recordStall(const std::string& filename, bool wasStaging, double waited) {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+
+  // a file not in transfer yet waited for whatever held it back in the queue
+  StallReport::Cause cause = StallReport::PIPELINE_FULL;
+  map<string,StallReport::Cause>::const_iterator iDeferral = m_deferrals.find(filename);
+  if (iDeferral!=m_deferrals.end())
+    cause = iDeferral->second;
+
+  map<string,StageFileInfo>::const_iterator iEntry = m_stageMap.find(filename);
+  if (iEntry!=m_stageMap.end()) {
+    const StageFileInfo& info = iEntry->second;
+    map<string,RetryInfo>::const_iterator iRetry = m_retries.find(filename);
+    double duration = info.stageEnd - info.stageStart;
+
+    if (info.fallbackStrategy!=StageFileInfo::NONE ||
+        info.status==StageFileInfo::REPLICATED || info.status==StageFileInfo::ERRORREPLICATION)
+      cause = StallReport::FALLBACK;
+    else if (iRetry!=m_retries.end() && (iRetry->second).attempts>0)
+      cause = StallReport::RETRY;
+    else if (wasStaging && info.verifyTime>0 && 2*info.verifyTime>=waited)
+      cause = StallReport::VERIFICATION;
+    else if (wasStaging && duration>0 && info.originalFileSize>0 && m_stagedSeconds>0 &&
+             info.originalFileSize/duration < s_slowFraction*m_stagedBytes/m_stagedSeconds)
+      cause = StallReport::SLOW_SOURCE;
+  }
+
+  m_stallReport.add(cause, waited);
+  log << MSG::INFO << "getFile() : waited " << waited << " s for <" << filename
+  << ">, cause: " << StallReport::name(cause) << endmsg;
+}
+
+
+//====================================================
+void StageManager::reportStalls() {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+
+  long stalls = m_stallReport.totalCount();
+  if (stalls==0) {
+    log << MSG::INFO << "Stall report: the event loop never waited for an input file." << endmsg;
+    return;
+  }
+
+  double total = m_stallReport.totalSeconds();
+  log << MSG::INFO << "Stall report: " << stalls << " waits for input files, "
+  << total << " s in total" << endmsg;
+  for (int i=StallReport::PIPELINE_FULL; i<=StallReport::FALLBACK; ++i) {
+    StallReport::Cause cause = StallReport::Cause(i);
+    if (m_stallReport.count(cause)==0)
+      continue;
+    log << MSG::INFO << "  " << StallReport::name(cause) << ": " << m_stallReport.count(cause)
+    << " waits, " << m_stallReport.seconds(cause) << " s ("
+    << int(100*m_stallReport.seconds(cause)/total + 0.5) << "%)" << endmsg;
+  }
+
+  StallReport::Cause worst = m_stallReport.dominant();
+  log << MSG::INFO << "Stall report: most waiting due to " << StallReport::name(worst)
+  << "; suggestion: " << StallReport::advice(worst) << endmsg;
+}
+
+
+//====================================================
+bool StageManager::getProgress(const std::string& fname, IFileStagerProgress::Progress& progress) {
+  std::string tmpname(fname);
+  trim(tmpname);
+  fixRootInPrefix(tmpname);
+  const std::string filename(tmpname);
+
+  updateStatus();
+  progress = IFileStagerProgress::Progress();
+  map<string,RetryInfo>::const_iterator iRetry = m_retries.find(filename);
+  if (iRetry!=m_retries.end())
+    progress.retries = (iRetry->second).attempts;
+  double average = (m_stagedSeconds>0) ? m_stagedBytes/m_stagedSeconds : 0;
+
+  if (m_toBeStagedList.contains(filename)) {
+    progress.state = IFileStagerProgress::QUEUED;
+    progress.source = copySource(filename);
+    SizeProber::Probe probe;
+    if (m_sizeProber.lookup(filename, probe)==SizeProber::DONE && probe.error==0)
+      progress.bytesTotal = probe.size;
+    if (progress.bytesTotal>0 && average>0)
+      progress.eta = progress.bytesTotal/average;
+    return true;
+  }
+
+  map<string,StageFileInfo>::iterator itr = m_stageMap.find(filename);
+  if (itr==m_stageMap.end())
+    return false;
+
+  StageFileInfo& info = itr->second;
+  progress.source = info.source;
+  progress.bytesTotal = info.originalFileSize;
+  switch (info.status) {
+  case StageFileInfo::STAGED:
+  case StageFileInfo::REPLICATED:
+    progress.state = IFileStagerProgress::STAGED;
+    progress.bytesDone = info.originalFileSize;
+    if (info.stageStart>0 && info.stageEnd>info.stageStart)
+      progress.rate = info.originalFileSize/(info.stageEnd-info.stageStart);
+    progress.eta = 0;
+    return true;
+  case StageFileInfo::ERRORSTAGING:
+  case StageFileInfo::ERRORREPLICATION:
+    progress.state = IFileStagerProgress::FAILED;
+    return true;
+  case StageFileInfo::RELEASED:
+    progress.state = IFileStagerProgress::RELEASED;
+    return true;
+  case StageFileInfo::STAGING:
+  case StageFileInfo::REPLICATING:
+    progress.state = IFileStagerProgress::STAGING;
+    break;
+  default:
+    return true;
+  }
+
+  // bytes reported by the range download, or the size of a copy written sequentially
+  double now = currentTime();
+  unsigned long long done(0);
+  SpaceLedger& space = (info.fallbackStrategy == StageFileInfo::SHARED_DIR) ? m_sharedSpace : m_localSpace;
+  bool measured = (info.transferId>0 && m_workerPool.progress(info.transferId, done)) ||
+                  (!useRanges(info) && space.written(info.outFile, done));
+  if (!measured) {
+    done = (average>0 && now>info.stageStart) ? (unsigned long long)(average*(now-info.stageStart)) : 0;
+    info.rate = average;
+  } else if (info.progressTime==0) {
+    info.rate = (now>info.stageStart) ? done/(now-info.stageStart) : 0;
+  } else if (now-info.progressTime >= s_rateInterval && done>=info.progressBytes) {
+    double sample = (done-info.progressBytes)/(now-info.progressTime);
+    info.rate = (info.rate>0) ? (1-s_ewmaWeight)*info.rate + s_ewmaWeight*sample : sample;
+  }
+  if (measured && (info.progressTime==0 || now-info.progressTime >= s_rateInterval)) {
+    info.progressTime = now;
+    info.progressBytes = done;
+  }
+
+  if (progress.bytesTotal>0 && done>progress.bytesTotal)
+    done = progress.bytesTotal;
+  progress.bytesDone = done;
+  progress.rate = info.rate;
+  if (progress.bytesTotal>0 && info.rate>0)
+    progress.eta = (progress.bytesTotal-done)/info.rate;
+  return true;
+}
+
+
+//====================================================
+void StageManager::setNodeCache(const std::string& dir, unsigned long long limit) {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  s_stagerInfo.nodeCacheDir = dir;
+  s_stagerInfo.nodeCacheLimit = limit;
+  if (!m_nodeCache.configure(dir, limit))
+    log << MSG::WARNING << "Node cache <" << dir << "> not usable"
+    << (limit==0 ? " without a size limit" : "") << ", staging without it." << endmsg;
+}
+
+
+//====================================================
+bool StageManager::fetchFromCache(const std::string& cf, unsigned long size) {
+  if (!m_nodeCache.enabled())
+    return false;
+
+  StageFileInfo& info = m_stageMap[cf];
+  bool hadOutFile = !info.outFile.empty();
+  string inFile(cf);
+  trim(inFile);
+  removePrefixOf(inFile);
+  info.inFile = inFile;
+  info.outFile = getTmpFilename(cf);
+  info.originalFileSize = size;
+  if (!m_nodeCache.fetch(middlewareName(cf), size, info.outFile)) {
+    if (!hadOutFile)
+      info.outFile.clear();
+    return false;
+  }
+
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  log << MSG::INFO << "Found <" << cf << "> in the node cache, linked to <"
+  << info.outFile << ">." << endmsg;
+  stat(info.outFile.c_str(), &(info.statFile));
+  setStatus(info, StageFileInfo::STAGED);
+  m_toBeStagedList.erase(cf);
+  ++m_stagedFiles;
+  m_stagedBytes += size;
+  double now = currentTime();
+  m_timeline.setCached(cf);
+  m_timeline.mark(cf, StageTimeline::TRANSFER_STARTED, now);
+  m_timeline.mark(cf, StageTimeline::TRANSFER_FINISHED, now);
+  return true;
+}
+
+
+//====================================================
+bool StageManager::claimTransfer(const std::string& cf, bool forceStage) {
+  StageFileInfo& info = m_stageMap[cf];
+  string name = middlewareName(cf);
+  if (info.originalFileSize==0 || m_nodeCache.claim(name, info.originalFileSize, info.outFile)) {
+    m_claimedElsewhere.erase(cf);
+    return true;
+  }
+
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  log << MSG::INFO << "<" << cf << "> is being staged by another job on this node." << endmsg;
+  m_deferrals[cf] = StallReport::NODE_CACHE;
+  if (!forceStage) {
+    // passed over by nextToStage() for a while, then found in the cache or claimed
+    m_claimedElsewhere[cf] = currentTime() + s_claimRecheck;
+    dropEntry(cf);
+    return false;
+  }
+
+  // waits as long as the owner keeps writing its copy
+  double lastActivity = currentTime();
+  while (true) {
+    usleep(s_claimPoll);
+    if (fetchFromCache(cf, info.originalFileSize))
+      return false;
+    if (m_nodeCache.claim(name, info.originalFileSize, info.outFile)) {
+      m_claimedElsewhere.erase(cf);
+      log << MSG::INFO << "Taking over the staging of <" << cf << ">." << endmsg;
+      return true;
+    }
+    time_t modified;
+    if (m_nodeCache.ownerActivity(name, info.originalFileSize, modified))
+      lastActivity = max(lastActivity, double(modified));
+    if (currentTime() - lastActivity > s_claimStall)
+      break;
+  }
+  m_claimedElsewhere.erase(cf);
+  log << MSG::WARNING << "The other job staging <" << cf << "> wrote nothing for "
+  << s_claimStall << " s, staging it here." << endmsg;
+  return true;
+}
+
+
+//====================================================
+void StageManager::setChecksums(const std::map<std::string,std::string>& checksums, bool catalogue) {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  s_stagerInfo.catalogChecksums = catalogue;
+  s_stagerInfo.checksums.clear();
+  map<string,string>::const_iterator itr = checksums.begin();
+  for (; itr!=checksums.end(); ++itr) {
+    unsigned long checksum;
+    if (Adler32::parse(itr->second, checksum))
+      s_stagerInfo.checksums[middlewareName(itr->first)] = checksum;
+    else
+      log << MSG::WARNING << "Not an Adler-32 checksum, <" << itr->first
+      << "> is not verified: " << itr->second << endmsg;
+  }
+}
+
+
+//====================================================
+bool StageManager::expectedChecksum(const std::string& cf, unsigned long& checksum) {
+  map<string,unsigned long>::const_iterator itr = s_stagerInfo.checksums.find(middlewareName(cf));
+  if (itr!=s_stagerInfo.checksums.end()) {
+    checksum = itr->second;
+    return true;
+  }
+  // the size lookup is done before every transfer
+  SizeProber::Probe probe;
+  if (m_sizeProber.lookup(cf, probe)!=SizeProber::DONE || !probe.hasChecksum)
+    return false;
+  checksum = probe.checksum;
+  return true;
+}
+
+
+//====================================================
+void StageManager::setRetries(const int maxRetries, const double backoff) {
+  s_stagerInfo.maxRetries = maxRetries;
+  s_stagerInfo.retryBackoff = backoff;
+}
+
+
+//====================================================
+void StageManager::setTimeout(const int timeout) {
+  s_stagerInfo.timeout = timeout;
+}
+
+
+//====================================================
+void StageManager::setRangeDownload(unsigned long long rangeSize, int streams, bool allReplicas) {
+  s_stagerInfo.rangeSize = rangeSize;
+  s_stagerInfo.rangeStreams = streams;
+  s_stagerInfo.rangeReplicas = allReplicas;
+}
+
+
+//====================================================
+void StageManager::setProbeThreads(const int probeThreads) {
+  s_stagerInfo.probeThreads = probeThreads;
+}
+
+
+//====================================================
+void StageManager::setPrefetchBudget(unsigned long long prefetchBytes, double freeFraction) {
+  s_stagerInfo.prefetchBytes = prefetchBytes;
+  s_stagerInfo.prefetchFreeFraction = freeFraction;
+}
+
+
+//====================================================
+void StageManager::setTransferThreads(const int transferThreads) {
+  s_stagerInfo.transferThreads = transferThreads;
+}
+
+
 //====================================================
 void StageManager::setInfilePrefix(const std::string& infilePrefix) {
   s_stagerInfo.infilePrefix = infilePrefix;
@@ -930,46 +2200,30 @@ StagerInfo StageManager::getStagerInfo() {
 //====================================================
 bool StageManager::replicaExists(std::string filename) {
   MsgStream log(m_msg, "StageManager");
-  char ***pfns = new char**[1024];
-  int errbufsz = 1024;
-  char *error_buf = new char[errbufsz];
-  char* src_file = new char[1024];
   bool status = false;
-  strcpy(src_file,m_stageMap[filename].inFile.c_str());
-  // locate the replica, by listing all available ones in pfns array
-  int rc1 = lcg_lr3(src_file,
-                    0,
-                    s_stagerInfo.vo,
-                    pfns,
-                    s_stagerInfo.verbose,
-                    error_buf,
-                    errbufsz);
-
-  if(rc1==0) { //lcg_lr exited without errors, pfns should contain all replica strings
+  // locate the replica, by listing all available ones
+  vector<string> pfns;
+  string error;
+  if(m_lcgBackend.listReplicas(m_stageMap[filename].inFile, transferOptions(), pfns, error)) {
     log << MSG::INFO << "replicaExists: lcg-lr success"<< endmsg;
-    int i = 0;
-    while ( pfns[0][i]!=NULL) {
-      m_stageMap[filename].outFile = pfns[0][i];
+    for (unsigned int i=0; i<pfns.size(); ++i) {
+      m_stageMap[filename].outFile = pfns[i];
       if(m_stageMap[filename].outFile.find(s_stagerInfo.dest_file)!=string::npos) { //substring match for "tbn18.nikhef.nl"
         log << MSG::INFO << "Local replica found: "
         <<  m_stageMap[filename].outFile << endmsg; //this is our "local" replica winner
         status = true;
         break;
       }
-      i++;
     }
   } else { //lcg_lr exited with error
     log << MSG::ERROR << " error with lcg-lr: "
-    << error_buf << "errno: " <<strerror(errno) << endmsg;
+    << error << endmsg;
     log << MSG::ERROR << " Try using lcg-lr "
     << filename << " manually to diagnoze the problem "
     <<endmsg;
-    m_stageMap[filename].status = StageFileInfo::ERRORREPLICATION;
+    setStatus(m_stageMap[filename], StageFileInfo::ERRORREPLICATION);
     status = false;
   }
-  delete [] pfns;
-  delete [] error_buf;
-  delete [] src_file;
   return status;
 }
 
@@ -998,14 +2252,8 @@ bool StageManager::replicaExists(std::string filename) {
 // }
 
 //====================================================
-bool StageManager::checkLocalSpace() {
-  struct statvfs info;
-  struct stat64 statbuf;
-  MsgStream log(m_msg, "StageManager");
-  log.setLevel(m_outputLevel);
-  if(m_toBeStagedList.empty())
-    return false;
-  string fileToStage = *(m_toBeStagedList.begin());
+string StageManager::gfalName(const std::string& cf) {
+  string fileToStage = cf;
   // gfal_stat does not accept PFN, strip it off. LFN is converted to lfn.
   iterator_range< string::iterator > result;
 
@@ -1017,66 +2265,117 @@ bool StageManager::checkLocalSpace() {
   ba::replace_first(fileToStage , "lfn:/lhcb", "lfn:/grid/lhcb");
 
   removePrefixOf(fileToStage);
-  log << MSG::INFO << "Checking file size for: " << fileToStage << endmsg;
+  return fileToStage;
+}
+
+//====================================================
+void StageManager::probeSize(const std::string& cf, bool front) {
+  // retries go through the other replicas, without a catalogue lookup of their own
+  if (!m_sizeProber.running() && (s_stagerInfo.rankReplicas || s_stagerInfo.maxRetries>0))
+    m_sizeProber.setReplicaLookup(transferOptions());
+  if (!m_sizeProber.running() && s_stagerInfo.catalogChecksums)
+    m_sizeProber.setChecksumLookup(transferOptions());
+  if (s_stagerInfo.probeThreads>0 && !m_sizeProber.running()) {
+    // the lookups report back through the notification pipe
+    installChildHandler();
+    m_sizeProber.setNotifyFd(s_notifyPipe[1]);
+    m_sizeProber.start(s_stagerInfo.probeThreads);
+  }
+  m_sizeProber.submit(cf, gfalName(cf), &backendFor(cf), front);
+}
+
+//====================================================
+void StageManager::collectProbes() {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+
+  string cf;
+  SizeProber::Probe probe;
+  while (m_sizeProber.poll(cf, probe)) {
+    if (probe.error==ENOENT && m_toBeStagedList.contains(cf))
+      dropMissing(cf);
+  }
+}
+
+//====================================================
+void StageManager::dropMissing(const std::string& cf) {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  log << MSG::ERROR << "<" << cf << "> does not exist, it will not be staged." << endmsg;
+  m_toBeStagedList.erase(cf);
+  setStatus(newEntry(cf), StageFileInfo::ERRORSTAGING);
+}
+
+//====================================================
+bool StageManager::getRemoteSize(const std::string& cf, unsigned long& size) {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+
+  SizeProber::Probe probe;
+  if (m_sizeProber.lookup(cf, probe)!=SizeProber::DONE) {
+    log << MSG::INFO << "Checking file size for: " << cf << endmsg;
+    probeSize(cf, true);
+    m_sizeProber.wait(cf, probe);
+  }
+
+  if (probe.error!=0) {
+    log <<  MSG::ERROR << "Checking file size:File does not exist, or"
+    << " problems with gfal library " << endmsg;
+    log << MSG::ERROR <<" gfal_stat() failed with error: " << strerror(probe.error) << endmsg;
+    return false;
+  }
+
+  size = probe.size;
+  m_timeline.setSize(cf, size);
+  m_timeline.mark(cf, StageTimeline::PROBED, probe.finished);
+  return true;
+}
+
+//====================================================
+bool StageManager::checkLocalSpace(const std::string& cf) {
+  struct statvfs info;
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  if(!m_toBeStagedList.contains(cf))
+    return false;
 
   int ret = -1;
   //check free user space of the tempdir before staging
-  if (m_stageMap[*(m_toBeStagedList.begin())].fallbackStrategy == StageFileInfo::SHARED_DIR)
+  bool shared = m_stageMap[cf].fallbackStrategy == StageFileInfo::SHARED_DIR;
+  if (shared)
     ret = statvfs ( s_stagerInfo.fallbackDir.c_str(), &info);
   else
     ret = statvfs( s_stagerInfo.tmpdir.c_str(), &info);
   if( ret ==0 ) {
     // check size of remote file
-    if (gfal_stat64 (fileToStage.c_str(), &statbuf) < 0) {
-      log <<  MSG::ERROR << "Checking file size:File does not exist, or"
-      << " problems with gfal library " << endmsg;
-      log << MSG::ERROR <<" gfal_stat() failed with error: " << strerror(errno) << endmsg;
+    unsigned long size(0);
+    if (!getRemoteSize(cf, size))
       return false;
+    updateRangeProgress();
+
+    unsigned long long available = (unsigned long long)info.f_bavail*info.f_bsize;
+    unsigned long long reserved = shared ? m_sharedSpace.outstanding() : m_localSpace.outstanding();
+
+    // unused node cache entries share the file system of the tmpdir: they go before any fallback
+    if (!shared && reserved + size >= available && m_nodeCache.enabled()) {
+      unsigned long long freed = m_nodeCache.reclaim(reserved + size - available + 1);
+      if (freed>0 && statvfs(s_stagerInfo.tmpdir.c_str(), &info)==0) {
+        log << MSG::INFO << "Evicted " << freed/(1024*1024) << " MB from the node cache." << endmsg;
+        available = (unsigned long long)info.f_bavail*info.f_bsize;
+      }
     }
 
     log.setLevel(m_outputLevel);
     log <<  MSG::INFO << "Available disk space: "
-    << (info.f_bavail*info.f_bsize)/(1024*1024)
+    << available/(1024*1024)
     << " MB" << endmsg;
+    log <<  MSG::INFO << "Reserved by running transfers: "
+    << reserved/(1024*1024) << " MB" << endmsg;
     log <<  MSG::INFO << "Necessary disk space: "
-    << statbuf.st_size/(1024*1024) << " MB" << endmsg;
-
-    // ----------allocate space to prevent half-staged files to fail because of insufficient disk space--------
-    // Daniela: works OK, but disabled because the call takes a few seconds to write the file
-    // might hamper performance
-
-    //     int tempfd = open(getTmpFilename(fileToStage).c_str(), O_RDWR|O_CREAT, 0777);
-    //     log << MSG::INFO << "About to allocate space:  "<< endmsg;
-    //
-    //     // Time stamp before the computations < - remove this section
-    //     struct timeval tp;
-    //     double sec, usec;
-    //     double m_beginInputFile, m_endInputFile;
-    //     double m_totalWaitTime, m_totalProcessingTime;
-    //     gettimeofday( &tp, NULL );
-    //     sec   = static_cast<double>( tp.tv_sec );
-    //     usec = static_cast<double>( tp.tv_usec )/1E6;
-    //     m_beginInputFile = sec + usec;
-    //     int ret1 = posix_fallocate(tempfd,0,statbuf.st_size); //allocate space, so comparisson is not necessary any more!
-    //     gettimeofday( &tp, NULL );
-    //     sec = static_cast<double>( tp.tv_sec );
-    //     usec = static_cast<double>( tp.tv_usec )/1E6;
-    //     m_endInputFile = sec + usec;
-    //     log << MSG::INFO <<"Time to allocate space = " <<(m_endInputFile-m_beginInputFile)<<" seconds"<< endmsg;
-    //     // END - remove this section
-    //
-    //     log << MSG::INFO << "Return code: "<<ret1 << endmsg;
-    //     if (ret1==0) {
-    //       log << MSG::INFO << "Allocated "<< statbuf.st_size/(1024*1024) <<"MB for the next file " <<endmsg;
-    //       return true;
-    //     } else {
-    //       log << MSG::ERROR << "Couldn't allocate enough space (" << statbuf.st_size/(1024*1024)<<" MB) for staging the next file " << endmsg;
-    //       log << MSG::ERROR << "Failed with error number: "<< ret1 << endmsg;
-    //       return false;
-    //     }
-    // END----allocate space to prevent half-staged files to fail because of insufficient disk space--------
-    m_stageMap[*(m_toBeStagedList.begin())].originalFileSize = statbuf.st_size;
-    return (statbuf.st_size/(1024*1024)) < (info.f_bavail*info.f_bsize)/(1024*1024) ;
+    << size/(1024*1024) << " MB" << endmsg;
+
+    m_stageMap[cf].originalFileSize = size;
+    return reserved + size < available;
   } else {
     log <<  MSG::ERROR << "Directory not available or no permission to write." << endmsg;
     //     throw GaudiException( "Checking space in " + s_stagerInfo.tmpdir + " failed.",
@@ -1086,4 +2385,72 @@ bool StageManager::checkLocalSpace() {
   return false;
 }
 
+//====================================================
+void StageManager::reserveSpace(const std::string& cf) {
+  MsgStream log(m_msg, "StageManager");
+  log.setLevel(m_outputLevel);
+  StageFileInfo& info = m_stageMap[cf];
+
+  bool preallocated(false);
+  if (s_stagerInfo.preallocate && info.originalFileSize>0) {
+    int fd = open(info.outFile.c_str(), O_WRONLY|O_CREAT, 0600);
+    if (fd<0) {
+      log << MSG::WARNING << "Could not create <" << info.outFile
+      << "> for preallocation: " << strerror(errno) << endmsg;
+    } else {
+      // posix_fallocate returns the error number instead of setting errno
+      int rc = posix_fallocate(fd, 0, info.originalFileSize);
+      close(fd);
+      if (rc==0) {
+        preallocated = true;
+        log << MSG::DEBUG << "Allocated " << info.originalFileSize/(1024*1024)
+        << " MB for <" << info.outFile << ">" << endmsg;
+      } else {
+        log << MSG::WARNING << "Couldn't allocate " << info.originalFileSize/(1024*1024)
+        << " MB for <" << info.outFile << ">: " << strerror(rc) << endmsg;
+      }
+    }
+  }
+
+  if (info.fallbackStrategy == StageFileInfo::SHARED_DIR)
+    m_sharedSpace.reserve(info.outFile, info.originalFileSize, preallocated);
+  else
+    m_localSpace.reserve(info.outFile, info.originalFileSize, preallocated);
+}
+
+//====================================================
+void StageManager::releaseSpace(const StageFileInfo& info) {
+  if (info.fallbackStrategy == StageFileInfo::SHARED_DIR)
+    m_sharedSpace.release(info.outFile);
+  else
+    m_localSpace.release(info.outFile);
+}
+
+//====================================================
+bool StageManager::spaceWillBeReleased() const {
+  return m_statusCount[StageFileInfo::STAGING] +
+         m_statusCount[StageFileInfo::STAGED] +
+         m_statusCount[StageFileInfo::ERRORSTAGING] > 0;
+}
 
+//====================================================
+void StageManager::updateRangeProgress() {
+  map<long,string>::iterator itr = m_rangeTransfers.begin();
+  while (itr!=m_rangeTransfers.end()) {
+    map<string,StageFileInfo>::const_iterator iEntry = m_stageMap.find(itr->second);
+    if (iEntry==m_stageMap.end() || (iEntry->second).transferId!=itr->first ||
+        (iEntry->second).status!=StageFileInfo::STAGING) {
+      m_rangeTransfers.erase(itr++);
+      continue;
+    }
+
+    // a preallocated file is on disk in full, otherwise only the ranges done so far
+    const StageFileInfo& info = iEntry->second;
+    unsigned long long done;
+    if (m_workerPool.progress(itr->first, done)) {
+      SpaceLedger& space = (info.fallbackStrategy == StageFileInfo::SHARED_DIR) ? m_sharedSpace : m_localSpace;
+      space.setWritten(info.outFile, m_workerPool.preallocated(itr->first) ? info.originalFileSize : done);
+    }
+    ++itr;
+  }
+}
@@ -4,6 +4,18 @@
 
 #include "StageFileInfo.h"
 #include "StagerInfo.h"
+#include "StageWorkerPool.h"
+#include "StageQueue.h"
+#include "SpaceLedger.h"
+#include "SizeProber.h"
+#include "ReplicaRanker.h"
+#include "NodeCache.h"
+#include "StageTimeline.h"
+#include "StageStatusBoard.h"
+#include "StallReport.h"
+#include "FileStager/IFileStagerProgress.h"
+#include "LcgTransferBackend.h"
+#include "PosixTransferBackend.h"
 
 #include "GaudiKernel/MsgStream.h"
 #include <set>
@@ -68,8 +80,9 @@ public:
    *  If the file is not already in the _toBeStagedList list, it is immediately pushed 
    *  to the front of the list and staging begins. Otherwise it checks the status of 
    *  the staging file and waits for the child process to terminate if the file is 
-   *  still staging.
+   *  still staging. A wait is attributed to its cause in the stall report.
    *  @param fname filename handle for the next file for processing
+   *  @see reportStalls
    */
   void getFile(const std::string& fname);
 
@@ -97,26 +110,40 @@ public:
     */
   StageFileInfo::Status getStatusOf(const std::string& filename, bool update=true);
 
+  /** Handles the transfers which have ended since the last call, and refills
+   *  the freed pipeline slots. Cheap when nothing happened (a single
+   *  non-blocking read), so it can be called once per event.
+   *  @see FileStagerSvc::handle()
+   */
+  void processCompletions();
+
   /** Setter method for the temporary local directory used for staging files
   *  Removes any unneccessary slashes from the file path.
   *  @param baseTmpdir the location of the base temporary directory 
   *  where the staged files will be stored. Usually /tmp or $TMPDIR
   */
   void setBaseTmpdir(const std::string& baseTmpdir);
-  ///The copy command issued by the child processes for invoking the tool for staging the files.
-  ///default value = "lcg-cp"
-
-  /** Setter method for the copy command issued by the child processes
-   *  for invoking the tool for staging the files.
-   *  @param cpcommand the command for invoking the middleware tool for staging the files
-   *  Default value is "lcg-cp"
+  /** Setter method for the transfer backend staging the files.
+   *  @param cpcommand "lcg" (or "lcg-cp") for the grid middleware, "posix" (or "cp") for
+   *  copies from a mounted file system; anything else, e.g. "auto" (default), picks the
+   *  posix backend for absolute paths and "file:" URLs and the lcg backend otherwise
+   *  @see ITransferBackend
    */
 
   void setCpCommand(const std::string& cpcommand);
 
 
-  /** Setter method for additional command-line arguments to the copy command
+  /** Replaces the built-in transfer backends for all files, e.g. by a simulated
+   *  storage element in the benchmarks.
+   *  @param backend the backend, not owned; 0 to go back to the built-in ones
+   */
+  void setTransferBackend(ITransferBackend* backend) {
+    m_backend = backend;
+  }
+
+  /** Setter method for additional arguments to the transfer backends.
    *  Can include the "-v" for verbosity, "--vo" for the virtual organization etc.
+   *  Each backend picks the arguments it knows.
    *  @param cparg the command argument to be added to the list
    */
   void addCpArg(const std::string& cparg);
@@ -131,6 +158,48 @@ public:
 
   void setPipeLength(const int& pipeLength);
 
+  /** Enables the adaptive pipe length: the number of files staged ahead is
+   * recomputed after every staged and every processed file, from running
+   * estimates of the transfer time and of the processing time per file,
+   * so that the next file is ready just before the current one is finished.
+   *  @param minPipeLength lower bound of the pipe length
+   *  @param maxPipeLength upper bound of the pipe length
+   *  @see FileStagerSvc::configStager
+   */
+  void setAdaptivePipe(const int& minPipeLength, const int& maxPipeLength);
+
+  /** Totals of the files staged so far, transferred or taken from the node cache
+   *  @param files number of staged files
+   *  @param bytes their size
+   *  @param seconds summed duration of their transfers; concurrent transfers add up
+   *  @see StagerChronoSvc::finalize()
+   */
+  void stagedTotals(long& files, unsigned long long& bytes, double& seconds) const;
+
+  /** Wall time during which at least one of the staged files was being transferred:
+   *  the length of the union of their transfer intervals
+   *  @see StagerChronoSvc::updateSummary()
+   */
+  double stagingWallTime() const;
+
+  /** Feeds the time spent by the job processing one input file
+   *  (BeginInputFile to EndInputFile) to the adaptive pipe length estimate.
+   *  @param seconds processing time of the file
+   *  @see StagerChronoSvc::handle()
+   */
+  void addProcessingTime(double seconds);
+
+  /** Setter method for the byte budget of the prefetch window. A file is only
+   *  staged ahead if the bytes of the files being staged and staged but not yet
+   *  released, plus its own size, fit in the budget. The pipe length still
+   *  bounds the number of concurrent transfers.
+   *  @param prefetchBytes fixed budget in bytes, 0 for none
+   *  @param freeFraction budget as a fraction of the free space in the temporary directory, 0 for none.
+   *  If both are given, the smaller one applies.
+   *  @see FileStagerSvc::configStager
+   */
+  void setPrefetchBudget(unsigned long long prefetchBytes, double freeFraction);
+
   /** Setter method for the input file prefix used in the FileStagerSvc.Input file descriptors
    *  Default value is "gfal:"
    *  @param infilePrefix string indicating the input file prefix used in the job configuration
@@ -199,6 +268,7 @@ public:
     *  Called by IFileStagerSvc::getLocalDataset
     *  If the dataset is in m_stageMap and has a STAGED (or REPLICATED) status, dataset_local will
     *   get the local file handle and StatusCode::SUCCESS will be returned. 
+    *  With progressive reads, STAGING files get their (partial) local handle as well.
     *  Otherwise the function returns StatusCode::FAILURE 
     * @param dataset the original dataset
     * @param dataset_local the mapped local handle of the staged file
@@ -207,6 +277,31 @@ public:
   StatusCode getLocalHandle(const std::string& dataset,
                             std::string & dataset_local);
 
+  /** Setter method for progressive reads: files with one of the given extensions are
+   *  handed out by getLocalHandle while they are still staging, and getFile does not wait
+   *  for them. Only suitable for files read sequentially from the front (MDF/raw);
+   *  ROOT files need their trailer at the end of the file.
+   *  @param extensions file name extensions, e.g. ".raw"; empty to disable
+   *  @param stallTimeout seconds without progress of the transfer after which the
+   *  reader switches to the remote original
+   *  @see StagedIODataManager::read
+   */
+  void setProgressiveRead(const std::vector<std::string>& extensions, double stallTimeout);
+
+  /// true if the local handle refers to a file handed out while it was still staging
+  bool isProgressive(const std::string& dataset_local) const;
+
+  /** Blocks until the first nbytes of a progressively read file have been written locally.
+   *  @param dataset_local the local handle obtained from getLocalHandle
+   *  @param nbytes number of bytes from the start of the file, -1 for the complete file
+   *  @return true if the bytes can be read locally; false if the transfer failed
+   *  or stalled, in which case the remote original should be read instead
+   */
+  bool waitForBytes(const std::string& dataset_local, long long nbytes);
+
+  /// original input file name of a progressively read local handle
+  string remoteName(const std::string& dataset_local) const;
+
   void setDefaultTmpdir() {
     s_stagerInfo.setTmpdir();
   }
@@ -216,6 +311,155 @@ public:
   void setParallelStreams(const int m_parallelStreams) {
     s_stagerInfo.gridFTPstreams = m_parallelStreams;
   }
+
+  /** Setter method for the number of in-process transfer threads.
+   *  With a value of 0 (default) every file is staged by a forked child process,
+   *  otherwise the transfers are run by a StageWorkerPool of that many threads.
+   *  Files are never staged by forked children while the size lookups run in threads,
+   *  which is the default: the pool is then sized by the pipe length.
+   *  @see setProbeThreads
+   *  @param transferThreads number of worker threads
+   *  @see FileStagerSvc::configStager
+   */
+  void setTransferThreads(const int transferThreads);
+
+  /** Setter method for the preallocation of the staged files with posix_fallocate.
+   *  Writing the blocks takes time on some file systems, but a transfer can then
+   *  not fail halfway because other transfers filled up the disk.
+   *  The copy command must write into the existing file.
+   *  @param preallocate true to preallocate, default false
+   *  @see FileStagerSvc::configStager
+   */
+  void setPreallocate(bool preallocate);
+
+  /** Setter method for the number of threads looking up the remote file sizes
+   *  in the background. With 0, each size is looked up when the file is staged.
+   *  With probe threads, the transfers run in the worker pool instead of forked children.
+   *  @param probeThreads number of concurrent lookups, default 4
+   *  @see FileStagerSvc::configStager
+   */
+  void setProbeThreads(const int probeThreads);
+
+  /** Setter method for the chunked download of large files: files of at least two ranges
+   *  are split into byte ranges fetched concurrently, from all replicas listed by lcg_lr3
+   *  if allReplicas is set, and written at their offsets into the local file.
+   *  The transfers run in the worker pool.
+   *  @param rangeSize size of one range in bytes, 0 (default) to disable
+   *  @param streams number of ranges fetched at the same time for one file
+   *  @param allReplicas spread the ranges over all replicas instead of the given source only
+   *  @see RangeDownload
+   */
+  void setRangeDownload(unsigned long long rangeSize, int streams, bool allReplicas);
+
+  /** Setter method for the retries of failed transfers. A failed file is queued again
+   *  and copied from the next replica listed by lcg_lr3, after a delay which doubles
+   *  with every attempt. getFile retries the file it waits for without delay between events.
+   *  The replicas are listed along with the size lookup, when the file is queued.
+   *  @param maxRetries number of retries after the first attempt, 0 to give up at once
+   *  @param backoff delay before the first retry, in seconds
+   *  @see FileStagerSvc::configStager
+   */
+  void setRetries(const int maxRetries, const double backoff);
+
+  /** Setter method for the replica ranking: the replicas of every input file are listed
+   *  in the background and each transfer copies from the replica with the shortest
+   *  expected completion time, according to the throughput and failures per SE host
+   *  seen so far. The model is read from modelFile and written back by saveReplicaModel().
+   *  @param rankReplicas true to list and rank the replicas
+   *  @param modelFile file keeping the model between jobs, empty for none
+   *  @see ReplicaRanker
+   */
+  void setReplicaRanking(bool rankReplicas, const std::string& modelFile);
+
+  /// writes the replica model to the file given to setReplicaRanking
+  void saveReplicaModel();
+
+  /** Setter method for the node-wide cache of staged files, shared by the jobs of the node.
+   *  Every staged file is published in the cache, and a file found there is hard-linked
+   *  into the temporary directory instead of being transferred. The cache directory must
+   *  be on the same file system as the base temporary directory. Jobs of the node
+   *  transferring the same file at the same time wait for the first one instead.
+   *  @param dir cache directory, empty (default) to disable the cache
+   *  @param limit size of the cache in bytes above which unused files are evicted, required;
+   *  unused files are also evicted when the temporary directory runs short of space
+   *  @see NodeCache
+   */
+  void setNodeCache(const std::string& dir, unsigned long long limit);
+
+  /** Setter method for the checksums the staged files are verified against.
+   *  A staged file whose Adler-32 differs is handled as a failed transfer and retried.
+   *  @param checksums Adler-32 checksums as 8 hexadecimal digits, optionally prefixed by
+   *  "adler32:" or "ad:", by input file name; other checksum types are ignored
+   *  @param catalogue true to look up the checksum of the files not listed through their
+   *  transfer backend, together with their size
+   *  @see Adler32, ITransferBackend::checksum
+   */
+  void setChecksums(const std::map<std::string,std::string>& checksums, bool catalogue=true);
+
+  /** Setter method for the timeout of a single transfer attempt, in seconds
+   *  @see FileStagerSvc::configStager
+   */
+  void setTimeout(const int timeout);
+
+  /** Setter method for the staging timeline: the lifecycle events of every input file
+   *  are recorded and written by writeTimeline() at the end of the job.
+   *  @param traceFile file for the Chrome trace-event JSON, empty for none
+   *  @param csvFile file for the CSV table with one line per input file, empty for none
+   *  @see StageTimeline
+   */
+  void setTimeline(const std::string& traceFile, const std::string& csvFile);
+
+  /** Writes the staging timeline to the files given to setTimeline. The files still held
+   *  are closed and released in the timeline at the time of writing, the end of the job.
+   */
+  void writeTimeline();
+
+  /** Setter method for the status board: the live staging figures are written to a
+   *  memory-mapped file, which a pilot or an operator can poll while the job runs.
+   *  @param path the board file, created or truncated
+   *  @see StageStatusBoard
+   */
+  void setStatusBoard(const std::string& path);
+
+  /** Keeps the live staging figures up to date without a status board, for the MonitorSvc.
+   *  The figures are refreshed at most once per second, from processCompletions(), and
+   *  when the event loop starts and stops waiting for a file.
+   */
+  void enableLiveMetrics() {
+    m_liveMetrics = true;
+  }
+
+  /// live staging figures, valid for the life time of the StageManager
+  const StageStatusBoard::Snapshot& liveMetrics() const {
+    return m_metrics;
+  }
+
+  /** Records the opening (BeginInputFile) and closing (EndInputFile) of an input file
+   *  by the event loop in the staging timeline.
+   *  @param fname the input file name, as given to getFile
+   *  @see FileStagerSvc::handle()
+   */
+  void beginInputFile(const std::string& fname);
+  void endInputFile(const std::string& fname);
+
+  /** Logs the waits of the event loop for its input files by cause, with the
+   *  configuration change most likely to shorten the largest share.
+   *  @see StallReport
+   */
+  void reportStalls();
+
+  const StallReport& stallReport() const {
+    return m_stallReport;
+  }
+
+  /** Progress of the staging of a file: bytes written, current rate and estimated time to completion.
+   *  The rate is sampled at most twice per second, from the bytes reported by a range download or
+   *  the size of the local copy; for a preallocated copy, the average throughput of the job is used.
+   *  @param fname the input file name, as given to getFile
+   *  @return false if the file is not known to the StageManager
+   *  @see IFileStagerProgress
+   */
+  bool getProgress(const std::string& fname, IFileStagerProgress::Progress& progress);
 protected:
 
   /// pointer to MessageSvc
@@ -238,10 +482,77 @@ private:
 
   bool replicaExists(std::string filename);
   /** Checks if the local temporary directory has enough disk space
-   * to store the next file
+   * to store a queued file, on top of the space still reserved by the
+   * running transfers into the same directory
+   * @param cf the file name handle as used in m_toBeStagedList
    * @return bool value, true if available disk space > maxFileSize
    */
-  bool checkLocalSpace();
+  bool checkLocalSpace(const std::string& cf);
+
+  /** Charges a file about to be staged against the free space of its directory,
+   * preallocating its blocks with posix_fallocate if configured.
+   * @param cf the file name handle as used in m_toBeStagedList; its outFile must be set
+   */
+  void reserveSpace(const std::string& cf);
+
+  /// removes the space reservation of a file whose transfer is over
+  void releaseSpace(const StageFileInfo& info);
+
+  /** Passes the bytes written by the running range downloads on to the space ledgers:
+   * their local files have their full size from the start, which tells nothing.
+   */
+  void updateRangeProgress();
+
+  /** true if files of the prefetch window are still on (or going to) the local disk,
+   * so that a file which does not fit now can wait for their release
+   */
+  bool spaceWillBeReleased() const;
+
+  /** Gets the size of a remote input file from the SizeProber cache, waiting
+   * for its lookup if it has not finished yet.
+   * @param cf the file name handle as used in m_toBeStagedList
+   * @param size the size of the remote file in bytes
+   * @return bool value, false if the file could not be found
+   */
+  bool getRemoteSize(const std::string& cf, unsigned long& size);
+
+  /** Queues the size lookup of an input file in the SizeProber
+   * @param front if true, the lookup is done before the other queued ones
+   */
+  void probeSize(const std::string& cf, bool front=false);
+
+  /** Handles the finished size lookups: files which do not exist are taken out
+   * of the queue and flagged as ERRORSTAGING before the event loop reaches them
+   */
+  void collectProbes();
+
+  /// takes a file which does not exist out of the queue, flagged as ERRORSTAGING
+  void dropMissing(const std::string& cf);
+
+  /// input file name in the form understood by gfal_stat64
+  string gfalName(const std::string& cf);
+
+  /// true if the file name has one of the extensions configured for progressive reads
+  bool progressive(const std::string& filename) const;
+
+  /// true for the states in which a file occupies (or will occupy) local disk space
+  static bool inWindow(StageFileInfo::Status status);
+
+  /** Current byte budget of the prefetch window, from the configured fixed size
+   * and/or fraction of the free space in the temporary directory
+   * @return the budget in bytes, 0 if no budget is configured
+   */
+  unsigned long long windowBudget();
+
+  /** Checks whether a file of the given size fits in the prefetch window.
+   * A file is always admitted if the window is empty, so that files
+   * larger than the budget are staged one at a time.
+   */
+  bool admitToWindow(unsigned long size);
+
+  /** Removes a file from m_stageMap, keeping the counters up to date
+   */
+  void dropEntry(const std::string& cf);
 
   /** Creates a child process responsible for downloading the next file
    * from the _toBeStagedList list. It uses the copy command and arguments 
@@ -251,13 +562,161 @@ private:
    */
   void stageNext(bool forceStage=false);
 
-  /** Issues a non-blocking call to check the status of the child processes responsible for
-   * staging the files. Iterates through the m_stageMap structure to get the process id's 
-   * of all child processes that are still staging files.
+  /** Picks the file stageNext() stages when it is not forced: the first queued file which
+   * neither waits for its next attempt, for its size lookup nor for another job's transfer. The files passed over are
+   * staged as soon as they are ready, without holding up the ones behind them.
+   * @param cf the file to stage
+   * @return false if none of the first queued files is ready
+   */
+  bool nextToStage(std::string& cf);
+
+  /** Moves the files whose transfer has ended to their final status.
+   * Driven by the notification pipe written by the SIGCHLD handler and the worker pool:
+   * nothing is checked unless a notification arrived, and then only the
+   * in-flight children in m_children are reaped with a non-waiting call.
    */
   void updateStatus();
 
-  void replicateNext(bool forceReplication=false);
+  /** Installs the SIGCHLD handler and creates the notification pipe, once per process.
+   */
+  void installChildHandler();
+
+  /** SIGCHLD handler: writes a byte to the notification pipe and chains to
+   * the previously installed handler, if any.
+   */
+  static void childHandler(int sig, siginfo_t* info, void* context);
+
+  /** Sets the final status of a file whose child process has ended.
+   * @param filename the file name handle as used in m_stageMap
+   * @param childOk whether the child process exited normally
+   */
+  void finishChild(const std::string& filename, bool childOk);
+
+  /** Starts new transfers until the pipeline is full or nothing is left to stage.
+   */
+  void refill();
+
+  /** Recomputes s_stagerInfo.pipeLength from the transfer and processing time estimates,
+   * moving it by one step towards ceil(transfer time/processing time),
+   * within [minPipeLength, maxPipeLength]
+   */
+  void adaptPipeLength();
+
+  /// current time in seconds since the epoch
+  static double currentTime();
+
+  /** Replicates a queued file to the closest storage element, the last fallback when
+   * neither the temporary nor the shared directory have space for it
+   * @param cf the file name handle as used in m_toBeStagedList
+   */
+  void replicateNext(const std::string& cf, bool forceReplication=false);
+
+  /** Collects the transfers finished by the worker pool and updates
+   * the status of the corresponding files.
+   */
+  void collectWorkers();
+
+  /** Sets the final status of a file after its transfer has ended:
+   * STAGED if the transfer succeeded and the local copy has the original size,
+   * ERRORSTAGING otherwise.
+   * @param filename the file name handle as used in m_stageMap
+   * @param transferOk whether the copy command reported success
+   */
+  void finishStaging(const std::string& filename, bool transferOk);
+
+  /** Sets the final status of a file after its replication has ended:
+   * REPLICATED if a local replica can be found, ERRORREPLICATION otherwise.
+   * @param filename the file name handle as used in m_stageMap
+   */
+  void finishReplication(const std::string& filename);
+
+  /** Fills a worker pool job with the transfer settings of s_stagerInfo
+   * @param cf the file name handle as used in m_stageMap
+   * @param type copy or replication
+   * @param src source handle passed to the middleware
+   * @param dest destination handle passed to the middleware
+   */
+  StageWorkerPool::Job makeJob(const std::string& cf, StageWorkerPool::JobType type,
+                               const std::string& src, const std::string& dest);
+
+  /** Body of getFile(): starts the staging of the file if needed and blocks until it has ended
+   * @param filename the normalized file name handle, as used in m_stageMap
+   */
+  void waitForFile(const std::string& filename);
+
+  /** Attributes a wait of the event loop to its cause and adds it to the stall report
+   * @param wasStaging the transfer of the file was running when getFile was called
+   * @param waited duration of the wait in seconds
+   */
+  void recordStall(const std::string& filename, bool wasStaging, double waited);
+
+  /** Blocks until the transfer of a STAGING file has ended, then finishes it
+   * @see finishStaging
+   */
+  void waitForStaging(const std::string& filename);
+
+  /** Queues a failed STAGING file again, unless it ran out of attempts
+   * @return true if a retry was scheduled
+   */
+  bool retryStaging(const std::string& filename);
+
+  /// source handle passed to the middleware for the next attempt: the best ranked replica not tried yet
+  string copySource(const std::string& filename);
+
+  /// input file name in the form accepted by lcg-cp
+  string middlewareName(const std::string& filename);
+
+  /// known replicas of a file, from the size probe or a failed attempt
+  vector<string> replicasOf(const std::string& filename);
+
+  /// starts the worker pool, sized by s_stagerInfo.transferThreads or else by the pipe length
+  void startWorkers();
+
+  /** true if the transfers run in the worker pool: if configured, and whenever threads of the
+   * stager run already. A forked child of a multithreaded process may inherit a lock held by
+   * another thread (in libc, gfal or a backend), and could then hang until its timeout.
+   */
+  bool useWorkers() const;
+
+  /** Links a queued file from the node cache into the temporary directory, making it STAGED
+   * @param cf the file name handle as used in m_toBeStagedList, in front of the queue
+   * @param size the size of the remote file
+   * @return true on a cache hit
+   */
+  bool fetchFromCache(const std::string& cf, unsigned long size);
+
+  /** Claims the transfer of a file in the node cache before it is staged. If another job of
+   * the node is transferring it, a forced file waits for that job as long as it keeps writing
+   * its copy: the file is then either found in the cache or, if the other job failed, died or
+   * stalled, transferred here. Other files are taken out of the pipeline and passed over by
+   * nextToStage() for a few seconds.
+   * @param cf the file name handle as used in m_toBeStagedList; its outFile and size must be set
+   * @return true if this job transfers the file
+   */
+  bool claimTransfer(const std::string& cf, bool forceStage);
+
+  /** Gets the checksum a staged file must have: the configured one, else the one
+   *  found by the size lookup
+   * @return false if it is not known
+   */
+  bool expectedChecksum(const std::string& cf, unsigned long& checksum);
+
+  /// true if the file is large enough to be downloaded as byte ranges
+  bool useRanges(const StageFileInfo& info);
+
+  /// transfer backend of an input file, from the configured copy command or the file name
+  ITransferBackend& backendFor(const std::string& filename);
+
+  /** Stops the worker transfer of a file: drops it if still queued, otherwise asks the
+   * range download or the backend to stop it
+   * @param running set if a worker still runs the transfer, which reports back once it ends
+   * @return false if the running transfer can not be interrupted and goes on until it ends
+   * or times out
+   */
+  bool stopTransfer(const std::string& filename, bool& running);
+
+  /// transfer settings of s_stagerInfo
+  TransferOptions transferOptions() const;
   /**
    * Removes any leading/trailing tabs/empty spaces from a string 
    * @param input input string
@@ -299,14 +758,115 @@ private:
    */
   int  getNstaging();
 
-  /// string vector of the orginal remote input file names containing the files to be staged
-  list< string > m_toBeStagedList;
+  /**
+   * Changes the status of a file, keeping m_statusCount up to date.
+   * All status changes of the m_stageMap entries go through here.
+   */
+  void setStatus(StageFileInfo& info, StageFileInfo::Status status);
+
+  /**
+   * Creates (or resets) the m_stageMap entry of a file, keeping m_statusCount up to date
+   * @return reference to the new entry
+   */
+  StageFileInfo& newEntry(const std::string& cf);
+
+  /// queue of the orginal remote input file names containing the files to be staged
+  StageQueue m_toBeStagedList;
+
+  /// number of m_stageMap entries in each StageFileInfo::Status
+  int m_statusCount[StageFileInfo::ERRORREPLICATION+1];
+
+  /// bytes of the files being staged, or staged and not yet released
+  unsigned long long m_windowBytes;
+
+  /// space reserved by the running transfers into the temporary and the shared directory
+  SpaceLedger m_localSpace;
+  SpaceLedger m_sharedSpace;
+  /// range downloads in the worker pool, by transfer id, until they are no longer STAGING
+  map<long,string> m_rangeTransfers;
+
+  /// attempts made to stage a file, kept while it is queued again after a failure
+  struct RetryInfo {
+    RetryInfo() : attempts(0), notBefore(0) {}
+    int attempts;
+    /// earliest time of the next attempt (seconds since the epoch)
+    double notBefore;
+    /// sources of the failed attempts
+    set<string> tried;
+  };
+  map<string,RetryInfo> m_retries;
+
+  /// replicas of the input files, listed by lcg_lr3
+  map<string, vector<string> > m_replicas;
+
+  /// throughput and failure history per SE host
+  ReplicaRanker m_replicaRanker;
+
+  /// transfer backends, see backendFor()
+  LcgTransferBackend m_lcgBackend;
+  PosixTransferBackend m_posixBackend;
+  /// backend set with setTransferBackend(), used for all files if set
+  ITransferBackend* m_backend;
+
+  /// staged files shared with the other jobs of the node
+  NodeCache m_nodeCache;
+
+  /// lifecycle events of the input files, recorded if enabled with setTimeline()
+  StageTimeline m_timeline;
+
+  /// waits of the event loop by cause
+  StallReport m_stallReport;
+  /// last reason each queued file was held back by stageNext(), until it is released
+  map<string,StallReport::Cause> m_deferrals;
+  /// queued files being transferred by another job of the node, with the time to look at them again
+  map<string,double> m_claimedElsewhere;
+
+  /** Refreshes the live staging figures and the status board, if enabled
+   * @param force refresh even if the last refresh is less than a second ago
+   */
+  void updateMetrics(bool force=false);
+
+  /// live staging figures, kept up to date if m_liveMetrics is set
+  StageStatusBoard::Snapshot m_metrics;
+  StageStatusBoard m_statusBoard;
+  bool m_liveMetrics;
+  /// time of the last throughput sample, and the bytes written until then
+  double m_metricsTime;
+  double m_metricsProgress;
+
+  /// local handles given out while staging, mapped to their input file name
+  map<string,string> m_progressiveHandles;
+
+  /// background lookups and cache of the remote file sizes
+  SizeProber m_sizeProber;
+
+  /// running (exponentially weighted) average of the time needed to stage a file, in seconds
+  double m_transferTime;
+  /// running (exponentially weighted) average of the time needed to process a file, in seconds
+  double m_processingTime;
+
+  /// files staged so far, their bytes and the summed duration of their transfers
+  long m_stagedFiles;
+  unsigned long long m_stagedBytes;
+  double m_stagedSeconds;
+  /// start and end of the transfer of each staged file
+  vector< pair<double,double> > m_stagedIntervals;
 
   /// mapping of each input file to its details: status, full input file name, temporary output file name (no protocol info)
   map<string,StageFileInfo> m_stageMap;
 
   /// static member acting as a data structure for the configuration details of the StageManager
   static StagerInfo s_stagerInfo;
+
+  /// worker threads running the transfers when s_stagerInfo.transferThreads > 0
+  StageWorkerPool m_workerPool;
+
+  /// child processes still transferring, mapped to the file they are staging
+  map<pid_t,string> m_children;
+
+  /// self-pipe written by childHandler() and the worker pool; [0] read end, [1] write end
+  static int s_notifyPipe[2];
+  static struct sigaction s_oldChildAction;
   bool m_submittedGarbageCollector;
   bool m_keepLogfiles;
   int m_outputLevel;
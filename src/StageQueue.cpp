@@ -0,0 +1,48 @@
+#include "StageQueue.h"
+
+//====================================================
+bool StageQueue::push_back(const std::string& name) {
+  if (contains(name))
+    return false;
+  m_index[name] = m_order.insert(m_order.end(), name);
+  return true;
+}
+
+
+//====================================================
+void StageQueue::push_front(const std::string& name) {
+  Index::iterator itr = m_index.find(name);
+  if (itr!=m_index.end()) {
+    // relink the existing node, no copy of the name
+    m_order.splice(m_order.begin(), m_order, itr->second);
+    return;
+  }
+  m_index[name] = m_order.insert(m_order.begin(), name);
+}
+
+
+//====================================================
+bool StageQueue::erase(const std::string& name) {
+  Index::iterator itr = m_index.find(name);
+  if (itr==m_index.end())
+    return false;
+  m_order.erase(itr->second);
+  m_index.erase(itr);
+  return true;
+}
+
+
+//====================================================
+void StageQueue::pop_front() {
+  if (m_order.empty())
+    return;
+  m_index.erase(m_order.front());
+  m_order.pop_front();
+}
+
+
+//====================================================
+void StageQueue::clear() {
+  m_index.clear();
+  m_order.clear();
+}
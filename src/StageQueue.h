@@ -0,0 +1,77 @@
+#ifndef STAGEQUEUE_H
+#define STAGEQUEUE_H 1
+
+#include <list>
+#include <string>
+#include <boost/unordered_map.hpp>
+
+using namespace std ;
+
+/**  @class StageQueue  StageQueue.h
+ *   Ordered queue of the file names waiting to be staged, with a hash index
+ *   on the names: membership tests, removal of an arbitrary entry and
+ *   moving an entry to the front (forced staging) are all O(1),
+ *   independently of the number of queued files.
+ *
+ *   @version 1.0
+ */
+class StageQueue {
+public:
+  typedef list<string>::const_iterator const_iterator;
+
+  /// true if the file name is queued
+  bool contains(const std::string& name) const {
+    return m_index.find(name)!=m_index.end();
+  }
+
+  /** Appends a file name, unless it is already queued
+   *  @return true if the name was added
+   */
+  bool push_back(const std::string& name);
+
+  /** Puts a file name in front of the queue, moving it there if it is already queued
+   */
+  void push_front(const std::string& name);
+
+  /** Removes a file name from the queue
+   *  @return true if the name was queued
+   */
+  bool erase(const std::string& name);
+
+  /// first file name in the queue; the queue must not be empty
+  const string& front() const {
+    return m_order.front();
+  }
+
+  /// removes the first file name of the queue
+  void pop_front();
+
+  bool empty() const {
+    return m_index.empty();
+  }
+
+  /// number of queued file names; constant time, unlike std::list::size()
+  size_t size() const {
+    return m_index.size();
+  }
+
+  void clear();
+
+  const_iterator begin() const {
+    return m_order.begin();
+  }
+
+  const_iterator end() const {
+    return m_order.end();
+  }
+
+private:
+  typedef boost::unordered_map<string, list<string>::iterator> Index;
+
+  /// file names in staging order
+  list<string> m_order;
+  /// position of every queued name in m_order
+  Index m_index;
+} ;
+
+#endif // STAGEQUEUE_H
@@ -0,0 +1,115 @@
+#include "StageStatusBoard.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <algorithm>
+
+namespace {
+  /// width of the name and of the value of a line
+  const size_t s_nameWidth = 16;
+  const size_t s_valueWidth = 24;
+  const size_t s_lineWidth = s_nameWidth + s_valueWidth + 1;
+  /// width of the value of the waiting_for line
+  const size_t s_fileWidth = 256;
+
+  /// lines of the board, in order; waiting_for is the one before the last
+  enum Line { SEQ_HEAD, PID, UPDATED, QUEUED, STAGING, STAGED, FAILED, IN_FLIGHT,
+              THROUGHPUT, SCRATCH, WAITING_SINCE, WAITING_FOR, SEQ_TAIL };
+
+  const size_t s_size = (SEQ_TAIL+1)*s_lineWidth + s_fileWidth - s_valueWidth;
+
+  size_t offsetOf(Line line) {
+    size_t offset = line*s_lineWidth;
+    if (line==SEQ_TAIL)
+      offset += s_fileWidth - s_valueWidth;
+    return offset;
+  }
+
+  string number(double value, int decimals=0) {
+    char text[64];
+    snprintf(text, sizeof(text), "%.*f", decimals, value);
+    return text;
+  }
+}
+
+
+//====================================================
+
+StageStatusBoard::StageStatusBoard()
+    : m_board(0)
+    , m_seq(0) {}
+
+
+StageStatusBoard::~StageStatusBoard() {
+  if (m_board)
+    munmap(m_board, s_size);
+}
+
+
+//====================================================
+bool StageStatusBoard::open(const std::string& path) {
+  if (m_board) {
+    munmap(m_board, s_size);
+    m_board = 0;
+  }
+
+  int fd = ::open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+  if (fd<0)
+    return false;
+  void* board(MAP_FAILED);
+  if (ftruncate(fd, s_size)==0)
+    board = mmap(0, s_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  // the mapping stays valid without the descriptor
+  close(fd);
+  if (board==MAP_FAILED)
+    return false;
+
+  m_board = static_cast<char*>(board);
+  memset(m_board, ' ', s_size);
+  publish(Snapshot());
+  return true;
+}
+
+
+//====================================================
+void StageStatusBoard::line(size_t offset, const char* name, const std::string& value) {
+  size_t width = (offset==offsetOf(WAITING_FOR)) ? s_fileWidth : s_valueWidth;
+  char* text = m_board + offset;
+  memset(text, ' ', s_nameWidth + width);
+  memcpy(text, name, std::min(strlen(name), s_nameWidth-1));
+  memcpy(text + s_nameWidth, value.data(), std::min(value.size(), width));
+  text[s_nameWidth + width] = '\n';
+}
+
+
+//====================================================
+void StageStatusBoard::publish(const Snapshot& snapshot) {
+  if (!m_board)
+    return;
+
+  // the watchers read from the start: the last seq line is written first and the first one last,
+  // so that equal seq lines enclose a complete update
+  string seq = number(++m_seq);
+  line(offsetOf(SEQ_TAIL), "seq", seq);
+  __sync_synchronize();
+
+  line(offsetOf(PID), "pid", number(getpid()));
+  struct timeval tp;
+  gettimeofday( &tp, NULL );
+  line(offsetOf(UPDATED), "updated", number(tp.tv_sec + tp.tv_usec/1E6, 3));
+  line(offsetOf(QUEUED), "queued", number(snapshot.queued));
+  line(offsetOf(STAGING), "staging", number(snapshot.staging));
+  line(offsetOf(STAGED), "staged", number(snapshot.staged));
+  line(offsetOf(FAILED), "failed", number(snapshot.failed));
+  line(offsetOf(IN_FLIGHT), "bytes_in_flight", number(snapshot.bytesInFlight));
+  line(offsetOf(THROUGHPUT), "throughput_Bps", number(snapshot.throughput));
+  line(offsetOf(SCRATCH), "scratch_bytes", number(snapshot.scratchBytes));
+  line(offsetOf(WAITING_SINCE), "waiting_since", number(snapshot.waitingSince, 3));
+  line(offsetOf(WAITING_FOR), "waiting_for", snapshot.waitingFor);
+
+  __sync_synchronize();
+  line(offsetOf(SEQ_HEAD), "seq", seq);
+}
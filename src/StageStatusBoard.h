@@ -0,0 +1,75 @@
+#ifndef STAGESTATUSBOARD_H
+#define STAGESTATUSBOARD_H 1
+
+#include <string>
+
+using namespace std ;
+
+/**  @class StageStatusBoard  StageStatusBoard.h
+ *   Live staging figures of the job in a small memory-mapped file, for a pilot or an
+ *   operator to poll (e.g. with cat) while the job runs. The file has a fixed size and
+ *   layout, one "name value" line per figure, and is rewritten in place without any
+ *   system call or lock, so that the watchers cost the job nothing:
+ *
+ *     seq             <n>       incremented by every update
+ *     pid, updated              job process and time of the update (seconds since the epoch)
+ *     queued, staging           files waiting for, and in, transfer
+ *     staged, failed            files staged so far, files given up
+ *     bytes_in_flight           size of the files in transfer
+ *     throughput_Bps            bytes written per second over the last interval
+ *     scratch_bytes             bytes the job holds in the temporary directories
+ *     waiting_since             time at which the event loop started waiting for a file, 0 if it is not
+ *     waiting_for               the file it waits for
+ *     seq             <n>       same as the first line once the update is complete
+ *
+ *   A watcher reads the whole file from the start and retries if the two seq lines differ.
+ *   The file is left in place at the end of the job, with its last figures.
+ *
+ *   @version 1.0
+ */
+class StageStatusBoard {
+public:
+
+  /// figures shown on the board
+  struct Snapshot {
+    Snapshot() : queued(0), staging(0), staged(0), failed(0), bytesInFlight(0),
+        throughput(0), scratchBytes(0), waitingSince(0) {}
+    int queued;
+    int staging;
+    int staged;
+    int failed;
+    double bytesInFlight;
+    double throughput;
+    double scratchBytes;
+    double waitingSince;
+    string waitingFor;
+  };
+
+  StageStatusBoard();
+  ~StageStatusBoard();
+
+  /** Creates (or truncates) and maps the board file
+   *  @return false if the file can not be created or mapped
+   */
+  bool open(const std::string& path);
+
+  bool isOpen() const {
+    return m_board!=0;
+  }
+
+  /// writes the figures to the board
+  void publish(const Snapshot& snapshot);
+
+private:
+
+  StageStatusBoard(const StageStatusBoard&);
+  StageStatusBoard& operator= (const StageStatusBoard&);
+
+  /// writes one line at the given offset of the board
+  void line(size_t offset, const char* name, const std::string& value);
+
+  char* m_board;
+  unsigned long m_seq;
+} ;
+
+#endif // STAGESTATUSBOARD_H
@@ -0,0 +1,299 @@
+#include "StageTimeline.h"
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+  /// names of the instant events in the trace, by StageTimeline::Event
+  const char* const s_instantNames[] = { "queued", "probed", 0, 0, "verified", 0, 0, "released" };
+
+  /// file name without its directories, as the row name of the trace
+  string baseName(const std::string& file) {
+    string::size_type slash = file.find_last_of('/');
+    return slash==string::npos ? file : file.substr(slash+1);
+  }
+
+  /// string as a JSON string literal
+  string jsonString(const std::string& text) {
+    string quoted("\"");
+    for (string::size_type i=0; i<text.size(); ++i) {
+      unsigned char c = text[i];
+      if (c=='"' || c=='\\') {
+        quoted += '\\';
+        quoted += c;
+      } else if (c<0x20) {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        quoted += escaped;
+      } else {
+        quoted += c;
+      }
+    }
+    return quoted + "\"";
+  }
+
+  /// string as a CSV field
+  string csvString(const std::string& text) {
+    string quoted("\"");
+    for (string::size_type i=0; i<text.size(); ++i) {
+      if (text[i]=='"')
+        quoted += '"';
+      quoted += text[i];
+    }
+    return quoted + "\"";
+  }
+
+  /// writes one complete ("X") event of the trace, times in seconds since the origin
+  void slice(ostream& out, bool& first, const char* name, int tid, double start, double end,
+             const std::string& file, const std::string& args="") {
+    out << (first ? "\n" : ",\n")
+    << "{\"name\":\"" << name << "\",\"cat\":\"staging\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+    << ",\"ts\":" << start*1E6 << ",\"dur\":" << std::max(end-start, 0.)*1E6
+    << ",\"args\":{\"file\":" << jsonString(file) << args << "}}";
+    first = false;
+  }
+
+  /// writes one instant ("i") event of the trace
+  void instant(ostream& out, bool& first, const char* name, int tid, double time, const std::string& file) {
+    out << (first ? "\n" : ",\n")
+    << "{\"name\":\"" << name << "\",\"cat\":\"staging\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":" << tid
+    << ",\"ts\":" << time*1E6 << ",\"args\":{\"file\":" << jsonString(file) << "}}";
+    first = false;
+  }
+
+  /// writes the name and position of one row of the trace
+  void row(ostream& out, bool& first, int tid, const std::string& name) {
+    out << (first ? "\n" : ",\n")
+    << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+    << ",\"args\":{\"name\":" << jsonString(name) << "}},\n"
+    << "{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+    << ",\"args\":{\"sort_index\":" << tid << "}}";
+    first = false;
+  }
+
+  /// orders (opening time, file) pairs by their opening time
+  struct ByOpening {
+    bool operator()(const pair<double,string>& a, const pair<double,string>& b) const {
+      return a.first < b.first;
+    }
+  };
+}
+
+
+//====================================================
+
+StageTimeline::StageTimeline()
+    : m_enabled(false) {}
+
+
+//====================================================
+StageTimeline::Record& StageTimeline::record(const std::string& file) {
+  map<string,Record>::iterator itr = m_records.find(file);
+  if (itr!=m_records.end())
+    return itr->second;
+  m_order.push_back(file);
+  return m_records[file];
+}
+
+
+//====================================================
+void StageTimeline::mark(const std::string& file, Event event, double time, bool ok) {
+  if (!m_enabled)
+    return;
+
+  Record& rec = record(file);
+  if (event==TRANSFER_STARTED) {
+    rec.attempts.push_back(Attempt());
+    rec.attempts.back().start = time;
+  } else if (event==TRANSFER_FINISHED) {
+    // a transfer released while queued in the worker pool never finishes
+    if (!rec.attempts.empty() && rec.attempts.back().end==0) {
+      rec.attempts.back().end = time;
+      rec.attempts.back().ok = ok;
+    }
+  } else if (rec.times[event]==0) {
+    rec.times[event] = time;
+  }
+}
+
+
+//====================================================
+void StageTimeline::setSize(const std::string& file, unsigned long long size) {
+  if (m_enabled)
+    record(file).size = size;
+}
+
+
+//====================================================
+void StageTimeline::setCached(const std::string& file) {
+  if (m_enabled)
+    record(file).cached = true;
+}
+
+
+//====================================================
+void StageTimeline::finish(double time) {
+  map<string,Record>::iterator itr = m_records.begin();
+  for (; itr!=m_records.end(); ++itr) {
+    Record& rec = itr->second;
+    if (!rec.attempts.empty() && rec.attempts.back().end==0)
+      rec.attempts.back().end = time;
+    if (rec.times[OPENED]>0 && rec.times[CLOSED]==0)
+      rec.times[CLOSED] = time;
+    if (rec.times[RELEASED]==0)
+      rec.times[RELEASED] = time;
+  }
+}
+
+
+//====================================================
+double StageTimeline::origin() const {
+  double first(0);
+  map<string,Record>::const_iterator itr = m_records.begin();
+  for (; itr!=m_records.end(); ++itr) {
+    const Record& rec = itr->second;
+    for (int i=0; i<=RELEASED; ++i)
+      if (rec.times[i]>0 && (first==0 || rec.times[i]<first))
+        first = rec.times[i];
+    for (unsigned int i=0; i<rec.attempts.size(); ++i)
+      if (first==0 || rec.attempts[i].start<first)
+        first = rec.attempts[i].start;
+  }
+  return first;
+}
+
+
+//====================================================
+bool StageTimeline::writeTrace(const std::string& path) const {
+  ofstream out(path.c_str());
+  if (!out)
+    return false;
+  out << fixed << setprecision(0);
+
+  double t0 = origin();
+  bool first(true);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  row(out, first, 0, "event loop");
+
+  // event loop row: the processing of each file, and the waits in between
+  vector< pair<double,string> > opened;
+  for (unsigned int i=0; i<m_order.size(); ++i) {
+    const Record& rec = m_records.find(m_order[i])->second;
+    if (rec.times[OPENED]>0)
+      opened.push_back(make_pair(rec.times[OPENED], m_order[i]));
+  }
+  std::sort(opened.begin(), opened.end(), ByOpening());
+  double lastClosed(0);
+  for (unsigned int i=0; i<opened.size(); ++i) {
+    const Record& rec = m_records.find(opened[i].second)->second;
+    if (lastClosed>0)
+      slice(out, first, "waiting", 0, lastClosed-t0, rec.times[OPENED]-t0, opened[i].second);
+    if (rec.times[CLOSED]>0) {
+      slice(out, first, "processing", 0, rec.times[OPENED]-t0, rec.times[CLOSED]-t0, opened[i].second);
+      lastClosed = rec.times[CLOSED];
+    }
+  }
+
+  // one row per input file
+  for (unsigned int i=0; i<m_order.size(); ++i) {
+    const string& file = m_order[i];
+    const Record& rec = m_records.find(file)->second;
+    int tid = i+1;
+    row(out, first, tid, baseName(file));
+
+    if (rec.times[QUEUED]>0 && !rec.attempts.empty())
+      slice(out, first, "queued", tid, rec.times[QUEUED]-t0, rec.attempts.front().start-t0, file);
+
+    double ready(0);
+    for (unsigned int j=0; j<rec.attempts.size(); ++j) {
+      const Attempt& attempt = rec.attempts[j];
+      if (attempt.end==0)
+        continue;
+      std::ostringstream args;
+      args << ",\"attempt\":" << j+1 << ",\"bytes\":" << rec.size;
+      const char* name = rec.cached ? "node cache" : (attempt.ok ? "transfer" : "failed transfer");
+      slice(out, first, name, tid, attempt.start-t0, attempt.end-t0, file, args.str());
+      if (attempt.ok)
+        ready = attempt.end;
+    }
+
+    // on the local disk ahead of its use by the event loop
+    double used = rec.times[OPENED]>0 ? rec.times[OPENED] : rec.times[RELEASED];
+    if (ready>0 && used>ready)
+      slice(out, first, "staged", tid, ready-t0, used-t0, file);
+    if (rec.times[OPENED]>0 && rec.times[CLOSED]>0)
+      slice(out, first, "processing", tid, rec.times[OPENED]-t0, rec.times[CLOSED]-t0, file);
+
+    for (int event=0; event<=RELEASED; ++event)
+      if (s_instantNames[event] && rec.times[event]>0)
+        instant(out, first, s_instantNames[event], tid, rec.times[event]-t0, file);
+  }
+
+  out << "\n]}" << endl;
+  return out.good();
+}
+
+
+//====================================================
+bool StageTimeline::writeCsv(const std::string& path) const {
+  ofstream out(path.c_str());
+  if (!out)
+    return false;
+  out << fixed << setprecision(3);
+
+  double t0 = origin();
+  // waits of the event loop: time from the previous EndInputFile to each BeginInputFile
+  map<string,double> stalls;
+  vector< pair<double,string> > opened;
+  for (map<string,Record>::const_iterator itr=m_records.begin(); itr!=m_records.end(); ++itr)
+    if ((itr->second).times[OPENED]>0)
+      opened.push_back(make_pair((itr->second).times[OPENED], itr->first));
+  std::sort(opened.begin(), opened.end(), ByOpening());
+  for (unsigned int i=1; i<opened.size(); ++i) {
+    double prevClosed = m_records.find(opened[i-1].second)->second.times[CLOSED];
+    if (prevClosed>0)
+      stalls[opened[i].second] = opened[i].first - prevClosed;
+  }
+
+  out << "file,size,cached,attempts,failed_attempts,queued,probed,transfer_started,transfer_finished,"
+  << "verified,opened,closed,released,transfer_time,staged_ahead,stall" << endl;
+  for (unsigned int i=0; i<m_order.size(); ++i) {
+    const Record& rec = m_records.find(m_order[i])->second;
+    int failed(0);
+    double started(0), finished(0);
+    for (unsigned int j=0; j<rec.attempts.size(); ++j) {
+      if (rec.attempts[j].end>0 && !rec.attempts[j].ok)
+        ++failed;
+      if (j==0)
+        started = rec.attempts[j].start;
+      if (rec.attempts[j].ok)
+        finished = rec.attempts[j].end;
+    }
+
+    out << csvString(m_order[i]) << "," << rec.size << "," << (rec.cached ? 1 : 0) << ","
+    << rec.attempts.size() << "," << failed;
+    double columns[] = { rec.times[QUEUED], rec.times[PROBED], started, finished, rec.times[VERIFIED],
+                         rec.times[OPENED], rec.times[CLOSED], rec.times[RELEASED] };
+    for (unsigned int j=0; j<sizeof(columns)/sizeof(columns[0]); ++j) {
+      out << ",";
+      if (columns[j]>0)
+        out << columns[j]-t0;
+    }
+
+    // durations, empty if one of their ends is missing
+    out << ",";
+    if (started>0 && finished>0)
+      out << finished-started;
+    out << ",";
+    if (finished>0 && rec.times[OPENED]>0)
+      out << rec.times[OPENED]-finished;
+    out << ",";
+    map<string,double>::const_iterator iStall = stalls.find(m_order[i]);
+    if (iStall!=stalls.end())
+      out << iStall->second;
+    out << endl;
+  }
+  return out.good();
+}
@@ -0,0 +1,104 @@
+#ifndef STAGETIMELINE_H
+#define STAGETIMELINE_H 1
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std ;
+
+/**  @class StageTimeline  StageTimeline.h
+ *   Records the lifecycle of every input file handled by the StageManager:
+ *   queued, size probed, each transfer attempt, verified, opened and closed by
+ *   the event loop (BeginInputFile and EndInputFile) and released.
+ *   At the end of the job the timeline is written as a Chrome trace-event JSON
+ *   file (one row per input file plus one for the event loop, to be loaded in
+ *   chrome://tracing or Perfetto) and as a flat CSV file with one line per input
+ *   file, for the analysis of many jobs. Nothing is recorded unless enabled.
+ *
+ *   @version 1.0
+ */
+class StageTimeline {
+public:
+
+  /// lifecycle events of an input file
+  enum Event { QUEUED, PROBED, TRANSFER_STARTED, TRANSFER_FINISHED,
+               VERIFIED, OPENED, CLOSED, RELEASED };
+
+  StageTimeline();
+
+  void enable(bool enable=true) {
+    m_enabled = enable;
+  }
+
+  bool enabled() const {
+    return m_enabled;
+  }
+
+  /** Records an event of an input file. The transfer events open and close one
+   *  attempt each; of the other events only the first occurrence is kept.
+   *  @param file input file name, as used in the StageManager bookkeeping
+   *  @param event the event
+   *  @param time time of the event, in seconds since the epoch
+   *  @param ok TRANSFER_FINISHED only: whether the attempt succeeded
+   */
+  void mark(const std::string& file, Event event, double time, bool ok=true);
+
+  /// records the size of an input file, in bytes
+  void setSize(const std::string& file, unsigned long long size);
+
+  /// records that an input file was linked from the node cache instead of being transferred
+  void setCached(const std::string& file);
+
+  /** Ends the lifecycle of the files still held at the end of the job: a running attempt
+   *  fails, an opened file is closed and every file is released at the given time,
+   *  unless these events were recorded before
+   */
+  void finish(double time);
+
+  /** Writes the timeline in the Chrome trace-event format
+   *  @return false if the file can not be written
+   */
+  bool writeTrace(const std::string& path) const;
+
+  /** Writes the timeline as CSV, one line per input file, times in seconds since the first event
+   *  @return false if the file can not be written
+   */
+  bool writeCsv(const std::string& path) const;
+
+private:
+
+  /// one transfer attempt
+  struct Attempt {
+    Attempt() : start(0), end(0), ok(false) {}
+    double start;
+    /// 0 while the attempt runs
+    double end;
+    bool ok;
+  };
+
+  /// all events of one input file; times are 0 if not recorded
+  struct Record {
+    Record() : size(0), cached(false) {
+      for (int i=0; i<=RELEASED; ++i)
+        times[i] = 0;
+    }
+    double times[RELEASED+1];
+    vector<Attempt> attempts;
+    unsigned long long size;
+    bool cached;
+  };
+
+  /// record of a file, created on its first event
+  Record& record(const std::string& file);
+
+  /// time of the earliest recorded event, the origin of the exported times
+  double origin() const;
+
+  bool m_enabled;
+  map<string,Record> m_records;
+  /// input files in the order of their first event
+  vector<string> m_order;
+} ;
+
+#endif // STAGETIMELINE_H
@@ -0,0 +1,390 @@
+#include "StageWorkerPool.h"
+#include "RangeDownload.h"
+#include "Adler32.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <algorithm>
+
+/// interval at which wait() looks at the progress of the job it waits for, in seconds
+static const double s_waitPoll = 1.;
+
+/// current time in seconds since the epoch
+static inline double currentTime() {
+  struct timeval tp;
+  gettimeofday( &tp, NULL );
+  return tp.tv_sec + tp.tv_usec*1E-6;
+}
+
+
+class StageWorkerPool::RangeProgress : public RangeDownload::Listener {
+public:
+  RangeProgress(StageWorkerPool& pool, long id) : m_pool(pool), m_id(id) {
+    m_pool.setProgress(m_id, 0);
+  }
+  void progress(unsigned long long bytesDone) {
+    m_pool.setProgress(m_id, bytesDone);
+  }
+  void preallocated() {
+    m_pool.setPreallocated(m_id);
+  }
+  bool cancelled() {
+    return m_pool.cancelled(m_id);
+  }
+private:
+  StageWorkerPool& m_pool;
+  long m_id;
+};
+
+//====================================================
+
+StageWorkerPool::StageWorkerPool()
+    : m_nextId(0)
+    , m_notifyFd(-1)
+    , m_stop(false) {
+  pthread_mutex_init(&m_mutex, 0);
+  pthread_cond_init(&m_jobCond, 0);
+  pthread_cond_init(&m_doneCond, 0);
+}
+
+
+StageWorkerPool::~StageWorkerPool() {
+  stop();
+  pthread_cond_destroy(&m_doneCond);
+  pthread_cond_destroy(&m_jobCond);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+
+//====================================================
+void StageWorkerPool::start(int nWorkers) {
+  if (running())
+    return;
+
+  m_stop = false;
+  for (int i=0; i<nWorkers; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, 0, &StageWorkerPool::run, this)==0)
+      m_threads.push_back(thread);
+  }
+}
+
+
+//====================================================
+void StageWorkerPool::stop() {
+  if (!running())
+    return;
+
+  pthread_mutex_lock(&m_mutex);
+  m_stop = true;
+  // the dropped jobs fail, so that nobody waits for them
+  for (unsigned int i=0; i<m_jobs.size(); ++i) {
+    Result result;
+    result.id = m_jobs[i].id;
+    result.type = m_jobs[i].type;
+    result.key = m_jobs[i].key;
+    result.rc = 1;
+    result.error = "transfer dropped, the worker pool was stopped";
+    result.verifySeconds = 0;
+    m_results.push_back(result);
+  }
+  m_jobs.clear();
+  pthread_cond_broadcast(&m_jobCond);
+  pthread_cond_broadcast(&m_doneCond);
+  pthread_mutex_unlock(&m_mutex);
+
+  // running transfers are bounded by the middleware timeout
+  for (unsigned int i=0; i<m_threads.size(); ++i)
+    pthread_join(m_threads[i], 0);
+  m_threads.clear();
+}
+
+
+//====================================================
+long StageWorkerPool::submit(Job job, bool front) {
+  pthread_mutex_lock(&m_mutex);
+  job.id = ++m_nextId;
+  if (front)
+    m_jobs.push_front(job);
+  else
+    m_jobs.push_back(job);
+  pthread_cond_signal(&m_jobCond);
+  pthread_mutex_unlock(&m_mutex);
+  return job.id;
+}
+
+
+//====================================================
+bool StageWorkerPool::cancel(long id) {
+  bool found(false);
+  pthread_mutex_lock(&m_mutex);
+  deque<Job>::iterator itr = m_jobs.begin();
+  for (; itr!=m_jobs.end(); ++itr) {
+    if (itr->id == id) {
+      m_jobs.erase(itr);
+      found = true;
+      break;
+    }
+  }
+  // backends stop their copies themselves, range downloads poll m_cancelled
+  if (!found && m_progress.find(id)!=m_progress.end())
+    m_cancelled.insert(id);
+  pthread_mutex_unlock(&m_mutex);
+  return found;
+}
+
+
+//====================================================
+bool StageWorkerPool::poll(Result& result) {
+  bool found(false);
+  pthread_mutex_lock(&m_mutex);
+  if (!m_results.empty()) {
+    result = m_results.front();
+    m_results.pop_front();
+    found = true;
+  }
+  pthread_mutex_unlock(&m_mutex);
+  return found;
+}
+
+
+//====================================================
+bool StageWorkerPool::wait(long id, Result& result, double timeout) {
+  bool found(false);
+  // the deadline starts once a worker runs the job, and moves with its progress
+  double deadline(0);
+  unsigned long long lastBytes(0);
+  double lastModified(0);
+  pthread_mutex_lock(&m_mutex);
+  while (true) {
+    deque<Result>::iterator itr = m_results.begin();
+    for (; itr!=m_results.end(); ++itr) {
+      if (itr->id == id)
+        break;
+    }
+    if (itr!=m_results.end()) {
+      result = *itr;
+      m_results.erase(itr);
+      found = true;
+      break;
+    }
+    if (!running())
+      break;
+
+    double now = currentTime();
+    if (queued(id)) {
+      deadline = 0;
+    } else {
+      unsigned long long bytes(0);
+      double modified(0);
+      map<long, unsigned long long>::const_iterator iProgress = m_progress.find(id);
+      if (iProgress!=m_progress.end())
+        bytes = iProgress->second;
+      else
+        written(id, bytes, modified);
+      if (deadline==0 || bytes!=lastBytes || modified!=lastModified) {
+        deadline = now + timeout;
+        lastBytes = bytes;
+        lastModified = modified;
+      } else if (now >= deadline) {
+        break;
+      }
+    }
+
+    double until = now + s_waitPoll;
+    struct timespec ts;
+    ts.tv_sec = time_t(until);
+    ts.tv_nsec = long((until - ts.tv_sec)*1E9);
+    pthread_cond_timedwait(&m_doneCond, &m_mutex, &ts);
+  }
+  pthread_mutex_unlock(&m_mutex);
+
+  if (!found) {
+    result.id = id;
+    result.type = COPY;
+    result.key.clear();
+    result.rc = 1;
+    result.error = "the transfer did not finish in time";
+    result.verifySeconds = 0;
+  }
+  return found;
+}
+
+
+//====================================================
+bool StageWorkerPool::written(long id, unsigned long long& bytes, double& modified) const {
+  map<long,string>::const_iterator itr = m_copies.find(id);
+  struct stat statbuf;
+  if (itr==m_copies.end() || stat((itr->second).c_str(), &statbuf)!=0)
+    return false;
+  // a preallocated file has its full size from the start, but every write moves its time
+  bytes = statbuf.st_size;
+  modified = statbuf.st_mtim.tv_sec + statbuf.st_mtim.tv_nsec*1E-9;
+  return true;
+}
+
+
+//====================================================
+bool StageWorkerPool::queued(long id) const {
+  deque<Job>::const_iterator itr = m_jobs.begin();
+  for (; itr!=m_jobs.end(); ++itr) {
+    if (itr->id == id)
+      return true;
+  }
+  return false;
+}
+
+
+//====================================================
+bool StageWorkerPool::progress(long id, unsigned long long& bytes) {
+  pthread_mutex_lock(&m_mutex);
+  map<long, unsigned long long>::const_iterator itr = m_progress.find(id);
+  bool running = (itr!=m_progress.end());
+  if (running)
+    bytes = itr->second;
+  pthread_mutex_unlock(&m_mutex);
+  return running;
+}
+
+
+//====================================================
+void StageWorkerPool::setProgress(long id, unsigned long long bytes) {
+  pthread_mutex_lock(&m_mutex);
+  m_progress[id] = bytes;
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+//====================================================
+bool StageWorkerPool::preallocated(long id) {
+  pthread_mutex_lock(&m_mutex);
+  bool whole = m_preallocated.count(id)>0;
+  pthread_mutex_unlock(&m_mutex);
+  return whole;
+}
+
+
+//====================================================
+void StageWorkerPool::setPreallocated(long id) {
+  pthread_mutex_lock(&m_mutex);
+  m_preallocated.insert(id);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+//====================================================
+bool StageWorkerPool::cancelled(long id) {
+  pthread_mutex_lock(&m_mutex);
+  bool stop = m_cancelled.count(id)>0;
+  pthread_mutex_unlock(&m_mutex);
+  return stop;
+}
+
+
+//====================================================
+void* StageWorkerPool::run(void* arg) {
+  static_cast<StageWorkerPool*>(arg)->work();
+  return 0;
+}
+
+
+//====================================================
+void StageWorkerPool::work() {
+  pthread_mutex_lock(&m_mutex);
+  while (true) {
+    while (m_jobs.empty() && !m_stop)
+      pthread_cond_wait(&m_jobCond, &m_mutex);
+    if (m_stop)
+      break;
+
+    Job job = m_jobs.front();
+    m_jobs.pop_front();
+    // a range download can be asked to stop as soon as it leaves the queue
+    if (job.type == RANGES)
+      m_progress[job.id] = 0;
+    else if (job.type == COPY)
+      m_copies[job.id] = job.local;
+    pthread_mutex_unlock(&m_mutex);
+
+    Result result;
+    execute(job, result);
+
+    pthread_mutex_lock(&m_mutex);
+    m_progress.erase(result.id);
+    m_copies.erase(result.id);
+    m_preallocated.erase(result.id);
+    m_cancelled.erase(result.id);
+    m_results.push_back(result);
+    pthread_cond_broadcast(&m_doneCond);
+    if (m_notifyFd>=0) {
+      char token(0);
+      // a full pipe already holds a pending notification
+      if (write(m_notifyFd, &token, 1) < 0) {}
+    }
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+//====================================================
+void StageWorkerPool::execute(const Job& job, Result& result) {
+  result.id = job.id;
+  result.type = job.type;
+  result.key = job.key;
+  result.verifySeconds = 0;
+
+  if (job.type == RANGES) {
+    RangeDownload download(job.src, job.dest, job.size, job.rangeSize, job.nbstreams);
+    RangeProgress listener(*this, job.id);
+    download.setListener(&listener);
+    if (!job.replicas.empty()) {
+      download.setReplicas(job.replicas);
+    } else if (job.allReplicas) {
+      vector<string> replicas;
+      string error;
+      // without the replica list, all ranges come from the given source
+      if (RangeDownload::listReplicas(job.src, job.vo, job.verbose, replicas, error))
+        download.setReplicas(replicas);
+    }
+    result.rc = download.run(result.error);
+    if (result.rc==0 && job.verify)
+      verify(job, download.checksum(), result);
+    return;
+  }
+
+  TransferOptions options;
+  options.vo = job.vo;
+  options.nbstreams = job.nbstreams;
+  options.verbose = job.verbose;
+  options.timeout = job.timeout;
+
+  if (job.type == COPY)
+    result.rc = job.backend->copy(job.src, job.dest, options, result.error);
+  else
+    result.rc = job.backend->replicate(job.src, job.dest, options, result.error);
+
+  if (result.rc == 0 && job.type == COPY && job.verify) {
+    unsigned long checksum;
+    double start = currentTime();
+    bool read = Adler32::ofFile(job.local, checksum);
+    result.verifySeconds = currentTime() - start;
+    if (read) {
+      verify(job, checksum, result);
+    } else {
+      result.rc = 1;
+      result.error = "cannot read " + job.local + " to verify its checksum";
+    }
+  }
+}
+
+
+//====================================================
+void StageWorkerPool::verify(const Job& job, unsigned long checksum, Result& result) {
+  if (checksum == job.checksum)
+    return;
+  result.rc = 1;
+  result.error = "checksum mismatch: expected adler32 " + Adler32::format(job.checksum)
+                 + ", got " + Adler32::format(checksum);
+}
@@ -0,0 +1,173 @@
+#ifndef STAGEWORKERPOOL_H
+#define STAGEWORKERPOOL_H 1
+
+#include <pthread.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "ITransferBackend.h"
+
+using namespace std ;
+
+/**  @class StageWorkerPool  StageWorkerPool.h
+ *   A bounded pool of worker threads running the transfers (through an
+ *   ITransferBackend, or as a RangeDownload) inside the job process, as an alternative to
+ *   forking the whole process for every staged file.
+ *   Jobs are queued by the StageManager; the workers never touch the
+ *   StageManager bookkeeping, they only report a Result which is collected
+ *   by the StageManager on its own thread. Copies with a known checksum are
+ *   verified by the worker, so that a corrupt copy is reported as a failed transfer.
+ *
+ *   @version 1.0
+ */
+class StageWorkerPool {
+public:
+
+  /// COPY and REPLICATE go through the backend of the job; RANGES runs a RangeDownload
+  enum JobType { COPY, REPLICATE, RANGES };
+
+  /// Everything a worker needs to run one transfer, copied from the StagerInfo at submission time
+  struct Job {
+    long id;
+    JobType type;
+    string key;
+    /// COPY and REPLICATE: backend running the transfer; must outlive the pool
+    ITransferBackend* backend;
+    string src;
+    string dest;
+    string vo;
+    int nbstreams;
+    int verbose;
+    int timeout;
+    /// RANGES only: file size, range size in bytes, and whether all replicas are used
+    unsigned long long size;
+    unsigned long long rangeSize;
+    bool allReplicas;
+    /// RANGES only: sources in order of preference; listed by the job if empty and allReplicas is set
+    vector<string> replicas;
+    /// COPY and RANGES: if verify is set, the local copy (without prefix) must have the Adler-32 checksum
+    bool verify;
+    unsigned long checksum;
+    string local;
+  };
+
+  /// Outcome of a finished job, handed back to the StageManager; a failure until a job fills it
+  struct Result {
+    Result() : id(0), type(COPY), rc(1), verifySeconds(0) {}
+    long id;
+    JobType type;
+    string key;
+    int rc;
+    string error;
+    /// time spent reading the copy back to verify its checksum, 0 if not verified separately
+    double verifySeconds;
+  };
+
+  StageWorkerPool();
+  ~StageWorkerPool();
+
+  /** Starts the worker threads. Calling it on a running pool has no effect.
+   *  @param nWorkers number of worker threads, i.e. the maximal number of concurrent transfers
+   */
+  void start(int nWorkers);
+
+  /** Drops all queued jobs and joins the worker threads, after they finish their current transfer.
+   *  The dropped jobs are completed with a failed Result.
+   */
+  void stop();
+
+  bool running() const {
+    return !m_threads.empty();
+  }
+
+  /** Sets a file descriptor to which one byte is written every time a job finishes,
+   *  so that the owner can be woken up instead of polling.
+   *  @param fd the write end of a non-blocking pipe, or -1 to disable
+   */
+  void setNotifyFd(int fd) {
+    m_notifyFd = fd;
+  }
+
+  /** Queues a transfer job.
+   *  @param job the job description; its id is assigned by the pool
+   *  @param front if true, the job is put in front of the queue (forced staging)
+   *  @return the id of the job
+   */
+  long submit(Job job, bool front=false);
+
+  /** Removes a job from the queue, if it has not been picked up by a worker yet.
+   *  A running range download is asked to stop, and reports back as a failed job;
+   *  other running jobs are stopped through their backend, see ITransferBackend::cancel().
+   *  @return true if the job was still queued and has been dropped
+   */
+  bool cancel(long id);
+
+  /** Non-blocking retrieval of a finished job.
+   *  @return true if a result was available
+   */
+  bool poll(Result& result);
+
+  /** Blocks until the job with the given id has finished and returns its result.
+   *  Results of other jobs are left in place for poll().
+   *  @param timeout seconds the job may run once a worker picked it up without making
+   *  progress: it gets that long again every time a range download reports progress, or
+   *  the local file of a copy is written
+   *  @return false if the job did not finish in time, or is not known to the pool;
+   *  result then holds a failure
+   */
+  bool wait(long id, Result& result, double timeout);
+
+  /** Bytes written so far by a running range download, updated after every complete range
+   *  @return false if the job is not a range download being run by a worker
+   */
+  bool progress(long id, unsigned long long& bytes);
+
+  /// true once a running range download has allocated the blocks of its whole local file
+  bool preallocated(long id);
+
+private:
+
+  StageWorkerPool(const StageWorkerPool&);
+  StageWorkerPool& operator= (const StageWorkerPool&);
+
+  static void* run(void* arg);
+  void work();
+  void execute(const Job& job, Result& result);
+  /// fails the result if the checksum of the local copy is not the expected one
+  static void verify(const Job& job, unsigned long checksum, Result& result);
+  /// true if the job is still waiting for a worker; m_mutex must be held
+  bool queued(long id) const;
+  /// size and modification time of the local file of a running copy; m_mutex must be held
+  bool written(long id, unsigned long long& bytes, double& modified) const;
+
+  /// passes the progress of a range download on to m_progress, and cancellations back to it
+  class RangeProgress;
+  void setProgress(long id, unsigned long long bytes);
+  void setPreallocated(long id);
+  bool cancelled(long id);
+
+  pthread_mutex_t m_mutex;
+  /// signalled when a job is queued or the pool is stopped
+  pthread_cond_t m_jobCond;
+  /// signalled when a job has finished
+  pthread_cond_t m_doneCond;
+
+  deque<Job> m_jobs;
+  deque<Result> m_results;
+  /// bytes written by the running range downloads, per job id
+  map<long, unsigned long long> m_progress;
+  /// local files of the running copies, per job id
+  map<long, string> m_copies;
+  /// running range downloads with a preallocated local file, and those asked to stop
+  set<long> m_preallocated;
+  set<long> m_cancelled;
+  vector<pthread_t> m_threads;
+  long m_nextId;
+  int m_notifyFd;
+  bool m_stop;
+} ;
+
+#endif // STAGEWORKERPOOL_H
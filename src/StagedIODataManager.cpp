@@ -7,9 +7,12 @@
 #include "GaudiKernel/SmartIF.h"
 #include "GaudiKernel/Incident.h"
 #include "GaudiKernel/IIncidentSvc.h"
+#include "GaudiKernel/IMonitorSvc.h"
 #include "FileStager/IFileStagerSvc.h"
 #include "StageManager.h"
 #include <set>
+#include <cstdio>
+#include <sys/time.h>
 
 DECLARE_NAMESPACE_SERVICE_FACTORY(Gaudi,StagedIODataManager)
 
@@ -20,8 +23,21 @@ enum { S_OK = StatusCode::SUCCESS, S_ERROR=StatusCode::FAILURE };
 static std::set
   <std::string>    s_badFiles;
 
+/// names of the origins of the data, by StagedIODataManager::Origin
+static const char* const s_originNames[] = { "local copies", "copies being staged", "remote files" };
+static const char* const s_originTags[] = { "Local", "Staging", "Remote" };
+
+/// timestamp of the read accounting, in seconds
+static inline double ioTime() {
+  struct timeval tp;
+  gettimeofday( &tp, NULL );
+  return tp.tv_sec + tp.tv_usec*1E-6;
+}
+
 StagedIODataManager::StagedIODataManager(CSTR nam, ISvcLocator* svcloc)
-    : base_class(nam, svcloc), m_ageLimit(2) {
+    : base_class(nam, svcloc), m_ageLimit(2), m_lastIoCon(0), m_lastIoStats(0), m_monitorSvc(0) {
+  for (int i=LOCAL; i<=REMOTE; ++i)
+    m_ioTotals[i].origin = Origin(i);
   declareProperty("CatalogType",     m_catalogSvcName="Gaudi::MultiFileCatalog/FileCatalog");
   declareProperty("UseGFAL",         m_useGFAL = true);
   declareProperty("QuarantineFiles", m_quarantine = true);
@@ -53,6 +69,19 @@ StatusCode StagedIODataManager::initialize() {
     return status;
   }
 
+  // optional: the read accounting is reported at finalize anyway
+  if ( !service("MonitorSvc", m_monitorSvc, false).isSuccess() )
+    m_monitorSvc = 0;
+  if ( m_monitorSvc ) {
+    for (int i=LOCAL; i<=REMOTE; ++i) {
+      std::string tag = s_originTags[i];
+      m_monitorSvc->declareInfo("IO"+tag+"Bytes", m_ioTotals[i].bytes,
+                                std::string("bytes read from ")+s_originNames[i]+" (closed files)", this);
+      m_monitorSvc->declareInfo("IO"+tag+"Reads", m_ioTotals[i].reads,
+                                std::string("read calls on ")+s_originNames[i]+" (closed files)", this);
+    }
+  }
+
   m_stager = serviceLocator()->service("FileStagerSvc", false);
   if( !m_stager.isValid() ) {
     log << MSG::ERROR << "Error initializing File Stager Service!" << endmsg;
@@ -63,10 +92,70 @@ StatusCode StagedIODataManager::initialize() {
 
 /// IService implementation: finalize the service
 StatusCode StagedIODataManager::finalize() {
+  while ( !m_ioStats.empty() )
+    closeIoStats((*m_ioStats.begin()).first);
+  MsgStream log(msgSvc(), name());
+  for (int i=LOCAL; i<=REMOTE; ++i) {
+    if ( m_ioTotals[i].reads == 0 && m_ioTotals[i].seeks == 0 )
+      continue;
+    log << MSG::INFO << "Reads from " << s_originNames[i] << ": ";
+    reportIoStats(log, m_ioTotals[i]);
+  }
+  if ( m_monitorSvc )
+    m_monitorSvc->undeclareAll(this);
+  m_monitorSvc = 0;
   m_catalog = 0; // release
   return Service::finalize();
 }
 
+/// Read accounting of a connection
+StagedIODataManager::IoStats& StagedIODataManager::ioStats(Connection* con) {
+  if ( con == m_lastIoCon )
+    return *m_lastIoStats;
+  IoStatsMap::iterator i = m_ioStats.find(con);
+  if ( i == m_ioStats.end() ) {
+    i = m_ioStats.insert(std::make_pair(con, IoStats())).first;
+    const std::string& pfn = con->pfn();
+    if ( m_progress.find(con) != m_progress.end() )
+      (*i).second.origin = STAGING;
+    else if ( (!pfn.empty() && pfn[0] == '/') || ::strncasecmp(pfn.c_str(),"file:",5)==0 )
+      (*i).second.origin = LOCAL;
+  }
+  m_lastIoCon = con;
+  m_lastIoStats = &(*i).second;
+  return *m_lastIoStats;
+}
+
+/// Adds the accounting of a connection to the totals of its origin
+void StagedIODataManager::closeIoStats(Connection* con) {
+  IoStatsMap::iterator i = m_ioStats.find(con);
+  if ( i == m_ioStats.end() )
+    return;
+  const IoStats& stats = (*i).second;
+  if ( stats.reads > 0 || stats.seeks > 0 ) {
+    MsgStream log(msgSvc(), name());
+    log << MSG::INFO << "Reads of " << con->pfn() << " from " << s_originNames[stats.origin] << ": ";
+    reportIoStats(log, stats);
+  }
+  IoStats& total = m_ioTotals[stats.origin];
+  total.bytes += stats.bytes;
+  total.reads += stats.reads;
+  total.seeks += stats.seeks;
+  total.latency.add(stats.latency);
+  m_ioStats.erase(i);
+  m_lastIoCon = 0;
+  m_lastIoStats = 0;
+}
+
+/// Reports the read accounting, ending the message
+void StagedIODataManager::reportIoStats(MsgStream& log, const IoStats& stats) const {
+  double seconds = stats.latency.sum();
+  log << stats.bytes/(1024*1024) << " MB in " << stats.reads << " reads, "
+  << stats.seeks << " seeks; read latency p50 " << stats.latency.percentile(0.50)*1E6
+  << " us, p99 " << stats.latency.percentile(0.99)*1E6 << " us, max " << stats.latency.max()*1E6
+  << " us; " << ((seconds > 0) ? stats.bytes/(1024*1024)/seconds : 0.) << " MB/s while reading" << endmsg;
+}
+
 // Small routine to issue exceptions
 StatusCode StagedIODataManager::error(CSTR msg, bool rethrow) {
   MsgStream log(msgSvc(),name());
@@ -112,7 +201,25 @@ StatusCode StagedIODataManager::connectWrite(Connection* con,IoType mode,CSTR do
 
 /// Read raw byte buffer from input stream
 StatusCode StagedIODataManager::read(Connection* con, void* const data, size_t len) {
-  return establishConnection(con).isSuccess() ? con->read(data,len) : S_ERROR;
+  if ( !establishConnection(con).isSuccess() )
+    return S_ERROR;
+  double start = ioTime();
+  StatusCode sc = S_ERROR;
+  ProgressMap::iterator i = m_progress.find(con);
+  if ( i == m_progress.end() ) {
+    sc = con->read(data,len);
+  } else if ( awaitData(con, (*i).second.offset+len).isSuccess() ) {
+    sc = con->read(data,len);
+    if ( sc.isSuccess() && (i=m_progress.find(con)) != m_progress.end() )
+      (*i).second.offset += len;
+  }
+  // the wait for a staging file is part of the latency seen by the reader
+  IoStats& stats = ioStats(con);
+  stats.latency.add(ioTime()-start);
+  ++stats.reads;
+  if ( sc.isSuccess() )
+    stats.bytes += len;
+  return sc;
 }
 
 /// Write raw byte buffer to output stream
@@ -122,11 +229,53 @@ StatusCode StagedIODataManager::write(Connection* con, const void* data, int len
 
 /// Seek on the file described by ioDesc. Arguments as in ::seek()
 long long int StagedIODataManager::seek(Connection* con, long long int where, int origin) {
-  return establishConnection(con).isSuccess() ? con->seek(where,origin) : -1;
+  if ( !establishConnection(con).isSuccess() )
+    return -1;
+  ++ioStats(con).seeks;
+  ProgressMap::iterator i = m_progress.find(con);
+  if ( i == m_progress.end() )
+    return con->seek(where,origin);
+  long long int target = -1;  // SEEK_END needs the complete file
+  if ( origin == SEEK_SET )
+    target = where;
+  else if ( origin == SEEK_CUR )
+    target = (*i).second.offset + where;
+  if ( !awaitData(con, target).isSuccess() )
+    return -1;
+  long long int pos = con->seek(where,origin);
+  if ( pos >= 0 && (i=m_progress.find(con)) != m_progress.end() )
+    (*i).second.offset = pos;
+  return pos;
+}
+
+/// Wait for a file which is still being staged, or continue reading it from the remote original
+StatusCode StagedIODataManager::awaitData(Connection* con, long long int nbytes) {
+  ProgressMap::iterator i = m_progress.find(con);
+  if ( i == m_progress.end() )
+    return S_OK;
+  if ( StageManager::instance().waitForBytes((*i).second.local, nbytes) )
+    return S_OK;
+
+  Progress p = (*i).second;
+  m_progress.erase(i);
+  // the reads so far came from the local copy, the next ones from the remote file
+  closeIoStats(con);
+  MsgStream log(msgSvc(),name());
+  log << MSG::WARNING << "Local copy " << p.local << " not available, reading "
+  << p.remote << " from offset " << p.offset << endmsg;
+  con->disconnect();
+  con->setPFN(p.remote);
+  if ( !con->connectRead().isSuccess() )
+    return error("awaitData> Cannot connect to remote dataset: PFN="+p.remote,false);
+  if ( p.offset > 0 && con->seek(p.offset,SEEK_SET) != p.offset )
+    return error("awaitData> Cannot resume remote dataset: PFN="+p.remote,false);
+  return S_OK;
 }
 
 StatusCode StagedIODataManager::disconnect(Connection* con) {
   if ( con ) {
+    closeIoStats(con);
+    m_progress.erase(con);
     std::string dataset = con->name();
     std::string dsn = dataset;
     StatusCode sc = con->disconnect();
@@ -262,12 +411,20 @@ StagedIODataManager::connectDataIO(int typ, IoType rw, CSTR dataset, CSTR techno
     <<dsn<<","<<dataset<<","<<technology<<")"<< endmsg;
 
     std::string dataset_local;
+    std::string remote;
     if(m_stager.isValid()) {
 
       sc  = m_stager->getLocalDataset(dataset, dataset_local);
       if (sc.isSuccess()) {
         dsn = dataset_local;
         typ = PFN;
+        // local copy still being staged: keep the original to fall back to
+        StageManager& manager(StageManager::instance());
+        if ( rw == Connection::READ && manager.isProgressive(dataset_local) ) {
+          remote = manager.remoteName(dataset_local);
+          if ( ::strncasecmp(remote.c_str(),"PFN:",4)==0 )
+            remote = remote.substr(4);
+        }
         log << MSG::INFO << " StagedIODataManager: dsn: "<<dsn << endmsg;
         // for ETCs, no EndInputFile event is fired by the EventSelector when the previous file is finished with reading.
         //Only FILE_OPEN_READ is fired from ROOT, but then it is too late: if the file is not fully staged, it will result in an error
@@ -389,6 +546,10 @@ StagedIODataManager::connectDataIO(int typ, IoType rw, CSTR dataset, CSTR techno
           }
         }
         m_connectionMap.insert(std::make_pair(fid,e)).first;
+        if ( !remote.empty() ) {
+          Progress p = { dsn, remote, 0 };
+          m_progress[connection] = p;
+        }
         return S_OK;
       }
       // Here we open the file!
@@ -399,6 +560,10 @@ StagedIODataManager::connectDataIO(int typ, IoType rw, CSTR dataset, CSTR techno
         error("connectDataIO> Cannot connect to database: PFN="+dsn+" FID="+fid,false).ignore();
         return IDataConnection::BAD_DATA_CONNECTION;
       }
+      if ( !remote.empty() ) {
+        Progress p = { dsn, remote, 0 };
+        m_progress[(*fi).second->connection] = p;
+      }
       return S_OK;
     }
     sc = connectDataIO(FID, rw, fid, technology, keep_open, connection);
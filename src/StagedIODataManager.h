@@ -3,8 +3,11 @@
 #include <map>
 #include "GaudiKernel/Service.h"
 #include "GaudiUtils/IIODataManager.h"
+#include "LatencyHistogram.h"
 
 class IIncidentSvc;
+class IMonitorSvc;
+class MsgStream;
 
 /*
  *  LHCb namespace declaration
@@ -21,6 +24,10 @@ namespace Gaudi  {
     * Same functionality implementation with the IODataManager except for
     * connectDataIO() method which checks via the FileStageSvc if a local copy 
     * is available in the bookkeeping and uses it instead of the original dsn.
+    * The reads of every input connection are counted (bytes, calls, seeks and
+    * the latency distribution), by origin of the data: a complete local copy,
+    * a local copy still being staged, or the remote file. The totals per origin
+    * are reported at finalize and declared to the MonitorSvc, if there is one.
     *
     */
   class StagedIODataManager : public extends1<Service, IIODataManager> {
@@ -35,8 +42,28 @@ namespace Gaudi  {
           : type(tech), ioType(iot), connection(con), keepOpen(k) {}
     }
     ;
+    /// Read position of a connection to a file which is still being staged
+    struct Progress  {
+      std::string      local;
+      std::string      remote;
+      long long int    offset;
+    };
+    /// Origin of the data read through a connection
+    enum Origin { LOCAL, STAGING, REMOTE };
+    /// Read accounting of one connection, or of all connections with the same origin
+    struct IoStats  {
+      IoStats() : origin(REMOTE), bytes(0), reads(0), seeks(0), latency(1E-6) {}
+      Origin           origin;
+      double           bytes;
+      long             reads;
+      long             seeks;
+      /// read latencies, from 1 us
+      LatencyHistogram latency;
+    };
     typedef std::map<std::string,Entry*>       ConnectionMap;
     typedef std::map<std::string, std::string> FidMap;
+    typedef std::map<Connection*, Progress>    ProgressMap;
+    typedef std::map<Connection*, IoStats>     IoStatsMap;
 
     /// Property: Name of the file catalog service
     std::string          m_catalogSvcName;
@@ -55,10 +82,29 @@ namespace Gaudi  {
     SmartIF<IFileStagerSvc> m_stager;
     /// Map of FID to PFN
     FidMap               m_fidMap;
+    /// Connections reading files which are still being staged
+    ProgressMap          m_progress;
+    /// Read accounting of the open connections
+    IoStatsMap           m_ioStats;
+    /// Read accounting of the closed connections, by origin
+    IoStats              m_ioTotals[REMOTE+1];
+    /// Last connection looked up in m_ioStats, which is nearly always the next one as well
+    Connection*          m_lastIoCon;
+    IoStats*             m_lastIoStats;
+    /// MonitorSvc the totals are declared to, if the job has one
+    IMonitorSvc*         m_monitorSvc;
     StatusCode connectDataIO(int typ, IoType rw, CSTR fn, CSTR technology, bool keep,Connection* con);
     StatusCode reconnect(Entry* e);
     StatusCode error(CSTR msg, bool rethrow);
     StatusCode establishConnection(Connection* con);
+    /// Waits until the first nbytes (-1: all) of a staging file are local, or reconnects to the remote original
+    StatusCode awaitData(Connection* con, long long int nbytes);
+    /// Read accounting of a connection, created with the current origin of the connection
+    IoStats& ioStats(Connection* con);
+    /// Adds the accounting of a connection to the totals of its origin and forgets it
+    void closeIoStats(Connection* con);
+    /// Reports the read accounting of a connection or of an origin
+    void reportIoStats(MsgStream& log, const IoStats& stats) const;
 
     SmartIF<IIncidentSvc> m_incSvc; ///the incident service
 
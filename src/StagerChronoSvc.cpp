@@ -13,6 +13,7 @@
 
 #include <sys/time.h>
 #include <sys/types.h>
+#include <algorithm>
 
 // Static Factory declaration
 using namespace Gaudi;
@@ -21,12 +22,31 @@ DECLARE_SERVICE_FACTORY(StagerChronoSvc)
 StagerChronoSvc::StagerChronoSvc(const std::string& nam, ISvcLocator* svcLoc) :
     base_class(nam,svcLoc)
     ,m_incidentSvc(0)
+    ,m_chronoSvc(0)
+    ,m_monitorSvc(0)
     ,m_totalWaitTime(0)
     ,m_beginInputFile(0)
     ,m_endInputFile(0)
-,m_totalProcessingTime(0) {
+    ,m_totalProcessingTime(0)
+    ,m_startTime(0)
+    ,m_stallThreshold(1.)
+    ,m_stalls(0)
+    ,m_waitP50(0)
+    ,m_waitP90(0)
+    ,m_waitP99(0)
+    ,m_hiddenFraction(0)
+    ,m_throughputMBs(0) {
   //------------------------------------------------------------------------------
+  declareProperty("StallThreshold", m_stallThreshold);
+}
+
 
+//====================================================
+double StagerChronoSvc::currentTime() {
+  gettimeofday( &tp, NULL );
+  sec   = static_cast<double>( tp.tv_sec );
+  usec = static_cast<double>( tp.tv_usec )/1E6;
+  return sec + usec;
 }
 
 
@@ -44,6 +64,25 @@ StagerChronoSvc::initialize() {
   
   log << MSG::DEBUG << "Added listeners on begin and end of input files." << endmsg;
 
+  // both are optional: the histograms are reported at finalize anyway
+  if (!service("ChronoStatSvc", m_chronoSvc, false).isSuccess())
+    m_chronoSvc = 0;
+  if (!service("MonitorSvc", m_monitorSvc, false).isSuccess())
+    m_monitorSvc = 0;
+  if (m_monitorSvc) {
+    m_monitorSvc->declareInfo("StagerWaitP50", m_waitP50, "median wait for an input file [s]", this);
+    m_monitorSvc->declareInfo("StagerWaitP90", m_waitP90, "90th percentile of the wait for an input file [s]", this);
+    m_monitorSvc->declareInfo("StagerWaitP99", m_waitP99, "99th percentile of the wait for an input file [s]", this);
+    m_monitorSvc->declareInfo("StagerStalls", m_stalls, "waits longer than StallThreshold", this);
+    m_monitorSvc->declareInfo("StagerHiddenFraction", m_hiddenFraction,
+                              "fraction of the wall time spent staging hidden behind the processing", this);
+    m_monitorSvc->declareInfo("StagerThroughput", m_throughputMBs, "staged MB per second of wall time", this);
+  }
+
+  // the first file is waited for from the start of the job
+  m_startTime = currentTime();
+  m_endInputFile = m_startTime;
+
   log << MSG::INFO << "StagerChronoSvc:Initialize() successful" << endmsg;
 
   return StatusCode::SUCCESS;
@@ -59,21 +98,29 @@ StagerChronoSvc::handle(const Incident& inc) {
   if (inc.type() == IncidentType::BeginInputFile) {
 
     // Time stamp before the computations
-    gettimeofday( &tp, NULL );
-    sec   = static_cast<double>( tp.tv_sec );
-    usec = static_cast<double>( tp.tv_usec )/1E6;
-    m_beginInputFile = sec + usec;
+    m_beginInputFile = currentTime();
+    double wait = m_beginInputFile - m_endInputFile;
     log << MSG::DEBUG << "Waiting time for "<< inc.source() << endmsg;
-    log << MSG::DEBUG <<"[EndInputFile(prev) - BeginInputFile (current)] = " <<(m_beginInputFile - m_endInputFile)<<" seconds"<< endmsg;
-    m_totalWaitTime = m_totalWaitTime + (m_beginInputFile-m_endInputFile);
+    log << MSG::DEBUG <<"[EndInputFile(prev) - BeginInputFile (current)] = " << wait <<" seconds"<< endmsg;
+    m_totalWaitTime = m_totalWaitTime + wait;
+    m_waitHist.add(wait);
+    if (wait > m_stallThreshold)
+      ++m_stalls;
+    if (m_chronoSvc)
+      m_chronoSvc->stat("StagerChronoSvc/Wait", wait);
   } else if (inc.type() == IncidentType::EndInputFile) {
-    gettimeofday( &tp, NULL );
-    sec = static_cast<double>( tp.tv_sec );
-    usec = static_cast<double>( tp.tv_usec )/1E6;
-    m_endInputFile = sec + usec;
+    m_endInputFile = currentTime();
+    double processing = m_endInputFile - m_beginInputFile;
     log << MSG::DEBUG << "Processing time for "<< inc.source() << endmsg;
-    log << MSG::DEBUG <<"[BeginInputFile(current)-EndInputFile(current)] = " <<(m_endInputFile-m_beginInputFile)<<" seconds"<< endmsg;
-    m_totalProcessingTime = m_totalProcessingTime + (m_endInputFile-m_beginInputFile);
+    log << MSG::DEBUG <<"[BeginInputFile(current)-EndInputFile(current)] = " << processing <<" seconds"<< endmsg;
+    m_totalProcessingTime = m_totalProcessingTime + processing;
+    m_processingHist.add(processing);
+    if (m_chronoSvc)
+      m_chronoSvc->stat("StagerChronoSvc/Processing", processing);
+    // feeds the adaptive pipe length of the stager
+    StageManager::instance().addProcessingTime(processing);
+    if (m_monitorSvc)
+      updateSummary();
   }
 
 }
@@ -82,12 +129,54 @@ StagerChronoSvc::handle(const Incident& inc) {
 StagerChronoSvc::~StagerChronoSvc() {}
 
 
+//====================================================
+void StagerChronoSvc::updateSummary() {
+  m_waitP50 = m_waitHist.percentile(0.50);
+  m_waitP90 = m_waitHist.percentile(0.90);
+  m_waitP99 = m_waitHist.percentile(0.99);
+
+  long files;
+  unsigned long long bytes;
+  double transferSeconds;
+  StageManager::instance().stagedTotals(files, bytes, transferSeconds);
+  // the part of the wall time spent staging the event loop did not wait for; overlapping
+  // transfers count once
+  double stagingSeconds = StageManager::instance().stagingWallTime();
+  m_hiddenFraction = 0;
+  if (stagingSeconds > 0)
+    m_hiddenFraction = std::max(0., 1. - m_totalWaitTime/stagingSeconds);
+  double wallTime = currentTime() - m_startTime;
+  m_throughputMBs = (wallTime > 0) ? bytes/(1024.*1024.)/wallTime : 0;
+}
+
+
 StatusCode StagerChronoSvc::finalize() {
   // /------------------------------------------------------------------------------
   MsgStream log(msgSvc(), "StagerChronoSvc");
 
+  updateSummary();
+  long files;
+  unsigned long long bytes;
+  double transferSeconds;
+  StageManager::instance().stagedTotals(files, bytes, transferSeconds);
+
+  log << MSG::INFO << "Input files processed: " << m_processingHist.count()
+  << ", staged: " << files << " (" << bytes/(1024*1024) << " MB)" << endmsg;
+  log << MSG::INFO << "Wait for input files [s]: p50 " << m_waitP50 << ", p90 " << m_waitP90
+  << ", p99 " << m_waitP99 << ", max " << m_waitHist.max() << ", total " << m_totalWaitTime << endmsg;
+  log << MSG::INFO << "Processing of input files [s]: p50 " << m_processingHist.percentile(0.50)
+  << ", p90 " << m_processingHist.percentile(0.90) << ", p99 " << m_processingHist.percentile(0.99)
+  << ", total " << m_totalProcessingTime << endmsg;
+  log << MSG::INFO << "Stalls (waits over " << m_stallThreshold << " s): " << m_stalls << endmsg;
+  log << MSG::INFO << "Staging time hidden by prefetching: " << 100*m_hiddenFraction << "%"
+  << " of " << StageManager::instance().stagingWallTime() << " s spent staging ("
+  << transferSeconds << " s of transfers)" << endmsg;
+  log << MSG::INFO << "Effective staging throughput: " << m_throughputMBs << " MB/s" << endmsg;
+
+  if (m_monitorSvc)
+    m_monitorSvc->undeclareAll(this);
+
   log << MSG::INFO <<  "StagerChronoSvc Finalize() successful" << endmsg;
-  log << MSG::VERBOSE << "Total waiting time due to staging: "<< m_totalWaitTime << " seconds" <<endmsg;
   return StatusCode::SUCCESS;
 }
 
@@ -7,9 +7,11 @@
 #include "GaudiKernel/MsgStream.h"
 #include "FileStager/IFileStagerSvc.h"
 #include "StageManager.h"
+#include "LatencyHistogram.h"
 #include "GaudiKernel/IDataProviderSvc.h"
 // #include "GaudiKernel/DataStoreItem.h"
 #include "GaudiKernel/IChronoStatSvc.h"
+#include "GaudiKernel/IMonitorSvc.h"
 #include <string>
 #include <vector>
 
@@ -24,6 +26,15 @@ namespace Gaudi
 }
 
 
+/**  @class StagerChronoSvc  StagerChronoSvc.h
+ *   Measures how long the event loop waits for each input file (EndInputFile of the
+ *   previous file, or the start of the job, to BeginInputFile) and how long it processes
+ *   it (BeginInputFile to EndInputFile). Both distributions are kept in LatencyHistograms;
+ *   at finalize the percentiles, the stalls, the fraction of the wall time spent staging hidden
+ *   behind the processing and the staging throughput are reported. Every wait and
+ *   processing time also goes to the ChronoStatSvc, and the summary figures are
+ *   published to the MonitorSvc, if there is one.
+ */
 class StagerChronoSvc : public extends1 <Service,IIncidentListener>
 {
 public:
@@ -38,12 +49,35 @@ public:
 protected:
   
 private:
-  
+
+  /// current time in seconds since the epoch
+  double currentTime();
+
+  /// recomputes the figures published to the MonitorSvc
+  void updateSummary();
+
  IIncidentSvc* m_incidentSvc;
+  /// optional: ChronoStatSvc collecting the waits and processing times, MonitorSvc publishing the summary
+  IChronoStatSvc* m_chronoSvc;
+  IMonitorSvc* m_monitorSvc;
   struct timeval tp;
   double sec, usec;
   double m_beginInputFile, m_endInputFile;
   double m_totalWaitTime, m_totalProcessingTime;
+  /// time of initialize(), the start of the wait for the first file
+  double m_startTime;
+
+  /// StagerChronoSvc().StallThreshold: a wait longer than this (seconds, default 1) counts as a stall
+  double m_stallThreshold;
+
+  LatencyHistogram m_waitHist;
+  LatencyHistogram m_processingHist;
+
+  /// summary figures, published to the MonitorSvc by reference
+  int m_stalls;
+  double m_waitP50, m_waitP90, m_waitP99;
+  double m_hiddenFraction;
+  double m_throughputMBs;
 };
 
 #endif
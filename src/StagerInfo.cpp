@@ -4,6 +4,23 @@
 
 StagerInfo::StagerInfo()
     : pipeLength(1)
+    , adaptivePipe(false)
+    , minPipeLength(1)
+    , maxPipeLength(5)
+    , prefetchBytes(0)
+    , prefetchFreeFraction(0)
+    , preallocate(false)
+    , progressiveStall(30)
+    , transferThreads(0)
+    , probeThreads(4)
+    , rangeSize(0)
+    , rangeStreams(4)
+    , rangeReplicas(true)
+    , maxRetries(0)
+    , retryBackoff(5)
+    , rankReplicas(false)
+    , nodeCacheLimit(0)
+    , catalogChecksums(true)
     , pid(getpid())
     , baseTmpdir("/tmp")
     , tmpdir("/tmp")
@@ -24,6 +24,32 @@ class StagerInfo
   void setTmpdir();
   void setDefaultTmpdir();
   int pipeLength;
+  bool adaptivePipe;
+  int minPipeLength;
+  int maxPipeLength;
+  unsigned long long prefetchBytes;
+  double prefetchFreeFraction;
+  bool preallocate;
+  vector<string> progressiveExtensions;
+  double progressiveStall;
+  int transferThreads;
+  int probeThreads;
+  unsigned long long rangeSize;
+  int rangeStreams;
+  bool rangeReplicas;
+  int maxRetries;
+  double retryBackoff;
+  bool rankReplicas;
+  string replicaModel;
+  string nodeCacheDir;
+  unsigned long long nodeCacheLimit;
+  /// expected Adler-32 checksums, by input file name as passed to lcg-cp
+  map<string,unsigned long> checksums;
+  /// true to look up the checksums of the other files with their size
+  bool catalogChecksums;
+  /// files the staging timeline is written to at the end of the job, empty for none
+  string timelineTrace;
+  string timelineCsv;
   int pid;
   int gridFTPstreams;
   string infilePrefix;
@@ -0,0 +1,76 @@
+#include "StallReport.h"
+
+namespace {
+  const char* const s_names[] = {
+    "pipeline full", "size probe", "disk space", "node cache", "slow source",
+    "verification", "retry", "fallback"
+  };
+
+  const char* const s_advice[] = {
+    "increase PipeSize (or enable AdaptivePipe), or TransferThreads",
+    "increase ProbeThreads",
+    "raise PrefetchBudgetMB/PrefetchFreeFraction or use a larger BaseTmpdir",
+    "none in this job: another job of the node transfers the same files",
+    "enable RankReplicas, raise ParallelStreams or use RangeSizeMB",
+    "verification reads the copy once more: use a faster BaseTmpdir",
+    "check the failing storage elements; RankReplicas avoids them",
+    "free local space in BaseTmpdir, so that files are staged locally"
+  };
+}
+
+
+//====================================================
+
+StallReport::StallReport() {
+  for (int i=0; i<=FALLBACK; ++i) {
+    m_counts[i] = 0;
+    m_seconds[i] = 0;
+  }
+}
+
+
+//====================================================
+void StallReport::add(Cause cause, double seconds) {
+  ++m_counts[cause];
+  m_seconds[cause] += seconds;
+}
+
+
+//====================================================
+long StallReport::totalCount() const {
+  long total(0);
+  for (int i=0; i<=FALLBACK; ++i)
+    total += m_counts[i];
+  return total;
+}
+
+
+//====================================================
+double StallReport::totalSeconds() const {
+  double total(0);
+  for (int i=0; i<=FALLBACK; ++i)
+    total += m_seconds[i];
+  return total;
+}
+
+
+//====================================================
+StallReport::Cause StallReport::dominant() const {
+  int worst(0);
+  for (int i=1; i<=FALLBACK; ++i)
+    if (m_seconds[i] > m_seconds[worst])
+      worst = i;
+  return Cause(worst);
+}
+
+
+//====================================================
+const char* StallReport::name(Cause cause) {
+  return s_names[cause];
+}
+
+
+//====================================================
+const char* StallReport::advice(Cause cause) {
+  return s_advice[cause];
+}
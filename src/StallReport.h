@@ -0,0 +1,65 @@
+#ifndef STALLREPORT_H
+#define STALLREPORT_H 1
+
+/**  @class StallReport  StallReport.h
+ *   Number and duration of the waits of the event loop for its next input file,
+ *   by cause, as classified by the StageManager when getFile() returns. Every
+ *   cause comes with the configuration change most likely to remove it, so that
+ *   the report at the end of the job points at the actual bottleneck.
+ *
+ *   @version 1.0
+ */
+class StallReport {
+public:
+
+  /// why the event loop had to wait for a file
+  enum Cause {
+    /// the transfer started late, because the files ahead filled the pipeline
+    PIPELINE_FULL,
+    /// the transfer started late, waiting for the size lookup of the file
+    SIZE_PROBE,
+    /// the transfer started late, waiting for free disk space or room in the prefetch budget
+    DISK_SPACE,
+    /// the transfer waited for another job of the node transferring the same file
+    NODE_CACHE,
+    /// the transfer started in time but ran well below the average throughput
+    SLOW_SOURCE,
+    /// most of the wait went into verifying the checksum of the copy
+    VERIFICATION,
+    /// an earlier attempt failed and the file was transferred again
+    RETRY,
+    /// the file went to the shared directory or was replicated, for lack of local space
+    FALLBACK
+  };
+
+  StallReport();
+
+  /// records a wait
+  void add(Cause cause, double seconds);
+
+  long count(Cause cause) const {
+    return m_counts[cause];
+  }
+
+  double seconds(Cause cause) const {
+    return m_seconds[cause];
+  }
+
+  long totalCount() const;
+  double totalSeconds() const;
+
+  /// cause with the longest total wait; only meaningful if totalCount() > 0
+  Cause dominant() const;
+
+  /// short name of a cause
+  static const char* name(Cause cause);
+
+  /// configuration change most likely to remove the waits of a cause
+  static const char* advice(Cause cause);
+
+private:
+  long m_counts[FALLBACK+1];
+  double m_seconds[FALLBACK+1];
+} ;
+
+#endif // STALLREPORT_H